@@ -28,7 +28,10 @@ private:
 
     uint64_t chAlign = 1;
     bool camera = true,
-         chromatic = true;
+         chromatic = true,
+         phase = true; // Initialize camera alignment with phase correlation
+
+    int32_t method = GPT::Align::SIMPLEX; // Engine used by the auto alignment
 
     bool working = false;  // to avoid running over multiple instances
 
@@ -56,6 +56,7 @@ private:
 	// Alignment
 	bool
 		checkCamera = true,
+		checkPhase = true,
 		checkAberration = true;
 
 	// GP-FBM side
@@ -67,6 +68,7 @@ private:
 
 	int32_t
 		alignID = 0,
+		alignMethod = GPT::Align::SIMPLEX,
 		spotSize = 3,
 		numChannels = 1,
 		numThreads = 1;
@@ -21,19 +21,55 @@ public:
 	void applyFilters(void);
 	void saveImages(const fs::path& address);
 
+	// Live preview filters only the frame being viewed, plus the neighbours needed by temporal filters
+	void requestPreview(void);
+	void runPreview(void);
+
 private:
-	// Funtions to display filter options in properties tab
-	void displayContrast(GPT::Filter::Contrast* ptr);
-	void displayMedian(GPT::Filter::Median* ptr);
-	void displayCLAHE(GPT::Filter::CLAHE* ptr);
-	void displaySVD(GPT::Filter::SVD* ptr);
+	// Funtions to display filter options in properties tab, they return true if any parameter changed
+	bool displayContrast(GPT::Filter::Contrast* ptr);
+	bool displayMedian(GPT::Filter::Median* ptr);
+	bool displayCLAHE(GPT::Filter::CLAHE* ptr);
+	bool displaySVD(GPT::Filter::SVD* ptr);
+	bool displayGaussian(GPT::Filter::Gaussian* ptr);
+	bool displayDoG(GPT::Filter::DoG* ptr);
+	bool displayTopHat(GPT::Filter::TopHat* ptr);
+	bool displayTemporal(GPT::Filter::Temporal* ptr);
+	bool displayBackground(GPT::Filter::BackgroundSubtraction* ptr);
+	bool displayNLMeans(double& sigma, double& strength, int64_t& patchRadius, int64_t& searchRadius); // 2D and 2D+t
 
 private:
 	GPT::Movie* mov = nullptr;
 	GPTool* tool = nullptr;
 
-	std::vector<MatXd> vImages;
+	std::vector<MatXf> vImages; // Single precision, as it goes straight into textures
 	std::map<std::string, GPT::Filter::Filter*> vFilters;
+	std::unique_ptr<GPT::ThreadPool> pool = nullptr;
+
+	// Filtered movie after every filter, so applying a changed chain only runs it from the first change
+	GPT::Filter::PrefixCache cache;
+
+	// Movie values are brought to the 0-1 interval with the same limits for every frame of the channel
+	std::pair<double, double> getChannelLimits(int32_t channel);
+	MatXf loadFrame(int32_t channel, uint64_t frame);
+
+	std::map<int32_t, std::pair<double, double>> vLimits; // computed once per channel
+
+	// Live preview runs on its own thread over copies of the filters taken by the GUI thread.
+	// Newer requests replace the one waiting, so only the latest parameters are previewed
+	struct PreviewJob
+	{
+		std::vector<std::unique_ptr<GPT::Filter::Filter>> chain;
+		int32_t channel = 0, frame = 0;
+	};
+
+	MatXf preview;
+	std::unique_ptr<PreviewJob> previewJob = nullptr;
+	std::thread previewThread;
+
+	std::mutex mtx;    // guards preview, the waiting job and channel limits
+	std::mutex runMtx; // serializes applyFilters, which runs the original filters over vImages and the cache in place
+	std::atomic<bool> previewBusy = false;
 
 
 private:
@@ -44,12 +80,15 @@ private:
 		updateTexture = true,
 		viewWindow = false,
 		viewHover = false,
+		livePreview = true,
+		outdated = true, // filters changed since the last time they were applied to the whole movie
 		first = true;
 
 	int32_t
 		currentCH = 0,
 		currentFR = 0,
 		numThreads = 1,
+		cacheMB = 2048,
 		filterCounter = 0;
 
 	std::unique_ptr<GRender::Quad> quad = nullptr;	
@@ -131,14 +131,29 @@ void AlignPlugin::showProperties(void)
 
     if (working)
     {
-        bool v1 = camera, v2 = chromatic; // it cannot change state while working
+        bool v1 = camera, v2 = chromatic, v4 = phase; // it cannot change state while working
+        int32_t v3 = method;
         ImGui::Checkbox("Camera", &v1);
+        ImGui::SameLine();
+        ImGui::Checkbox("Phase correlation", &v4);
         ImGui::Checkbox("Chromatic aberration", &v2);
+        ImGui::RadioButton("Simplex", &v3, GPT::Align::SIMPLEX);
+        ImGui::SameLine();
+        ImGui::RadioButton("Gauss-Newton", &v3, GPT::Align::GAUSS_NEWTON);
+        ImGui::SameLine();
+        ImGui::RadioButton("Beads", &v3, GPT::Align::BEADS);
     }
     else
     {
         ImGui::Checkbox("Camera", &camera);
+        ImGui::SameLine();
+        ImGui::Checkbox("Phase correlation", &phase);
         ImGui::Checkbox("Chromatic aberration", &chromatic);
+        ImGui::RadioButton("Simplex", &method, GPT::Align::SIMPLEX);
+        ImGui::SameLine();
+        ImGui::RadioButton("Gauss-Newton", &method, GPT::Align::GAUSS_NEWTON);
+        ImGui::SameLine();
+        ImGui::RadioButton("Beads", &method, GPT::Align::BEADS);
     }
 
     ImGui::Spacing();
@@ -195,23 +210,26 @@ void AlignPlugin::runAlignment(void)
 
     MoviePlugin *movPlg = reinterpret_cast<MoviePlugin*>(tool->getPlugin("MOVIE"));
 
+    // Filters attached to the movie also help finding the transform
     std::vector<MatXd> vi1, vi2;
     for (uint64_t k = 0; k < nFrames; k++)
     {
         // Correct constrast as set on the movie plugin
         const glm::vec2& ct1 = movPlg->getContrast(0);
-        const MatXd& img1 = movie->getImage(0, k);
+        const MatXd& img1 = movie->getView(0, k);
 
         vi1.emplace_back(changeContrast(img1, ct1));
 
         // Same, but for the selected channel
         const glm::vec2& ct2 = movPlg->getContrast(chAlign);
-        const MatXd& img2 = movie->getImage(chAlign, k);
+        const MatXd& img2 = movie->getView(chAlign, k);
 
         vi2.emplace_back(changeContrast(img2, ct2));
     }
 
     m_align = std::make_unique<GPT::Align>(nFrames, vi1.data(), vi2.data());
+    m_align->setMethod(method);
+    m_align->setPhaseCorrelation(phase, phase);
 
     if (camera)
     {
@@ -291,45 +309,14 @@ static void workOnFrame(Image<TP>* vImg, GPT::Movie* movie, const Mat3d& itrf, c
 {
     const uint64_t
         nChannels = movie->getMetadata().SizeC,
-        nFrames = movie->getMetadata().SizeT,
-        nRows = movie->getMetadata().SizeY,
-        nCols = movie->getMetadata().SizeX,
-        nThreads = std::thread::hardware_concurrency();
+        nFrames = movie->getMetadata().SizeT;
 
+    // Source pixels are the same for every frame of the channel
+    const GPT::WarpMap warp(itrf, movie->getMetadata().SizeX, movie->getMetadata().SizeY);
 
-    auto func = [&](const uint64_t tid) -> void
-    {
-        // Aligning second channel
-        for (uint64_t frame = tid; frame < nFrames; frame += nThreads)
-        {
-            const uint64_t dir = frame * nChannels + channel;
-            const MatXd& old = movie->getImage(channel, frame);
-
-            Image<TP> img(nRows, nCols);
-            for (uint64_t k = 0; k < nRows; k++)
-                for (uint64_t l = 0; l < nCols; l++)
-                {
-                    int64_t x = static_cast<int64_t>(itrf(0, 0) * (l + 0.5) + itrf(0, 1) * (k + 0.5) + itrf(0, 2));
-                    int64_t y = static_cast<int64_t>(itrf(1, 0) * (l + 0.5) + itrf(1, 1) * (k + 0.5) + itrf(1, 2));
-
-                    if (x >= 0 && x < static_cast<int64_t>(nCols) && y >= 0 && y < static_cast<int64_t>(nRows))
-                        img(k, l) = static_cast<TP>(old(y, x));
-                    else
-                        img(k, l) = 0;
-                }
-
-            vImg[dir] = img;
-        }
-    };
-
-
-    std::vector<std::thread> vec(nThreads);
-    for (uint64_t k = 0; k < nThreads; k++)
-        vec[k] = std::thread(func, k);
-
-    for (std::thread& thr : vec)
-        thr.join();
-    
+    GPT::ThreadPool::shared().run(uint32_t(nFrames), [&](uint32_t frame) -> void {
+        warp.apply(movie->getImage(channel, frame), vImg[frame * nChannels + channel]);
+    });
 }
 
 void AlignPlugin::saveTIF(const fs::path& path)
@@ -93,7 +93,14 @@ void Batching::imguiLayer(void)
             ImGui::RadioButton("Bundled", &alignID, ALIGN::BUNDLED);
             ImGui::Spacing();
             ImGui::Checkbox("Camera alignment", &checkCamera);
+            ImGui::SameLine();
+            ImGui::Checkbox("Phase correlation", &checkPhase);
             ImGui::Checkbox("Correct aberrations", &checkAberration);
+            ImGui::RadioButton("Simplex", &alignMethod, GPT::Align::SIMPLEX);
+            ImGui::SameLine();
+            ImGui::RadioButton("Gauss-Newton", &alignMethod, GPT::Align::GAUSS_NEWTON);
+            ImGui::SameLine();
+            ImGui::RadioButton("Beads", &alignMethod, GPT::Align::BEADS);
             ImGui::TreePop();
         }
 
@@ -163,11 +170,12 @@ void Batching::imguiLayer(void)
 
         view_batching = false;
         
-        checkCamera = checkAberration = true;
+        checkCamera = checkAberration = checkPhase = true;
         checkSingle = checkInterpol = false;
         checkCoupled = checkSubstrate = false;
 
         alignID = ALIGN::INDIVIDUAL;
+        alignMethod = GPT::Align::SIMPLEX;
         numChannels = 1;
         suffices.resize(numChannels);
     }
@@ -324,6 +332,9 @@ void Batching::run(void)
         for (int32_t ch = 1; ch < numChannels; ch++)
         {
             GPT::Align var(2, vecImagesToAlign[0].data(), vecImagesToAlign[ch].data());
+            var.setMethod(alignMethod);
+            var.setPhaseCorrelation(checkPhase, checkPhase);
+            var.setSpotSize(spotSize);
 
             if (checkCamera && !cancelBatch)
                 var.alignCameras();
@@ -545,6 +556,9 @@ void Batching::runSamples(const int32_t threadId)
                 for (int32_t ch = 1; ch < numChannels; ch++)
                 {
                     GPT::Align var(2, vImg[0].data(), vImg[ch].data());
+                    var.setMethod(alignMethod);
+                    var.setPhaseCorrelation(checkPhase, checkPhase);
+                    var.setSpotSize(spotSize);
 
                     if (checkCamera)
                         var.alignCameras();
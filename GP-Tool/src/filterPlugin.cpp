@@ -4,6 +4,15 @@ FilterPlugin::FilterPlugin(GPT::Movie* movie, GPTool* ptr) : mov(movie), tool(pt
 
 FilterPlugin::~FilterPlugin(void)
 {
+	// Preview stops after the frame it is filtering
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		previewJob = nullptr;
+	}
+
+	if (previewThread.joinable())
+		previewThread.join();
+
 	for (auto [name, filter] : vFilters)
 		delete filter;
 }
@@ -29,7 +38,12 @@ void FilterPlugin::showProperties(void)
         if (ImGui::Button("Set"))
         {
             currentCH = locCH;
-            loadImages();
+            outdated = true;
+
+            if (livePreview)
+                requestPreview();
+            else
+                loadImages();
         }
 
         // Setting the number of threads to be used during filtering
@@ -39,12 +53,27 @@ void FilterPlugin::showProperties(void)
         ImGui::SetNextItemWidth(width);
         ImGui::DragInt("##threads", &numThreads, 0.5f, 1, std::thread::hardware_concurrency());
 
+        // Memory kept for intermediate results of the chain
+        ImGui::Text(" Cache (MB):");
+        ImGui::SameLine();
+        ImGui::SetCursorPosX(pos);
+        ImGui::SetNextItemWidth(width);
+        ImGui::DragInt("##cache", &cacheMB, 8.0f, 0, 65536);
+
+        // Parameters are tuned on the viewed frame, the whole movie is filtered when applied or saved
+        if (ImGui::Checkbox("Live preview", &livePreview))
+        {
+            updateTexture = true;
+            if (livePreview)
+                requestPreview();
+        }
+
     }
 
     ImGui::Dummy({ 0, 5.0f * GRender::DPI_FACTOR });
 
     // Choosing which filters to use
-	std::vector<const char*> filterNames = { "Contrast", "Median", "CLAHE", "SVD" };
+	std::vector<const char*> filterNames = { "Contrast", "Median", "CLAHE", "SVD", "Gaussian", "DoG", "TopHat", "RunningMean", "TemporalMedian", "Background", "NLMeans", "TemporalNLMeans" };
 
     static uint64_t currentID = 0;
     ImGui::Text("Choose filter:");
@@ -65,8 +94,11 @@ void FilterPlugin::showProperties(void)
 
     ImGui::SameLine();
 
+    bool changed = false;
+
     if (ImGui::Button("Add"))
     {
+        changed = true;
         std::string name = std::to_string(filterCounter++) + "_" + std::string(filterNames[currentID]);
 
         switch (currentID)
@@ -83,6 +115,30 @@ void FilterPlugin::showProperties(void)
         case 3:
             vFilters[name] = new GPT::Filter::SVD();
             break;
+        case 4:
+            vFilters[name] = new GPT::Filter::Gaussian();
+            break;
+        case 5:
+            vFilters[name] = new GPT::Filter::DoG();
+            break;
+        case 6:
+            vFilters[name] = new GPT::Filter::TopHat();
+            break;
+        case 7:
+            vFilters[name] = new GPT::Filter::RunningMean();
+            break;
+        case 8:
+            vFilters[name] = new GPT::Filter::TemporalMedian();
+            break;
+        case 9:
+            vFilters[name] = new GPT::Filter::BackgroundSubtraction();
+            break;
+        case 10:
+            vFilters[name] = new GPT::Filter::NLMeans();
+            break;
+        case 11:
+            vFilters[name] = new GPT::Filter::TemporalNLMeans();
+            break;
         }
     }
 
@@ -114,17 +170,46 @@ void FilterPlugin::showProperties(void)
 
         if (openTree)
         {
-            if (name.find("Contrast") != std::string::npos)
-                displayContrast(reinterpret_cast<GPT::Filter::Contrast*>(ptr));
+            // Temporal filters first, as "TemporalMedian" also contains "Median"
+            if (name.find("RunningMean") != std::string::npos || name.find("TemporalMedian") != std::string::npos)
+                changed |= displayTemporal(reinterpret_cast<GPT::Filter::Temporal*>(ptr));
+
+            else if (name.find("TemporalNLMeans") != std::string::npos)
+            {
+                GPT::Filter::TemporalNLMeans* nlm = reinterpret_cast<GPT::Filter::TemporalNLMeans*>(ptr);
+                changed |= displayTemporal(nlm);
+                changed |= displayNLMeans(nlm->sigma, nlm->strength, nlm->patchRadius, nlm->searchRadius);
+            }
+
+            else if (name.find("NLMeans") != std::string::npos)
+            {
+                GPT::Filter::NLMeans* nlm = reinterpret_cast<GPT::Filter::NLMeans*>(ptr);
+                changed |= displayNLMeans(nlm->sigma, nlm->strength, nlm->patchRadius, nlm->searchRadius);
+            }
+
+            else if (name.find("Background") != std::string::npos)
+                changed |= displayBackground(reinterpret_cast<GPT::Filter::BackgroundSubtraction*>(ptr));
+
+            else if (name.find("Contrast") != std::string::npos)
+                changed |= displayContrast(reinterpret_cast<GPT::Filter::Contrast*>(ptr));
 
             else if (name.find("Median") != std::string::npos)
-                displayMedian(reinterpret_cast<GPT::Filter::Median*>(ptr));
+                changed |= displayMedian(reinterpret_cast<GPT::Filter::Median*>(ptr));
 
             else if (name.find("CLAHE") != std::string::npos)
-                displayCLAHE(reinterpret_cast<GPT::Filter::CLAHE*>(ptr));
+                changed |= displayCLAHE(reinterpret_cast<GPT::Filter::CLAHE*>(ptr));
 
             else if (name.find("SVD") != std::string::npos)
-                displaySVD(reinterpret_cast<GPT::Filter::SVD*>(ptr));
+                changed |= displaySVD(reinterpret_cast<GPT::Filter::SVD*>(ptr));
+
+            else if (name.find("Gaussian") != std::string::npos)
+                changed |= displayGaussian(reinterpret_cast<GPT::Filter::Gaussian*>(ptr));
+
+            else if (name.find("DoG") != std::string::npos)
+                changed |= displayDoG(reinterpret_cast<GPT::Filter::DoG*>(ptr));
+
+            else if (name.find("TopHat") != std::string::npos)
+                changed |= displayTopHat(reinterpret_cast<GPT::Filter::TopHat*>(ptr));
        
             ImGui::Dummy({ 0, 5.0f * GRender::DPI_FACTOR });
 
@@ -136,6 +221,7 @@ void FilterPlugin::showProperties(void)
     
     if (toRemove.size() > 0)
     {
+        changed = true;
         delete vFilters[toRemove]; // Removing from memory to avoid memory leak
         vFilters.erase(toRemove);  // erasing from hash table
 
@@ -147,6 +233,13 @@ void FilterPlugin::showProperties(void)
 
     ImGui::EndChild();
 
+    if (changed)
+    {
+        outdated = true;
+        if (livePreview)
+            requestPreview();
+    }
+
     {
         float pos = 0.8f * ImGui::GetContentRegionAvailWidth();
 
@@ -179,6 +272,24 @@ void FilterPlugin::showProperties(void)
             tool->dialog.createDialog(GDialog::SAVE, "Save TIF file...", { "tif", "ome.tif" }, this,
                 [](const fs::path& path, void* ptr) -> void { std::thread(&FilterPlugin::saveImages, reinterpret_cast<FilterPlugin*>(ptr), path).detach(); });
 
+        // Viewer, alignment and track enhancement use filtered frames straight from the movie
+        if (ImGui::Button("Attach to movie"))
+        {
+            std::vector<GPT::Filter::Filter*> chain;
+            for (auto [name, ptr] : vFilters)
+                chain.push_back(ptr);
+
+            mov->setFilters(currentCH, chain);
+            tool->mailbox.createInfo("Filters attached to channel " + std::to_string(currentCH));
+        }
+
+        ImGui::SameLine();
+        if (ImGui::Button("Detach"))
+        {
+            mov->setFilters(currentCH, {});
+            tool->mailbox.createInfo("Filters detached from channel " + std::to_string(currentCH));
+        }
+
     }
 
     ImGui::End();
@@ -214,8 +325,12 @@ void FilterPlugin::showWindows(void)
     ImGui::Text("Channel: %d", currentCH);
     ImGui::Text("Frame:");
     ImGui::SameLine();
-    if (ImGui::DragInt("##frame", &currentFR, 1.0f, 0, int32_t(vImages.size()) - 1))
+    if (ImGui::DragInt("##frame", &currentFR, 1.0f, 0, int32_t(mov->getMetadata().SizeT) - 1))
+    {
         updateTexture = true;
+        if (livePreview)
+            requestPreview();
+    }
 
     ImGui::End();
 }
@@ -240,8 +355,13 @@ void FilterPlugin::update(float deltaTime)
     if (!viewWindow)
         return;
      
-    // If we are going to use this plugin for real, we load the images
-    if (vImages.empty())
+    // If we are going to use this plugin for real, we load the images. Live preview only needs a few frames
+    if (livePreview)
+    {
+        if (preview.size() == 0 && !previewBusy)
+            requestPreview();
+    }
+    else if (vImages.empty())
         loadImages();
 
     if (viewHover)
@@ -265,14 +385,19 @@ void FilterPlugin::update(float deltaTime)
 
         if (ImGui::IsKeyPressed(GKey::RIGHT))
         {
-            currentFR += (currentFR + 1 == int32_t(vImages.size())) ? 0 : 1;
+            currentFR += (currentFR + 1 == int32_t(mov->getMetadata().SizeT)) ? 0 : 1;
             updateTexture = true;
 
+            if (livePreview)
+                requestPreview();
         }
         else if (ImGui::IsKeyPressed(GKey::LEFT))
         {
             currentFR -= (currentFR == 0) ? 0 : 1;
             updateTexture = true;
+
+            if (livePreview)
+                requestPreview();
         }
     }
 
@@ -282,8 +407,14 @@ void FilterPlugin::update(float deltaTime)
     {
         updateTexture = false;
 
-        MatXf mat = vImages[currentFR].cast<float>();
-        tool->texture.updateFloat("denoise", mat.data());
+        if (livePreview)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (preview.size() > 0)
+                tool->texture.updateFloat("denoise", preview.data());
+        }
+        else if (currentFR < int32_t(vImages.size()))
+            tool->texture.updateFloat("denoise", vImages[currentFR].data());
     }
 
     // Updating frame buffer
@@ -313,87 +444,153 @@ void FilterPlugin::update(float deltaTime)
 ////////////////////////////////////////////////////////////////////////////
 // UTILITY FUNCTIONS
 
-void FilterPlugin::loadImages(void)
+std::pair<double, double> FilterPlugin::getChannelLimits(int32_t channel)
 {
-    uint64_t ST = mov->getMetadata().SizeT;
-    vImages.resize(ST);
-
-    for (uint64_t k = 0; k < ST; k++)
     {
-        vImages[k] = mov->getImage(currentCH, k);
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = vLimits.find(channel);
+        if (it != vLimits.end())
+            return it->second;
+    }
 
-        // This images are not in the 0-1 interval. Let's set this interval using some sort of auto-contrast
-        double
-            bot = 0.8 * vImages[k].minCoeff(),
-            top = 1.2 * vImages[k].maxCoeff();
+    // This images are not in the 0-1 interval. Let's set this interval with percentiles over the whole channel,
+    // so every frame gets the same contrast. Filters attached to the movie see the same frames
+    std::pair<double, double> limits = mov->getChannelLimits(channel);
 
-        vImages[k].array() = (vImages[k].array() - bot) / (top - bot);
-    }
+    std::lock_guard<std::mutex> lock(mtx);
+    vLimits[channel] = limits;
+    return limits;
+}
+
+MatXf FilterPlugin::loadFrame(int32_t channel, uint64_t frame)
+{
+    auto [channelLow, channelHigh] = getChannelLimits(channel);
+
+    float
+        low = float(channelLow),
+        range = channelHigh > channelLow ? float(channelHigh - channelLow) : 1.0f;
+
+    MatXf img = mov->getImage(channel, frame).cast<float>();
+    img = ((img.array() - low) / range).max(0.0f).min(1.0f);
+    return img;
+}
+
+void FilterPlugin::loadImages(void)
+{
+    const GPT::Metadata& meta = mov->getMetadata();
+    vImages.resize(meta.SizeT);
+
+    for (uint64_t k = 0; k < meta.SizeT; k++)
+        vImages[k] = loadFrame(currentCH, k);
 
     // We need to update the texture we are seeing
     updateTexture = true;
 }
 
-void FilterPlugin::applyFilters(void)
+void FilterPlugin::requestPreview(void)
 {
-    // To avoid loading things we don't need, we only load images for display or running the filters
-    if (vImages.empty())
-        loadImages();
+    // GUI keeps changing the filters, so the preview gets its own copies
+    auto job = std::make_unique<PreviewJob>();
+    job->channel = currentCH;
+    job->frame = currentFR;
+
+    for (auto [name, ptr] : vFilters)
+        if (std::unique_ptr<GPT::Filter::Filter> copy = ptr->clone())
+            job->chain.emplace_back(std::move(copy));
 
+    std::lock_guard<std::mutex> lock(mtx);
+    previewJob = std::move(job);
 
-    int64_t 
-        total = vFilters.size() * vImages.size(),
-        counter = 0;
+    if (previewBusy)
+        return;
 
-    // Let's reset the images so we don't need to do it manually every time
-    loadImages();
+    // Previous thread has already left its loop
+    if (previewThread.joinable())
+        previewThread.join();
 
-    for (auto [name, ptr] : vFilters)
+    previewBusy = true;
+    previewThread = std::thread(&FilterPlugin::runPreview, this);
+}
+
+void FilterPlugin::runPreview(void)
+{
+    while (true)
     {
-        if (name.find("SVD") != std::string::npos) // Our special boy 
+        std::unique_ptr<PreviewJob> job = nullptr;
+
         {
-            GPT::Filter::SVD* svd = reinterpret_cast<GPT::Filter::SVD*>(ptr);
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!previewJob)
+            {
+                previewBusy = false;
+                return;
+            }
+
+            job = std::move(previewJob);
+        }
 
-            svd->importImages(vImages);
-            svd->run(cancel);
-            svd->updateImages(vImages);
+        // Temporal filters need their windows around the frame, and windows add up along the chain.
+        // Whole movie contrast only sees these frames, so the preview is an approximation for it
+        int64_t
+            frame = job->frame,
+            numFrames = int64_t(mov->getMetadata().SizeT),
+            reach = 0;
 
-            counter += vImages.size();
-            prog->progress = float(counter) / float(total);
-        }
-        else
+        GPT::Filter::Pipeline pipeline;
+        for (auto& filter : job->chain)
         {
-            // Applying filter on all images
-            auto parallelFunction = [&](int32_t tid, GPT::Filter::Filter* filter) -> void {
-
-                for (int32_t k = tid; k < vImages.size(); k += numThreads)
-                {
-                    if (cancel)
-                        return;
-
-                    filter->apply(vImages[k]);
-
-                    if (tid == 0)
-                    {
-                        counter += numThreads;
-                        prog->progress = float(counter) / float(total);
-                    }
-                }
-            };
-
-            // Splitting in threads
-            std::vector<std::thread> vThr(numThreads);
-            for (int32_t k = 0; k < numThreads; k++)
-                vThr[k] = std::thread(parallelFunction, k, ptr);
-
-            for (std::thread& thr : vThr)
-                thr.join();
+            if (GPT::Filter::SVD* svd = dynamic_cast<GPT::Filter::SVD*>(filter.get()))
+                reach += svd->slice - 1;
+            else if (GPT::Filter::Temporal* temp = dynamic_cast<GPT::Filter::Temporal*>(filter.get()))
+                reach += temp->radius;
+
+            pipeline.add(filter.get());
         }
 
-        // No need to continue with other filters
-        if (cancel)
-            break;
+        int64_t
+            first = std::max<int64_t>(frame - reach, 0),
+            last = std::min<int64_t>(frame + reach, numFrames - 1);
+
+        std::vector<MatXf> vec;
+        for (int64_t k = first; k <= last; k++)
+            vec.emplace_back(loadFrame(job->channel, k));
+
+        // All the cores work on a single frame most of the time
+        bool stop = false;
+        pipeline.run(vec, GPT::ThreadPool::shared(), stop);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            preview = std::move(vec[frame - first]);
+            updateTexture = true;
+        }
     }
+}
+
+void FilterPlugin::applyFilters(void)
+{
+    // Workers are kept alive between executions
+    if (!pool || pool->getNumThreads() != uint32_t(numThreads))
+        pool = std::make_unique<GPT::ThreadPool>(uint32_t(numThreads));
+
+    // Filters keep state while running and vImages is filtered in place, so applying and saving take turns.
+    // Preview runs on its own clones of the chain and never waits here
+    std::lock_guard<std::mutex> lock(runMtx);
+
+    std::vector<GPT::Filter::Filter*> chain;
+    for (auto [name, ptr] : vFilters)
+        chain.push_back(ptr);
+
+    // Frames are normalized per channel, so the channel identifies the input
+    const std::string input = "channel " + std::to_string(currentCH);
+
+    // Cached prefixes replace the frames, so unfiltered images are only loaded without one
+    if (cache.cached(input, chain) == 0)
+        loadImages();
+
+    cache.budget = uint64_t(cacheMB) << 20;
+    cache.onProgress = [&](float value) -> void { prog->progress = value; };
+    cache.run(input, chain, vImages, *pool, cancel);
 
     // Wrapping up function
     if (cancel)
@@ -404,6 +601,7 @@ void FilterPlugin::applyFilters(void)
     else
     {
         updateTexture = true;
+        outdated = false;
         prog->progress = 1.0f;
         tool->mailbox.createInfo("Filters execution completed");
     }
@@ -412,10 +610,24 @@ void FilterPlugin::applyFilters(void)
 
 void FilterPlugin::saveImages(const fs::path& address)
 {
+    // With live preview, the whole movie is only filtered now
+    if (outdated || vImages.empty())
+    {
+        cancel = false;
+        prog = tool->mailbox.createProgress("Applying filters...", [](void* ptr) {
+            FilterPlugin* fil = reinterpret_cast<FilterPlugin*>(ptr);
+            fil->cancel = true;
+            }, this);
+
+        applyFilters();
+        if (cancel)
+            return;
+    }
+
     // Converting images into 16-bit
     std::vector<Image<uint16_t>> vec(vImages.size());
     for (uint64_t k = 0; k < vImages.size(); k++)
-        vec[k] = (65535.0 * vImages[k]).cast<uint16_t>();
+        vec[k] = (65535.0f * vImages[k]).cast<uint16_t>();
 
     // Saving to input path
     GPT::Tiffer::Write wrt(vec);
@@ -428,42 +640,87 @@ void FilterPlugin::saveImages(const fs::path& address)
 // DISPLAY FUNCTIONS
 
 // Display configuration settings for filters
-void FilterPlugin::displayContrast(GPT::Filter::Contrast* ptr)
+bool FilterPlugin::displayContrast(GPT::Filter::Contrast* ptr)
 {
+    bool changed = false;
+
     float low = float(ptr->low);
     float high = float(ptr->high);
 
     ImGui::Text("Low:");
     ImGui::SameLine();
     if (ImGui::DragFloat("##low", &low, 0.1f, 0.0f, high, "%.3f"))
+    {
         ptr->low = double(low);
+        changed = true;
+    }
 
     ImGui::Text("High:");
     ImGui::SameLine();
     if (ImGui::DragFloat("##high", &high, 0.1f, low, 1.0f, "%.3f"))
+    {
         ptr->high = double(high);
+        changed = true;
+    }
+
+    changed |= ImGui::Checkbox("Whole movie", &ptr->wholeMovie);
+
+    if (ptr->wholeMovie)
+    {
+        float
+            lowPerc = float(100.0 * ptr->lowPercentile),
+            highPerc = float(100.0 * ptr->highPercentile);
+
+        ImGui::Text("Low percentile:");
+        ImGui::SameLine();
+        if (ImGui::DragFloat("##lowPerc", &lowPerc, 0.01f, 0.0f, highPerc, "%.2f"))
+        {
+            ptr->lowPercentile = 0.01 * double(lowPerc);
+            changed = true;
+        }
+
+        ImGui::Text("High percentile:");
+        ImGui::SameLine();
+        if (ImGui::DragFloat("##highPerc", &highPerc, 0.01f, lowPerc, 100.0f, "%.2f"))
+        {
+            ptr->highPercentile = 0.01 * double(highPerc);
+            changed = true;
+        }
+    }
 
+    return changed;
 }
 
-void FilterPlugin::displayMedian(GPT::Filter::Median* ptr)
+bool FilterPlugin::displayMedian(GPT::Filter::Median* ptr)
 {
+    bool changed = false;
+
     int32_t sx = int32_t(ptr->sizeX);
     int32_t sy = int32_t(ptr->sizeY);
 
     ImGui::Text("Size X:");
     ImGui::SameLine();
     if (ImGui::DragInt("##sizeX", &sx, 0.5f, 3, 64, "%.3f"))
+    {
         ptr->sizeX = int64_t(sx);
+        changed = true;
+    }
 
     ImGui::Text("Size Y:");
     ImGui::SameLine();
     if (ImGui::DragInt("##sizeY", &sy, 0.5f, 3, 64, "%.3f"))
+    {
         ptr->sizeY = int64_t(sy);
+        changed = true;
+    }
 
+    return changed;
 }
 
-void FilterPlugin::displayCLAHE(GPT::Filter::CLAHE* ptr)
+bool FilterPlugin::displayCLAHE(GPT::Filter::CLAHE* ptr)
 {
+    bool changed = false;
+
     int32_t
         TX = int32_t(ptr->tileSizeX),
         TY = int32_t(ptr->tileSizeY);
@@ -474,23 +731,35 @@ void FilterPlugin::displayCLAHE(GPT::Filter::CLAHE* ptr)
     ImGui::Text("Tile X:");
     ImGui::SameLine();
     if (ImGui::DragInt("##tileX", &TX, 0.5f, 8, 256))
+    {
         ptr->tileSizeX = int64_t(TX);
+        changed = true;
+    }
 
     ImGui::Text("Tile Y:");
     ImGui::SameLine();
     if (ImGui::DragInt("##tileY", &TY, 0.5f, 8, 256))
+    {
         ptr->tileSizeY = int64_t(TY);
+        changed = true;
+    }
 
 
     ImGui::Text("Clip limit:");
     ImGui::SameLine();
     if (ImGui::DragFloat("##clip", &clip, 0.1f, 0.1f, 10.0f, "%.3f"))
+    {
         ptr->clipLimit = double(clip);
+        changed = true;
+    }
 
+    return changed;
 }
 
-void FilterPlugin::displaySVD(GPT::Filter::SVD* ptr)
+bool FilterPlugin::displaySVD(GPT::Filter::SVD* ptr)
 {
+    bool changed = false;
+
     int32_t
         ST = int32_t(mov->getMetadata().SizeT),
         slice = int32_t(ptr->slice),
@@ -499,13 +768,181 @@ void FilterPlugin::displaySVD(GPT::Filter::SVD* ptr)
     ImGui::Text("Slice:");
     ImGui::SameLine();
     if (ImGui::DragInt("##slice", &slice, 0.5f, 1, ST))
+    {
         ptr->slice = int64_t(slice);
+        changed = true;
+    }
 
     ImGui::Text("Rank:");
     ImGui::SameLine();
     if (ImGui::DragInt("##rank", &rank, 0.5f, 1, ST))
+    {
         ptr->rank = int64_t(rank);
+        changed = true;
+    }
+
+    changed |= ImGui::Checkbox("Truncated", &ptr->truncated);
 
+    return changed;
 }
 
+bool FilterPlugin::displayGaussian(GPT::Filter::Gaussian* ptr)
+{
+    bool changed = false;
+
+    float sx = float(ptr->sigmaX);
+    float sy = float(ptr->sigmaY);
+
+    ImGui::Text("Sigma X:");
+    ImGui::SameLine();
+    if (ImGui::DragFloat("##sigmaX", &sx, 0.1f, 0.0f, 64.0f, "%.2f"))
+    {
+        ptr->sigmaX = double(sx);
+        changed = true;
+    }
+
+    ImGui::Text("Sigma Y:");
+    ImGui::SameLine();
+    if (ImGui::DragFloat("##sigmaY", &sy, 0.1f, 0.0f, 64.0f, "%.2f"))
+    {
+        ptr->sigmaY = double(sy);
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool FilterPlugin::displayDoG(GPT::Filter::DoG* ptr)
+{
+    bool changed = false;
+
+    float low = float(ptr->sigmaLow);
+    float high = float(ptr->sigmaHigh);
+
+    ImGui::Text("Sigma low:");
+    ImGui::SameLine();
+    if (ImGui::DragFloat("##sigmaLow", &low, 0.1f, 0.0f, high, "%.2f"))
+    {
+        ptr->sigmaLow = double(low);
+        changed = true;
+    }
+
+    ImGui::Text("Sigma high:");
+    ImGui::SameLine();
+    if (ImGui::DragFloat("##sigmaHigh", &high, 0.1f, low, 64.0f, "%.2f"))
+    {
+        ptr->sigmaHigh = double(high);
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool FilterPlugin::displayTopHat(GPT::Filter::TopHat* ptr)
+{
+    bool changed = false;
 
+    int32_t rx = int32_t(ptr->radiusX);
+    int32_t ry = int32_t(ptr->radiusY);
+
+    ImGui::Text("Radius X:");
+    ImGui::SameLine();
+    if (ImGui::DragInt("##radiusX", &rx, 0.5f, 1, 128))
+    {
+        ptr->radiusX = int64_t(rx);
+        changed = true;
+    }
+
+    ImGui::Text("Radius Y:");
+    ImGui::SameLine();
+    if (ImGui::DragInt("##radiusY", &ry, 0.5f, 1, 128))
+    {
+        ptr->radiusY = int64_t(ry);
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool FilterPlugin::displayTemporal(GPT::Filter::Temporal* ptr)
+{
+    bool changed = false;
+
+    int32_t
+        ST = int32_t(mov->getMetadata().SizeT),
+        radius = int32_t(ptr->radius);
+
+    ImGui::Text("Radius:");
+    ImGui::SameLine();
+    if (ImGui::DragInt("##radius", &radius, 0.5f, 1, ST))
+    {
+        ptr->radius = int64_t(radius);
+        changed = true;
+    }
+
+    return changed;
+}
+
+bool FilterPlugin::displayBackground(GPT::Filter::BackgroundSubtraction* ptr)
+{
+    bool changed = displayTemporal(ptr);
+    changed |= ImGui::Checkbox("Photobleaching", &ptr->compensateBleaching);
+
+    return changed;
+}
+
+bool FilterPlugin::displayNLMeans(double& sigma, double& strength, int64_t& patchRadius, int64_t& searchRadius)
+{
+    bool changed = false;
+
+    // Negative sigma estimates the noise from every frame
+    bool automatic = sigma < 0.0;
+    if (ImGui::Checkbox("Estimate noise", &automatic))
+    {
+        sigma = automatic ? -1.0 : 0.05;
+        changed = true;
+    }
+
+    if (!automatic)
+    {
+        float sig = float(sigma);
+        ImGui::Text("Sigma:");
+        ImGui::SameLine();
+        if (ImGui::DragFloat("##sigma", &sig, 0.001f, 0.001f, 1.0f, "%.3f"))
+        {
+            sigma = double(sig);
+            changed = true;
+        }
+    }
+
+    float str = float(strength);
+    ImGui::Text("Strength:");
+    ImGui::SameLine();
+    if (ImGui::DragFloat("##strength", &str, 0.01f, 0.05f, 4.0f, "%.2f"))
+    {
+        strength = double(str);
+        changed = true;
+    }
+
+    int32_t
+        patch = int32_t(patchRadius),
+        search = int32_t(searchRadius);
+
+    ImGui::Text("Patch radius:");
+    ImGui::SameLine();
+    if (ImGui::DragInt("##patchRadius", &patch, 0.2f, 1, 5))
+    {
+        patchRadius = int64_t(patch);
+        changed = true;
+    }
+
+    ImGui::Text("Search radius:");
+    ImGui::SameLine();
+    if (ImGui::DragInt("##searchRadius", &search, 0.2f, 1, 15))
+    {
+        searchRadius = int64_t(search);
+        changed = true;
+    }
+
+    return changed;
+}
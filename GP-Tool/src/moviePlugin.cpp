@@ -322,7 +322,7 @@ void MoviePlugin::calcHistogram(uint64_t channel)
     float low = loc->contrast.x,
           high = loc->contrast.y;
 
-    const MatXd &mat = movie->getImage(channel, current_frame);
+    const MatXd &mat = movie->getView(channel, current_frame);
 
     loc->histogram.fill(0.0f);
     const size_t N = mat.cols() * mat.rows();
@@ -375,7 +375,7 @@ void MoviePlugin::updateTexture(uint64_t channel)
           high = info[channel].contrast.y;
 
     // Let's use this function to update out textures for the shader
-    MatXf img = movie->getImage(channel, current_frame).cast<float>();
+    MatXf img = movie->getView(channel, current_frame).cast<float>();
     img = (img.array() - low) / (high - low);
     tool->texture.updateFloat(std::to_string(channel), img.data());
 }
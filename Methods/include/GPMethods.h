@@ -4,4 +4,5 @@
 #include <trajectory.h>
 #include <gp_fbm.h>
 #include <align.h>
-#include <filters.h>
\ No newline at end of file
+#include <filters.h>
+#include <threadpool.h>
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 #include "header.h"
 #include "goptimize.h"
+#include "filters.h"
+
+#include <mutex>
+#include <atomic>
 
 namespace GPT
 {
@@ -20,12 +24,60 @@ namespace GPT
         GP_API void update(void);
     };
 
+    // Nearest source pixel for every pixel of an aligned frame. All frames of a channel share
+    // the same transform, so the map is computed once and every frame is only a gather
+    struct WarpMap
+    {
+        GP_API WarpMap(const Mat3d &itrf, uint64_t width, uint64_t height);
+        GP_API WarpMap(void) = default;
+        GP_API ~WarpMap(void) = default;
+
+        Vec2u size;
+        std::vector<int32_t> source; // Index into the column-major source for every row-major pixel, -1 if outside
+
+        template <typename TP>
+        void apply(const MatXd &src, Image<TP> &dst) const
+        {
+            dst.resize(size(1), size(0));
+
+            const int64_t nCols = size(0), nRows = size(1), tile = 32;
+            const double *in = src.data();
+            TP *out = dst.data();
+
+            // Source is column-major and destination row-major, so tiles keep both of them in cache
+            for (int64_t r0 = 0; r0 < nRows; r0 += tile)
+                for (int64_t c0 = 0; c0 < nCols; c0 += tile)
+                    for (int64_t r = r0; r < std::min(r0 + tile, nRows); r++)
+                        for (int64_t k = r * nCols + c0; k < r * nCols + std::min(c0 + tile, nCols); k++)
+                            out[k] = source[k] < 0 ? TP(0) : static_cast<TP>(in[source[k]]);
+        }
+    };
+
     class Align
     {
     public:
         GP_API Align(uint64_t nFrames, const MatXd *vim1, const MatXd *vim2);
         GP_API ~Align(void) = default;
 
+        // Engines available to alignCameras and correctAberrations
+        enum Method : int32_t
+        {
+            SIMPLEX = 0,      // Nelder-Mead on nearest pixel differences, derivative free
+            GAUSS_NEWTON = 1, // Damped Gauss-Newton on bilinear differences, with analytic image gradients
+            BEADS = 2,        // Least squares on matched bead centroids, for calibration images
+        };
+
+        GP_API void setMethod(int32_t value) { method = value; }
+        GP_API int32_t getMethod(void) const { return method; }
+
+        // Half size of the region fitted around every bead, only used by BEADS
+        GP_API void setSpotSize(uint64_t value) { spotSize = value; }
+
+        // Camera alignment starts from the translation found by phase correlation, and optionally
+        // from the rotation found by phase correlation of the log-polar magnitude spectra. Off by default
+        GP_API void setPhaseCorrelation(bool translation, bool rotation = true) { phaseTranslation = translation; phaseRotation = rotation; }
+        GP_API bool phaseCorrelation(void); // Keeps the estimate with lowest energy, including the current translation and rotation
+
         GP_API bool alignCameras(void);
         GP_API bool correctAberrations(void);
         GP_API void stop(void);
@@ -34,19 +86,53 @@ namespace GPT
 
 
     private:
-        TransformData RT;                       // Transformation parameters
-        std::vector<Image<uint8_t>> vIm0, vIm1; // Treated images
+        TransformData RT; // Transformation parameters
+
+        // Treated images as coarse to fine pyramids, indexed by level and then by frame.
+        // Level 0 is the full resolution and every level halves the size of the previous one
+        std::vector<std::vector<Image<uint8_t>>> vIm0, vIm1;
+
+        // Frame averages of the raw images and the bead centroids found on them, detected on first use
+        MatXd avg0, avg1;
+        std::vector<Vec2d> beads0, beads1;
+        uint64_t spotSize = 3;
 
         std::unique_ptr<GOptimize::NMSimplex> nms = nullptr;
+        std::mutex mtxSimplex; // Guards nms, which optimize replaces at every level while stop may use it
+        int32_t method = SIMPLEX;
+        bool phaseTranslation = false, phaseRotation = false;
+        std::atomic<bool> stopped = false;
 
         // Parallel variables
-        Mat3d itrf;
+        uint64_t level = 0; // Pyramid level being optimized
+        Mat3d itrf;         // Inverse transform at this level
         std::vector<double> global_energy;
 
         void calcEnergy(const uint64_t id, const uint64_t nThr);
+        double evaluate(const Mat3d &trf); // Energy for a transform given in full resolution pixels
+        double arcRadius(void) const { return 0.5 * double(std::max(RT.size(0), RT.size(1))); } // Angles are optimized as arcs, so steps are in pixels
         double weightTransRot(const VecXd &p);
         double weightScale(const VecXd &p);
 
+        // Transforms in full resolution pixels, parameters as in weightTransRot and weightScale
+        Mat3d transRotMatrix(const VecXd &p) const;
+        Mat3d scaleMatrix(const VecXd &p) const;
+
+        // Derivatives of the transforms above with respect to parameter k, in closed form
+        Mat3d transRotDiff(const VecXd &p, int64_t k) const;
+        Mat3d scaleDiff(const VecXd &p, int64_t k) const;
+
+        // Nelder-Mead from the coarsest level down to full resolution, with the initial step halved at every level
+        bool optimize(VecXd &vec, double step, double (Align::*weight)(const VecXd &));
+
+        // Levenberg-Marquardt from the coarsest level down to full resolution, model gives the transform for the parameters
+        // and diff its derivative with respect to one of them
+        bool gaussNewton(VecXd &vec, const std::function<Mat3d(const VecXd &)> &model,
+                         const std::function<Mat3d(const VecXd &, int64_t)> &diff);
+
+        // Matches beads with RANSAC and solves translation and rotation, plus scale if requested, by least squares
+        bool registerBeads(bool withScale);
+
     };
 
 }
\ No newline at end of file
@@ -2,6 +2,12 @@
 
 #include "header.h"
 
+#include <list>
+#include <deque>
+#include <functional>
+
+#include "threadpool.h"
+
 namespace GPT::Filter
 {
 	// Base class from which all the other filters will be derived
@@ -10,24 +16,84 @@ namespace GPT::Filter
 		Filter(void) = default;
 		virtual ~Filter(void) = default;
 
+		// Floating point images are in between 0 and 1 and integer images use their full range.
+		// Filters without their own kernels for float and uint16_t go through double precision
 		virtual void apply(MatXd& img) {}
+		GP_API virtual void apply(MatXf& img);
+		GP_API virtual void apply(Image<uint16_t>& img);
+
+		// Blocks of lines a single image is split into. They run on the pool executing the caller, see ThreadPool::current
+		uint32_t numThreads = 1;
+
+		// Blocks for the call running on this thread. Pipeline stages give their own budget from the number of frames
+		// and threads, without writing to the filter, otherwise it is numThreads
+		GP_API uint32_t threads(void) const;
+
+		// Filter type and parameters, so equal signatures give equal results on the same frames.
+		// Filters with an empty signature are never cached
+		virtual std::string signature(void) const { return ""; }
+
+		// Copy with the same parameters, for chains kept by other objects
+		virtual std::unique_ptr<Filter> clone(void) const { return nullptr; }
+	};
+
+	// Histogram over a fixed range, filled one frame at a time with O(bins) memory.
+	// Bins are centered at evenly spaced values, and values outside the range go to the edge bins
+	class Histogram
+	{
+	public:
+		GP_API Histogram(double low = 0.0, double high = 1.0, uint32_t numBins = 65536);
+		GP_API ~Histogram(void) = default;
+
+		GP_API void add(const MatXd& img);
+		GP_API void add(const MatXf& img);
+		GP_API void add(const Image<uint16_t>& img); // Full range is mapped to the 0 to 1 interval
+		GP_API void merge(const Histogram& other);
+
+		GP_API uint64_t getCount(void) const { return count; }
+		GP_API double percentile(double value) const; // value in between 0 and 1
+
+	private:
+		template <typename T>
+		void addValues(const T* data, int64_t size, double scale);
+
+	private:
+		std::vector<uint64_t> bins;
+		double low, width;
+		uint64_t count = 0;
 	};
 
 	struct Contrast : public Filter
 	{
-		double low = -1.0, high = -1.0; // Negative values mean auto-contrast, otherwise, betweem 0 and 1
+		double low = -1.0, high = -1.0; // Negative values mean per-frame auto-contrast, otherwise, betweem 0 and 1
+
+		// Whole movie auto-contrast uses the same percentile limits for every frame.
+		// Pipeline builds the histogram from all the frames reaching this filter
+		bool wholeMovie = false;
+		double lowPercentile = 0.001, highPercentile = 0.999;
+
+		// Limits found from the histogram are kept apart from low and high, they are only used while wholeMovie is set
+		GP_API void setLimits(const Histogram& hist);
 
 		GP_API Contrast(double lowValue, double highValue) : low(lowValue), high(highValue) {}
 		GP_API Contrast(void) = default;
 		GP_API ~Contrast(void) = default;
 
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<Contrast>(*this); }
 		GP_API void apply(MatXd& img) override;
+		GP_API void apply(MatXf& img) override;
+		GP_API void apply(Image<uint16_t>& img) override;
+
+	private:
+		double movieLow = -1.0, movieHigh = -1.0;
 	};
 
 
 	struct Median : public Filter
 	{
-		// For now, we are going to shrink the tile around the boundary
+		// For now, we are going to shrink the tile around the boundary.
+		// Tiles of 3x3 and 5x5 use sorting networks, bigger tiles use a running histogram with 16-bit bins
 
 		int64_t sizeX = 5, sizeY = 5;
 
@@ -35,7 +101,11 @@ namespace GPT::Filter
 		GP_API Median(void) = default;
 		GP_API ~Median(void) = default;
 
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<Median>(*this); }
 		GP_API void apply(MatXd& img) override;
+		GP_API void apply(MatXf& img) override;
+		GP_API void apply(Image<uint16_t>& img) override;
 	};
 
 	struct CLAHE : public Filter
@@ -49,18 +119,113 @@ namespace GPT::Filter
 		GP_API CLAHE(void) = default;
 		GP_API ~CLAHE(void) = default;
 
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<CLAHE>(*this); }
+		GP_API void apply(MatXd& img) override;
+		GP_API void apply(MatXf& img) override;
+		GP_API void apply(Image<uint16_t>& img) override;
+	};
+
+
+	struct Gaussian : public Filter
+	{
+		// Recursive 4th order Deriche filter, the cost per pixel doesn't depend on sigma.
+		// Sigmas below 0.5 leave that direction untouched
+
+		double sigmaX = 1.0, sigmaY = 1.0;
+
+		GP_API Gaussian(double sigmaX, double sigmaY) : sigmaX(sigmaX), sigmaY(sigmaY) {}
+		GP_API Gaussian(void) = default;
+		GP_API ~Gaussian(void) = default;
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<Gaussian>(*this); }
+		GP_API void apply(MatXd& img) override;
+		GP_API void apply(MatXf& img) override;
+		GP_API void apply(Image<uint16_t>& img) override;
+	};
+
+	struct DoG : public Filter
+	{
+		// Difference of Gaussians, values below zero are kept for floating point images
+		double sigmaLow = 1.0, sigmaHigh = 3.0;
+
+		GP_API DoG(double sigmaLow, double sigmaHigh) : sigmaLow(sigmaLow), sigmaHigh(sigmaHigh) {}
+		GP_API DoG(void) = default;
+		GP_API ~DoG(void) = default;
+
+		using Filter::apply;
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<DoG>(*this); }
+		GP_API void apply(MatXd& img) override;
+		GP_API void apply(MatXf& img) override;
+	};
+
+	struct TopHat : public Filter
+	{
+		// Background removal by subtracting the opening with a rectangle, which approximates a rolling ball.
+		// Minimum and maximum use van Herk/Gil-Werman, so the cost per pixel doesn't depend on the size
+		int64_t radiusX = 5, radiusY = 5;
+
+		GP_API TopHat(int64_t radiusX, int64_t radiusY) : radiusX(radiusX), radiusY(radiusY) {}
+		GP_API TopHat(void) = default;
+		GP_API ~TopHat(void) = default;
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<TopHat>(*this); }
 		GP_API void apply(MatXd& img) override;
+		GP_API void apply(MatXf& img) override;
+		GP_API void apply(Image<uint16_t>& img) override;
 	};
 
+	struct NLMeans : public Filter
+	{
+		// Buades, Coll and Morel, "Non-Local Means Denoising", IPOL 1 (2011). Patch distances come from an
+		// integral image of squared differences for every offset, so the cost per pixel doesn't depend on the patch size
+
+		// Noise standard deviation between 0 and 1, negative values estimate it from every frame.
+		// Weights decay with strength * sigma
+		double sigma = -1.0, strength = 0.4;
+		int64_t patchRadius = 1, searchRadius = 5;
+
+		GP_API NLMeans(double sigma, int64_t patchRadius, int64_t searchRadius) : sigma(sigma), patchRadius(patchRadius), searchRadius(searchRadius) {}
+		GP_API NLMeans(void) = default;
+		GP_API ~NLMeans(void) = default;
+
+		using Filter::apply;
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<NLMeans>(*this); }
+		GP_API void apply(MatXd& img) override;
+	};
+
+	// Filters that need neighbouring frames. Frames are pushed in order and every frame is
+	// handed to emit as soon as no later frame can change it
+	struct Window : public Filter
+	{
+		Window(void) = default;
+		virtual ~Window(void) = default;
+
+		std::function<void(int64_t frame, MatXd& img)> emit;
+
+		virtual void push(const MatXd& /*img*/) {}
+		virtual void flush(void) {} // Emits the remaining frames and restarts the stream
+	};
 
-	class SVD : public Filter
+	class SVD : public Window
 	{
-		// I'm not sure I like all the copies happening, but it should do for now
+		// Frames are streamed through a ring buffer of 2*slice-1 frames. Each window only adds
+		// weights to its frames, and a frame is emitted as the weighted sum of its neighbours
 	public:
 		GP_API SVD(void) = default;
 		GP_API ~SVD(void) = default;
 
 		int64_t slice = 1, rank = 1;
+		bool truncated = true; // Method of snapshots on the slice x slice Gram matrix instead of a full SVD
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<SVD>(*this); }
+		GP_API void push(const MatXd& img) override;
+		GP_API void flush(void) override;
 
 		GP_API void importImages(const std::vector<MatXd>& vec);
 		GP_API void updateImages(std::vector<MatXd>& vec);  // Copies denoised images into vec
@@ -68,7 +233,214 @@ namespace GPT::Filter
 
 		GP_API void run(bool &trigger);
 
+	private:
+		void addWindow(int64_t first, int64_t size);
+		void emitFrame(int64_t frame);
+
 	private:
 		std::vector<MatXd> vImages, denoised;
+
+		// Streaming state, columns are indexed by frame % ring.size()
+		std::vector<MatXd> ring;
+		std::vector<float> counter;
+		MatXd gram, weight; // gram(d, fr) = <fr, fr + d> and weight(d, fr) multiplies frame fr + d - slice + 1
+		int64_t numPushed = 0, numEmitted = 0;
+	};
+
+	// Temporal filters over a centered window of 2*radius+1 frames, which shrinks at both ends of the movie.
+	// Only the frames inside the window are kept, whatever the length of the movie
+	class Temporal : public Window
+	{
+	public:
+		int64_t radius = 2;
+
+		GP_API void push(const MatXd& img) override;
+		GP_API void flush(void) override;
+
+	protected:
+		// Frames entering and leaving the window, count is updated after these calls
+		virtual void insert(const MatXd& img) = 0;
+		virtual void remove(const MatXd& img) = 0;
+		virtual void compute(const MatXd& center, MatXd& out) = 0;
+
+		// Drops the frames in the window without emitting them
+		void restart(void);
+
+		int64_t count = 0;
+
+	private:
+		void emitFrame(int64_t frame);
+
+	private:
+		std::vector<MatXd> ring;
+		int64_t numPushed = 0, numEmitted = 0, oldest = 0;
+	};
+
+	class RunningMean : public Temporal
+	{
+	public:
+		GP_API RunningMean(int64_t radius) { this->radius = radius; }
+		GP_API RunningMean(void) = default;
+		GP_API ~RunningMean(void) = default;
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<RunningMean>(*this); }
+
+	protected:
+		void insert(const MatXd& img) override;
+		void remove(const MatXd& img) override;
+		void compute(const MatXd& center, MatXd& out) override;
+
+	private:
+		MatXd sum;
+	};
+
+	class TemporalMedian : public Temporal
+	{
+		// Every pixel keeps its window sorted, so frames are inserted and removed with binary searches
+	public:
+		GP_API TemporalMedian(int64_t radius) { this->radius = radius; }
+		GP_API TemporalMedian(void) = default;
+		GP_API ~TemporalMedian(void) = default;
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<TemporalMedian>(*this); }
+
+	protected:
+		void insert(const MatXd& img) override;
+		void remove(const MatXd& img) override;
+		void compute(const MatXd& center, MatXd& out) override;
+
+	private:
+		std::vector<double> sorted;
+	};
+
+	class BackgroundSubtraction : public TemporalMedian
+	{
+		// Removes the temporal median of the window. With photobleaching compensation, frames are divided
+		// by their mean intensity before the median, which is then scaled back to the current frame
+	public:
+		GP_API BackgroundSubtraction(int64_t radius) : TemporalMedian(radius) {}
+		GP_API BackgroundSubtraction(void) = default;
+		GP_API ~BackgroundSubtraction(void) = default;
+
+		bool compensateBleaching = true;
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override { return std::make_unique<BackgroundSubtraction>(*this); }
+
+	protected:
+		void insert(const MatXd& img) override;
+		void remove(const MatXd& img) override;
+		void compute(const MatXd& center, MatXd& out) override;
+
+	private:
+		MatXd normalize(const MatXd& img) const;
+	};
+
+	class TemporalNLMeans : public Temporal
+	{
+		// Non-local means searching patches in the 2*radius+1 frames around each frame, parameters as in NLMeans
+	public:
+		GP_API TemporalNLMeans(int64_t radius) { this->radius = radius; }
+		GP_API TemporalNLMeans(void) { radius = 1; }
+		GP_API ~TemporalNLMeans(void) = default;
+
+		double sigma = -1.0, strength = 0.4;
+		int64_t patchRadius = 1, searchRadius = 5;
+
+		GP_API std::string signature(void) const override;
+		GP_API std::unique_ptr<Filter> clone(void) const override;
+
+	protected:
+		void insert(const MatXd& img) override;
+		void remove(const MatXd& img) override;
+		void compute(const MatXd& center, MatXd& out) override;
+
+	private:
+		// Frames in the window and their padded copies, oldest first
+		std::deque<const MatXd*> frames;
+		std::deque<MatXd> padded;
+	};
+
+	// Ordered chain of filters executed frame by frame on a thread pool. Consecutive
+	// per-frame filters run together while the frame is still in cache, and window
+	// filters are barriers streaming over all the frames in order
+	class Pipeline
+	{
+	public:
+		GP_API Pipeline(void) = default;
+		GP_API ~Pipeline(void) = default;
+
+		GP_API void add(Filter* filter); // Filters are not owned by the pipeline
+		GP_API void clear(void) { chain.clear(); }
+		GP_API bool empty(void) const { return chain.empty(); }
+
+		// Filters frames in place. Progress goes from 0 to 1 as frames leave each stage
+		GP_API void run(std::vector<MatXd>& frames, ThreadPool& pool, bool& trigger);
+		GP_API void run(std::vector<MatXf>& frames, ThreadPool& pool, bool& trigger);
+
+		std::function<void(float progress)> onProgress;
+		std::function<void(size_t numFilters)> onStage; // after every stage of run, with the filters applied so far
+
+		// Streaming mode, frames are pushed in order and leave through emit in the same order.
+		// Per-frame stages filter batches of batchSize frames in parallel, which bounds memory.
+		// Whole movie contrast still holds every frame until flush
+		GP_API void push(MatXd img, ThreadPool& pool);
+		GP_API void flush(void); // Emits the remaining frames and restarts the stream
+
+		int64_t batchSize = 8;
+		std::function<void(int64_t frame, MatXd& img)> emit;
+
+	private:
+		std::vector<Filter*> chain;
+
+		struct Stage
+		{
+			std::vector<Filter*> filters;
+			std::vector<MatXd> pending;
+		};
+
+		ThreadPool* pool = nullptr;
+		std::vector<Stage> vStream;
+		int64_t numEmitted = 0;
+
+		void feed(size_t id, MatXd& img);
+		void process(size_t id);
+	};
+
+	// Frames after every stage of a chain, so changing one filter only recomputes the chain from the stage holding it.
+	// The rest of the chain runs as a single Pipeline, so per-frame filters stay fused. Prefixes are keyed by the input
+	// and the signatures of their filters, and the least recently used ones are dropped once the memory budget is exceeded
+	class PrefixCache
+	{
+	public:
+		GP_API PrefixCache(uint64_t budget = uint64_t(2) << 30) : budget(budget) {}
+		GP_API ~PrefixCache(void) = default;
+
+		// Frames come unfiltered, and they are replaced by the longest cached prefix before running the rest
+		GP_API void run(const std::string& input, const std::vector<Filter*>& chain, std::vector<MatXf>& frames, ThreadPool& pool, bool& trigger);
+		GP_API void clear(void);
+
+		// Number of filters of the longest cached prefix. Without one, run needs the unfiltered frames
+		GP_API size_t cached(const std::string& input, const std::vector<Filter*>& chain) const;
+
+		GP_API uint64_t getMemory(void) const { return memory; }
+
+		uint64_t budget; // in bytes
+		std::function<void(float progress)> onProgress;
+
+	private:
+		struct Entry
+		{
+			std::string key;
+			std::vector<MatXf> frames;
+			uint64_t bytes = 0;
+		};
+
+		std::list<Entry> entries; // most recently used first
+		uint64_t memory = 0;
+
+		std::vector<std::string> keys(const std::string& input, const std::vector<Filter*>& chain) const;
 	};
 }
\ No newline at end of file
@@ -68,6 +68,10 @@ namespace GPT
             std::string getMetadata(void);
             std::string getIJMetadata(void);
 
+            // Re-reads the file looking for directories appended since last call.
+            // Useful while the movie is still being acquired. Returns number of new directories
+            uint32_t update(void);
+
             template <typename T>
             Image<T> getImage(const uint32_t id = 0);
 
@@ -79,6 +83,7 @@ namespace GPT
             bool lzw = false;       // if image was compressed used lzw algorithm
 
             uint32_t numDir = 0;
+            uint32_t nextPos = 0; // Position in buffer storing the offset to the next IFD
             Buffer buffer;
 
             std::vector<IFD> vIFD; // To organize the bytes into good information
@@ -89,6 +94,9 @@ namespace GPT
 
             ImData getImageData(const uint32_t id);
 
+            bool readDirectories(void);
+            bool isComplete(IFD &ifd);
+
         }; // class
 
 
@@ -102,6 +110,17 @@ namespace GPT
             GP_API void save(const fs::path &path);
             GP_API void funcLZW(const uint32_t tid, uint32_t nThreads, uint32_t nStrips, IFD* ifd);
 
+            // Streaming mode, every appended image goes straight to disk with its directory,
+            // so memory doesn't grow with the movie. Classic tiff offsets limit files to 4 GB
+            GP_API Write(const fs::path& path, std::string metadata = "");
+            GP_API ~Write(void);
+
+            template <typename T>
+            bool append(const Image<T>& img);
+
+            GP_API bool isOpen(void) const { return stream.is_open(); }
+            GP_API void close(void);
+
         private:
             bool lzw = false;      // if the file lzw compressed
             std::vector<IFD> vIFD; // To organize the bytes into good information
@@ -112,6 +131,12 @@ namespace GPT
             template <typename A>
             void writeValue(Buffer* vOut, A val);
 
+            // Streaming
+            std::ofstream stream;
+            uint64_t streamOffset = 0; // where the next bytes go
+            uint64_t nextPos = 4;      // where the offset of the next ifd has to be written
+
+            GP_API bool appendData(const uint8_t* data, uint64_t size, uint32_t width, uint32_t height, uint16_t bits);
 
             template <typename T>
             void createTable(const std::vector<Image<T>>& vImg, std::string metadata, bool lzw);
@@ -185,6 +210,13 @@ namespace GPT
     template <typename T>
     Tiffer::Write::Write(const std::vector<Image<T>>& vImg, std::string metadata, bool lzw) { createTable(vImg, metadata, lzw); }
 
+    template <typename T>
+    bool Tiffer::Write::append(const Image<T>& img)
+    {
+        uint64_t size = uint64_t(img.size()) * sizeof(T);
+        return appendData(reinterpret_cast<const uint8_t*>(img.data()), size, uint32_t(img.cols()), uint32_t(img.rows()), uint16_t(8 * sizeof(T)));
+    }
+
     template <typename A>
     void Tiffer::Write::writeValue(Buffer* vOut, A val)
     {
@@ -2,11 +2,17 @@
 
 #include "header.h"
 
+#include <array>
+#include <charconv>
+#include <string_view>
+
 #include "gtiffer.h"
 #include "pugixml/pugixml.hpp"
 
 namespace GPT
 {
+    // Unicode code point as UTF-8, for character references in OME-XML and escapes in json
+    GP_API void appendUTF8(std::string& out, uint32_t code);
 
     struct Plane
     {
@@ -56,10 +62,35 @@ namespace GPT
         GP_API Metadata(Tiffer::Read *tif);
 
         GP_API bool hasPlanes(void) const { return (vPlanes.size() > 0); }
-        GP_API const Plane &getPlane(uint64_t c, uint64_t z, uint64_t t) const;
+        GP_API Plane getPlane(uint64_t c, uint64_t z, uint64_t t) const;
+
+        // DeltaT for every frame of a channel at z = 0, useful for gathering time points at once
+        GP_API const VecXd &getDeltaT(uint64_t c) const { return vDeltaT.at(c); }
+
+        // Movies still being acquired outgrow SizeT, planes are indexed again for the new frames
+        GP_API void grow(uint64_t numFrames);
 
     private:
-        std::vector<Plane> vPlanes;
+        // Compact columnar storage for planes, units are interned as they repeat for every plane
+        struct PlaneTable
+        {
+            std::vector<uint32_t> TheC, TheT, TheZ;
+            std::vector<float> DeltaT, ExposureTime, PositionX, PositionY, PositionZ;
+
+            std::vector<std::array<uint16_t, 5>> units; // DeltaT, ExposureTime, PositionX, PositionY, PositionZ
+            std::vector<std::string> names = {""};     // first name is kept for missing units
+
+            uint64_t size(void) const { return TheC.size(); }
+            uint16_t intern(std::string_view unit);
+        };
+
+        PlaneTable vPlanes;
+
+        // Dense (c, z, t) index into vPlanes for constant time lookups
+        std::vector<int64_t> planeIndex;
+        std::vector<VecXd> vDeltaT;
+
+        void indexPlanes(void);
 
         bool parseOME(const std::string &inputString);
         bool parseIJ(const std::string &inputString);
@@ -2,8 +2,16 @@
 
 #include "header.h"
 
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <shared_mutex>
+#include <condition_variable>
+
 #include "gtiffer.h"
 #include "metadata.h"
+#include "filters.h"
 
 namespace GPT
 {
@@ -12,14 +20,40 @@ namespace GPT
 
     public:
         GP_API Movie(const fs::path &movie_path);
-        GP_API ~Movie(void) = default;
+        GP_API ~Movie(void);
 
         GP_API bool successful(void) const { return success; }
 
         GP_API const Metadata &getMetadata(void) const;
         GP_API Metadata &getMetadata(void);
 
-        GP_API const MatXd& getImage(uint64_t channel, uint64_t frame);
+        GP_API const MatXd& getImage(uint64_t channel, uint64_t frame); // Frames load on first use, from any thread
+
+        // Drops a loaded frame, so streaming through long movies doesn't keep them all in memory.
+        // References previously returned for this frame become empty
+        GP_API void release(uint64_t channel, uint64_t frame);
+
+        // Filter chain evaluated lazily over a channel, so filtered frames are used without saving another movie.
+        // Frames are filtered in blocks extended by the neighbours temporal filters need, and kept once computed.
+        // Filters see frames mapped from the channel limits to [0, 1], and filtered frames keep the units of the movie.
+        // References to frames of a replaced chain become empty, and are only valid until the next setFilters
+        GP_API void setFilters(uint64_t channel, const std::vector<Filter::Filter*>& chain); // filters are copied, empty chain removes the layer
+        GP_API bool hasFilters(uint64_t channel);
+        GP_API const MatXd& getFiltered(uint64_t channel, uint64_t frame);
+
+        // Filtered frame if the channel has filters, otherwise the raw frame
+        GP_API const MatXd& getView(uint64_t channel, uint64_t frame);
+
+        // Percentiles 0.1% and 99.9% over every frame of a channel, as filter chains are tuned on frames normalized by them
+        GP_API std::pair<double, double> getChannelLimits(uint64_t channel);
+
+        // Follow mode for movies still being acquired
+        GP_API uint64_t getAvailableFrames(void) const { return available; }
+        GP_API uint64_t update(void); // Looks for new frames, returns how many became available
+
+        // Polls file every interval milliseconds and calls callback for each new frame (all channels written)
+        GP_API void follow(std::function<void(uint64_t frame)> callback, uint32_t interval = 500);
+        GP_API void unfollow(void);
 
     private:
         bool success = true;
@@ -28,7 +62,35 @@ namespace GPT
 
         // We are going to setup for lazy loading
         std::unique_ptr<Tiffer::Read> tif = nullptr;
-        std::vector<MatXd> vImg;
+        std::deque<MatXd> vImg; // deque keeps references valid while frames are appended
+
+        MatXd decode(uint32_t id); // Directory of the file as doubles, callers hold mtx
+
+        struct Layer
+        {
+            std::vector<std::unique_ptr<Filter::Filter>> chain;
+            std::deque<MatXd> vFiltered;
+
+            int64_t reach = 0;        // frames needed on each side of a block
+            int64_t blockSize = 32;   // whole movie if the chain has whole movie contrast
+            double low = 0.0, high = 1.0; // channel limits
+            std::mutex mtx;
+        };
+
+        // Layers are shared, so they outlive setFilters while frames are being filtered.
+        // When both are needed, layer->mtx is always locked before mtx
+        std::vector<std::shared_ptr<Layer>> vLayer;  // one per channel, null without filters
+        std::vector<std::shared_ptr<Layer>> vRetired; // replaced layers, dropped by the next setFilters once no reader holds them
+
+        // Follow mode
+        std::atomic<uint64_t> available = 0;
+        std::function<void(uint64_t)> onFrame;
+
+        std::shared_mutex mtx;
+        std::mutex followMtx;
+        std::condition_variable followCV;
+        std::thread follower;
+        bool following = false;
 
     };
-}
\ No newline at end of file
+}
@@ -21,7 +21,7 @@ namespace GPT
     {
 
     public:
-        Spot(const MatXd &mat);
+        Spot(const MatXd &mat, bool sampleError = true); // Without sampling, error stays at one pixel
 
         const SpotInfo &getSpotInfo(void) const { return info; }
         bool successful(void) const { return flag; }
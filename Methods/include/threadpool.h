@@ -0,0 +1,55 @@
+#pragma once
+
+#include "header.h"
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+namespace GPT
+{
+    // Persistent workers, so we don't create and join threads for every task
+    class ThreadPool
+    {
+    public:
+        GP_API ThreadPool(uint32_t numThreads = 0); // Zero means one thread per core, the calling thread included
+        GP_API ~ThreadPool(void);
+
+        GP_API uint32_t getNumThreads(void) const { return uint32_t(vThr.size()) + 1; }
+
+        // Calls func(k) for every k in [0, numTasks) and returns when all of them are done.
+        // The calling thread also executes tasks, so nested calls from inside a task cannot deadlock
+        GP_API void run(uint32_t numTasks, const std::function<void(uint32_t)>& func);
+
+        // Process wide pool with one thread per core, created on first use
+        GP_API static ThreadPool& shared(void);
+
+        // Pool executing the calling task, so nested work stays in the same pool. Shared pool otherwise
+        GP_API static ThreadPool& current(void);
+
+    private:
+        struct Batch
+        {
+            const std::function<void(uint32_t)>* func = nullptr;
+            uint32_t numTasks = 0;
+
+            std::atomic<uint32_t> next = 0, done = 0;
+
+            std::mutex mtx;
+            std::condition_variable cv;
+        };
+
+        bool work(Batch& batch); // Executes one task, returns false if there is nothing left to do
+        void worker(void);
+
+    private:
+        std::vector<std::thread> vThr;
+        std::deque<std::shared_ptr<Batch>> queue;
+
+        std::mutex mtx;
+        std::condition_variable cv;
+        bool stop = false;
+    };
+}
@@ -1,4 +1,11 @@
 #include "align.h"
+#include "spot.h"
+
+#include <unsupported/Eigen/FFT>
+#include <numeric>
+
+using MatXcd = Eigen::MatrixXcd;
+using VecXcd = Eigen::VectorXcd;
 
 GPT::TransformData::TransformData(uint64_t width, uint64_t height) : size(width, height)
 {
@@ -37,322 +44,1207 @@ void GPT::TransformData::update(void)
 
 } // updateTransform
 
+GPT::WarpMap::WarpMap(const Mat3d &itrf, uint64_t width, uint64_t height) : size(width, height), source(width * height)
+{
+    const int64_t nCols = int64_t(width), nRows = int64_t(height);
+
+    for (int64_t k = 0; k < nRows; k++)
+        for (int64_t l = 0; l < nCols; l++)
+        {
+            int64_t x = int64_t(std::floor(itrf(0, 0) * (l + 0.5) + itrf(0, 1) * (k + 0.5) + itrf(0, 2)));
+            int64_t y = int64_t(std::floor(itrf(1, 0) * (l + 0.5) + itrf(1, 1) * (k + 0.5) + itrf(1, 2)));
+
+            source[k * nCols + l] = (x >= 0 && x < nCols && y >= 0 && y < nRows) ? int32_t(x * nRows + y) : -1;
+        }
+} // constructor
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
-static void autoContrast(MatXd& img)
+static MatXd treatImage(MatXd img, int medianSize, double clipLimit, uint64_t tileSizeX, uint64_t tileSizeY, uint32_t nThreads)
 {
-    double bot = img.minCoeff(), top = img.maxCoeff();
-    img.array() = (img.array() - bot) / (top - bot);
+    // Removing as much noise as possible
+    GPT::Filter::Median median(medianSize, medianSize);
+    median.numThreads = nThreads;
+    median.apply(img);
+
+    // Before anything else, let's correct contrast
+    GPT::Filter::Contrast autoContrast;
+    autoContrast.numThreads = nThreads;
+    autoContrast.apply(img);
+
+    // Enhancing local contrast
+    GPT::Filter::CLAHE clahe(clipLimit, tileSizeX, tileSizeY);
+    clahe.numThreads = nThreads;
+    clahe.apply(img);
+
+    //////////////////////////////////////////
+    // Apply some final auto-contrast to make all images of similar sinal
+
+    autoContrast.apply(img);
+    return img;
 }
 
-static MatXd medianFilter(const MatXd& mat, int64_t medianSize)
+// Every pixel is the rounded mean of a 2x2 block, so pixel centers scale by exactly one half
+static Image<uint8_t> downsample(const Image<uint8_t> &img)
 {
-    MatXd img(mat.rows(), mat.cols());
+    const int64_t
+        width = img.cols() / 2,
+        height = img.rows() / 2;
 
-    int64_t median_radius = static_cast<int64_t>(0.5 * double(medianSize));
-    for (int64_t k = 0; k < mat.rows(); k++)
-        for (int64_t l = 0; l < mat.cols(); l++)
-        {
-            // Getting region
-            int64_t
-                xo = std::max<int64_t>(l - median_radius, 0),
-                yo = std::max<int64_t>(k - median_radius, 0),
-                xf = std::min<int64_t>(l + median_radius + 1, mat.cols()),
-                yf = std::min<int64_t>(k + median_radius + 1, mat.rows());
+    Image<uint8_t> out(height, width);
+    for (int64_t y = 0; y < height; y++)
+    {
+        const uint8_t
+            *top = img.data() + 2 * y * img.cols(),
+            *bottom = top + img.cols();
+
+        uint8_t *row = out.data() + y * width;
+        for (int64_t x = 0; x < width; x++)
+            row[x] = uint8_t((uint32_t(top[2 * x]) + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1] + 2) / 4);
+    }
+
+    return out;
+}
 
-            int64_t size = (yf - yo) * (xf - xo);
+/*******************************************************************/
+/*******************************************************************/
 
-            std::vector<double> vec;
-            vec.reserve(size);
+GPT::Align::Align(uint64_t nFrames, const MatXd *im1, const MatXd *im2)
+{
 
-            for (int64_t y = yo; y < yf; y++)
-                for (int64_t x = xo; x < xf; x++)
-                    vec.push_back(mat(y, x));
+    vIm0.resize(1);
+    vIm1.resize(1);
+    vIm0[0].resize(nFrames);
+    vIm1[0].resize(nFrames);
+    RT = TransformData(im1[0].cols(), im1[0].rows());
 
-            std::sort(vec.begin(), vec.end());
+    avg0 = MatXd::Zero(im1[0].rows(), im1[0].cols());
+    avg1 = MatXd::Zero(im2[0].rows(), im2[0].cols());
+    for (uint64_t k = 0; k < nFrames; k++)
+    {
+        avg0 += im1[k] / double(nFrames);
+        avg1 += im2[k] / double(nFrames);
+    }
 
-            int64_t pos = static_cast<int64_t>(0.5 * double(vec.size()));
-            img(k, l) = vec.at(pos);
-        }
+    // We usually have only a few frames, so remaining threads split every frame in blocks of lines.
+    // Every image is a task on the shared pool, and its blocks are nested tasks on the same pool
+    GPT::ThreadPool& pool = GPT::ThreadPool::shared();
+
+    const uint64_t numTasks = 2 * nFrames;
+    const uint32_t nImageThreads = uint32_t(std::max<uint64_t>(pool.getNumThreads() / numTasks, 1));
+
+    pool.run(uint32_t(numTasks), [&](uint32_t id) -> void {
+        uint64_t k = id / 2;
+        if (id % 2 == 0)
+            vIm0[0][k] = (255.0 * treatImage(im1[k], 9, 5.0, 32, 32, nImageThreads)).array().round().cast<uint8_t>();
+        else
+            vIm1[0][k] = (255.0 * treatImage(im2[k], 9, 5.0, 32, 32, nImageThreads)).array().round().cast<uint8_t>();
+    });
+
+    // Coarser levels down to 64 pixels on the smallest side, as features vanish below that
+    const uint64_t minSize = 64, maxLevels = 4;
+    while (vIm0.size() < maxLevels && std::min(vIm0.back()[0].rows(), vIm0.back()[0].cols()) >= 2 * int64_t(minSize))
+    {
+        vIm0.emplace_back(nFrames);
+        vIm1.emplace_back(nFrames);
+
+        const uint64_t lv = vIm0.size() - 1;
+        pool.run(uint32_t(numTasks), [&](uint32_t id) -> void {
+            uint64_t k = id / 2;
+            if (id % 2 == 0)
+                vIm0[lv][k] = downsample(vIm0[lv - 1][k]);
+            else
+                vIm1[lv][k] = downsample(vIm1[lv - 1][k]);
+        });
+    }
 
-    return img;
 }
 
+// Coordinates are walked along each row in fixed point with 32 fractional bits, so every pixel
+// only adds the column step. Extreme transforms are clamped, they map every pixel outside anyway
+static int64_t toFixed(double value)
+{
+    value = std::min(std::max(value, -1073741824.0), 1073741824.0);
+    return static_cast<int64_t>(std::llround(value * 4294967296.0));
+}
 
-static MatXd treatImage(MatXd img, int medianSize, double clipLimit, uint64_t tileSizeX, uint64_t tileSizeY)
+static int64_t floorDiv(int64_t a, int64_t b)
 {
-    // Removing as much noise as possible
-    MatXd mat = medianFilter(img, medianSize);
+    int64_t q = a / b;
+    return (a % b != 0 && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
 
+// Shrinks [first, last) to the columns x where 0 <= start + x * step < limit
+static void insideRange(int64_t start, int64_t step, int64_t limit, int64_t &first, int64_t &last)
+{
+    int64_t lo = first, hi = last - 1;
 
-    // Before anything else, let's correct contrast
-    autoContrast(mat);
+    if (step == 0)
+    {
+        if (start < 0 || start >= limit)
+            hi = lo - 1;
+    }
+    else if (step > 0)
+    {
+        lo = -floorDiv(start, step);
+        hi = floorDiv(limit - 1 - start, step);
+    }
+    else
+    {
+        lo = -floorDiv(start - limit + 1, step);
+        hi = floorDiv(-start, step);
+    }
 
-    //////////////////////////////////////////////////////////////
-    // Creating look-up table
+    first = std::min(std::max(first, lo), last);
+    last = std::max(std::min(last, hi + 1), first);
+}
 
+// Sum of squared differences between im0 and im1 mapped by itrf, with nearest neighbour sampling.
+// Pixels mapped outside of im1 compare against zero. Only the columns mapped inside im1 need to look
+// it up, so the inner loop has no bounds checks and accumulates in integers, which compilers vectorize
+static uint64_t frameEnergy(const Image<uint8_t> &im0, const Image<uint8_t> &im1, const Mat3d &itrf)
+{
     const int64_t
-        nCols = mat.cols(),
-        nRows = mat.rows(),
-        tileArea = tileSizeX * tileSizeY,
-        TX = static_cast<int64_t>(std::ceil(double(nCols) / double(tileSizeX))),
-        TY = static_cast<int64_t>(std::ceil(double(nRows) / double(tileSizeY))),
-        NT = TX * TY;
+        width = im0.cols(),
+        height = im0.rows(),
+        stepI = toFixed(itrf(0, 0)),
+        stepJ = toFixed(itrf(1, 0));
 
-    clipLimit *= tileArea / 256.0;
+    uint64_t energy = 0;
 
-    std::vector<uint64_t> cdfmin(NT, 0);
-    MatXd lut = MatXd::Zero(256, NT);
+    for (int64_t y = 0; y < height; y++)
+    {
+        // Pixel centers are at half integers, so the integer part is the nearest pixel
+        int64_t
+            startI = toFixed(itrf(0, 0) * 0.5 + itrf(0, 1) * (y + 0.5) + itrf(0, 2)),
+            startJ = toFixed(itrf(1, 0) * 0.5 + itrf(1, 1) * (y + 0.5) + itrf(1, 2));
 
-    for (int64_t k = 0; k < nRows; k++)
-        for (int64_t l = 0; l < nCols; l++)
+        int64_t first = 0, last = width;
+        insideRange(startI, stepI, int64_t(im1.cols()) << 32, first, last);
+        insideRange(startJ, stepJ, int64_t(im1.rows()) << 32, first, last);
+
+        const uint8_t *row = im0.data() + y * width;
+        uint32_t outside = 0, inside = 0;
+
+        for (int64_t x = 0; x < first; x++)
+            outside += uint32_t(row[x]) * uint32_t(row[x]);
+
+        for (int64_t x = last; x < width; x++)
+            outside += uint32_t(row[x]) * uint32_t(row[x]);
+
+        if (last > first)
         {
-            int64_t
-                y = static_cast<int64_t>(k / double(tileSizeX)),
-                x = static_cast<int64_t>(l / double(tileSizeY)),
-                tid = y * TX + x;
+            int64_t coordI = startI + first * stepI, coordJ = startJ + first * stepJ;
+            for (int64_t x = first; x < last; x++)
+            {
+                int32_t dr = int32_t(row[x]) - int32_t(im1.data()[(coordJ >> 32) * im1.cols() + (coordI >> 32)]);
+                inside += uint32_t(dr * dr);
 
-            int64_t id = static_cast<int64_t>(255.0 * mat(k, l));
-            lut(id, tid)++;
+                coordI += stepI;
+                coordJ += stepJ;
+            }
         }
 
-    // Normalization
-    for (int64_t tid = 0; tid < NT; tid++)
+        // Rows up to 66051 pixels fit in 32 bits
+        energy += uint64_t(outside) + uint64_t(inside);
+    }
+
+    return energy;
+}
+
+void GPT::Align::calcEnergy(const uint64_t id, const uint64_t nThr)
+{
+    const std::vector<Image<uint8_t>> &im0 = vIm0[level], &im1 = vIm1[level];
+
+    uint64_t energy = 0;
+    for (uint64_t fr = id; fr < im0.size(); fr += nThr)
+        energy += frameEnergy(im0[fr], im1[fr], itrf);
+
+    global_energy[id] = double(energy);
+}
+
+double GPT::Align::evaluate(const Mat3d &trf)
+{
+    // Pixel coordinates at this level are the full resolution ones divided by 2^level
+    const double factor = std::ldexp(1.0, -int(level));
+
+    Mat3d S = Mat3d::Identity(), iS = Mat3d::Identity();
+    S(0, 0) = S(1, 1) = factor;
+    iS(0, 0) = iS(1, 1) = 1.0 / factor;
+
+    itrf = S * trf.inverse() * iS;
+
+    // Splitting log-likelihood calculationg between frames on the shared pool
+    const std::vector<Image<uint8_t>> &im0 = vIm0[level];
+    const uint64_t nThr = std::max<uint64_t>(std::min<uint64_t>(GPT::ThreadPool::shared().getNumThreads(), im0.size()), 1);
+
+    global_energy.assign(nThr, 0.0);
+    GPT::ThreadPool::shared().run(uint32_t(nThr), [&](uint32_t tid) -> void { calcEnergy(tid, nThr); });
+
+    double energy = 0.0;
+    for (double val : global_energy)
+        energy += val;
+
+    // We want to minimize, therefore the negative of the maximize
+    return 0.5 * double(im0[0].cols()) * double(im0[0].rows()) * log(energy);
+}
+
+Mat3d GPT::Align::transRotMatrix(const VecXd &p) const
+{
+    double 
+        dx = p[0], dy = p[1],
+        cx = p[2], cy = p[3], angle = p[4] / arcRadius();
+
+    // Transformation matrices
+    Mat3d A, B, C;
+
+    A << 1.0, 0.0, dx + cx,
+         0.0, 1.0, dy + cy,
+         0.0, 0.0, 1.0;
+
+    B << cos(angle), -sin(angle), 0.0,
+         sin(angle), cos(angle), 0.0,
+         0.0, 0.0, 1.0;
+
+    C << 1.0, 0.0, -cx,
+         0.0, 1.0, -cy,
+         0.0, 0.0, 1.0;
+
+    // Complete transformation
+    return A * B * C;
+}
+
+Mat3d GPT::Align::scaleMatrix(const VecXd &p) const
+{
+    double 
+        sx = p[0], sy = p[1],
+        width = static_cast<double>(RT.size(0)),
+        height = static_cast<double>(RT.size(1));
+
+    // Transformation matrices
+    Mat3d A;
+    A << sx, 0.0, 0.5 * width * (1.0 - sx),
+         0.0, sy, 0.5 * height * (1.0 - sy),
+         0.0, 0.0, 1.0;
+
+    return A * RT.trf;
+}
+
+Mat3d GPT::Align::transRotDiff(const VecXd &p, int64_t k) const
+{
+    double
+        dx = p[0], dy = p[1],
+        cx = p[2], cy = p[3], angle = p[4] / arcRadius();
+
+    Mat3d A, B, C;
+
+    A << 1.0, 0.0, dx + cx,
+         0.0, 1.0, dy + cy,
+         0.0, 0.0, 1.0;
+
+    B << cos(angle), -sin(angle), 0.0,
+         sin(angle), cos(angle), 0.0,
+         0.0, 0.0, 1.0;
+
+    C << 1.0, 0.0, -cx,
+         0.0, 1.0, -cy,
+         0.0, 0.0, 1.0;
+
+    // Translations only enter the last column of A and C, the angle only B
+    Mat3d D = Mat3d::Zero();
+    switch (k)
+    {
+    case 0:
+    case 1:
+        D(k, 2) = 1.0;
+        return D * B * C;
+
+    case 2:
+    case 3:
+        D(k - 2, 2) = 1.0;
+        return D * B * C - A * B * D;
+
+    default:
+        D << -sin(angle), -cos(angle), 0.0,
+             cos(angle), -sin(angle), 0.0,
+             0.0, 0.0, 0.0;
+        return A * D * C / arcRadius();
+    }
+}
+
+Mat3d GPT::Align::scaleDiff(const VecXd & /*p*/, int64_t k) const
+{
+    const double size = static_cast<double>(RT.size(k));
+
+    Mat3d D = Mat3d::Zero();
+    D(k, k) = 1.0;
+    D(k, 2) = -0.5 * size;
+
+    return D * RT.trf;
+}
+
+double GPT::Align::weightTransRot(const VecXd &p) { return evaluate(transRotMatrix(p)); }
+double GPT::Align::weightScale(const VecXd &p) { return evaluate(scaleMatrix(p)); }
+
+bool GPT::Align::optimize(VecXd &vec, double step, double (Align::*weight)(const VecXd &))
+{
+    stopped = false;
+
+    for (int64_t lv = int64_t(vIm0.size()) - 1; lv >= 0; lv--)
     {
-        // To avoid contrast differences at borders, let's clip the histogram
-        while (true)
+        level = uint64_t(lv);
+
+        // Coarse levels stop after the simplex shrinks a thousand times and leave the details to finer ones,
+        // while full resolution converges as tightly as before
+        double thres = lv > 0 ? 1e-3 * step : 1e-8;
+
         {
-            double extra = 0.0;
-            for (int64_t r = 0; r < 256; r++)
-                if (lut(r, tid) > clipLimit)
-                {
-                    extra += lut(r, tid) - clipLimit;
-                    lut(r, tid) = clipLimit;
-                }
+            // stop() may run from another thread while the simplex is replaced
+            std::lock_guard<std::mutex> lock(mtxSimplex);
+            if (stopped)
+                return false;
 
-            if (extra < 0.00001)
-                break;
+            nms = std::make_unique<GOptimize::NMSimplex>(vec, thres, step);
+        }
 
-            lut.col(tid).array() += extra / 256.0;
+        // A stop arriving before the simplex starts only ends it after this level
+        if (!nms->runSimplex(weight, this) || stopped)
+            return false;
 
-        } // while-true-clipLimit
+        vec = nms->getResults();
+        step *= 0.5;
+    }
 
-        double norm = lut.col(tid).sum();
-        lut.col(tid).array() /= norm;
+    return true;
+}
 
-        for (int64_t k = 1; k < 256; k++)
-            lut(k, tid) += lut(k - 1, tid);
+// Normal equations for the squared differences between two images, H = J^T J and g = J^T r
+struct NormalEquations
+{
+    MatXd H;
+    VecXd g;
+    double energy = 0.0;
+    uint64_t count = 0;
 
-        double bot = lut.col(tid).minCoeff();
-        lut.col(tid).array() = (lut.col(tid).array() - bot) / (1.0 - bot);
+    NormalEquations(int64_t nParams) : H(MatXd::Zero(nParams, nParams)), g(VecXd::Zero(nParams)) {}
 
-    } // normalization
+    void add(const NormalEquations &other)
+    {
+        H += other.H;
+        g += other.g;
+        energy += other.energy;
+        count += other.count;
+    }
+};
 
-    /////////////////////////////////////////////////////////////////////
-    // Applying clahe algorithm
+// Residuals of rows [first, last) of im0 against im1 interpolated bilinearly at the positions mapped by itrf. Pixels
+// without their four neighbours inside im1 are left out. Every matrix in vDiff is the derivative of itrf with respect
+// to one parameter, and the image gradient is the exact derivative of the interpolation
+static void accumulate(const Image<uint8_t> &im0, const Image<uint8_t> &im1, const Mat3d &itrf, const std::vector<Mat3d> &vDiff,
+                       int64_t first, int64_t last, NormalEquations &eq)
+{
+    const int64_t
+        nParams = int64_t(vDiff.size()),
+        width = im1.cols(),
+        height = im1.rows();
 
-    img.fill(0.0);
+    VecXd jac(nParams);
 
-    for (int64_t k = 0; k < nRows; k++)
-        for (int64_t l = 0; l < nCols; l++)
+    for (int64_t y = first; y < last; y++)
+    {
+        const uint8_t *row = im0.data() + y * im0.cols();
+        const double py = y + 0.5;
+
+        for (int64_t x = 0; x < im0.cols(); x++)
         {
-            // Determining tile
-            int64_t x = l / tileSizeX, y = k / tileSizeY;
+            // Pixel centers are at half integers, so interpolation starts from the pixel whose center is below
+            const double
+                px = x + 0.5,
+                u = itrf(0, 0) * px + itrf(0, 1) * py + itrf(0, 2) - 0.5,
+                v = itrf(1, 0) * px + itrf(1, 1) * py + itrf(1, 2) - 0.5;
 
-            double px = double(l) / tileSizeX - x,
-                   py = double(k) / tileSizeY - y;
+            if (!(u >= 0.0 && v >= 0.0 && u < double(width - 1) && v < double(height - 1)))
+                continue;
 
-            int dx = round(px) == 1.0 ? 1 : -1,
-                dy = round(py) == 1.0 ? 1 : -1;
+            const int64_t i = int64_t(u), j = int64_t(v);
+            const double a = u - double(i), b = v - double(j);
 
-            // boundary conditions
-            if (y == 0 && dy == -1)
-                dy = 0;
+            const uint8_t
+                *top = im1.data() + j * width + i,
+                *bottom = top + width;
 
-            if (y == (TY - 1) && dy == 1)
-                dy = 0;
+            const double
+                upper = top[0] + a * (double(top[1]) - double(top[0])),
+                lower = bottom[0] + a * (double(bottom[1]) - double(bottom[0])),
+                res = double(row[x]) - (upper + b * (lower - upper));
 
-            if (x == 0 && dx == -1)
-                dx = 0;
+            eq.energy += res * res;
+            eq.count++;
 
-            if (x == (TX - 1) && dx == 1)
-                dx = 0;
+            if (nParams == 0)
+                continue;
 
-            // getting distance from tile's center
-            px = px > 0.5 ? px - 0.5 : 0.5 - px;
-            py = py > 0.5 ? py - 0.5 : 0.5 - py;
+            const double
+                gx = (1.0 - b) * (double(top[1]) - double(top[0])) + b * (double(bottom[1]) - double(bottom[0])),
+                gy = lower - upper;
 
-            uint64_t 
-                bin = static_cast<uint64_t>(255.0 * mat(k, l)),
-                tid0 = (y + 0) * TX + (x + 0),
-                tid1 = (y + 0) * TX + (x + dx),
-                tid2 = (y + dy) * TX + (x + 0),
-                tid3 = (y + dy) * TX + (x + dx);
+            for (int64_t k = 0; k < nParams; k++)
+            {
+                const Mat3d &D = vDiff[k];
+                jac(k) = -gx * (D(0, 0) * px + D(0, 1) * py + D(0, 2)) - gy * (D(1, 0) * px + D(1, 1) * py + D(1, 2));
+            }
 
-            double valx1 = (1.0 - px) * lut(bin, tid0) + px * (lut(bin, tid1));
-            double valx2 = (1.0 - px) * lut(bin, tid2) + px * (lut(bin, tid3));
+            for (int64_t k = 0; k < nParams; k++)
+            {
+                for (int64_t l = 0; l <= k; l++)
+                    eq.H(k, l) += jac(k) * jac(l);
 
-            img(k, l) = (1.0 - py) * valx1 + py * valx2;
+                eq.g(k) += jac(k) * res;
+            }
         }
+    }
 
-    //////////////////////////////////////////
-    // Apply some final auto-contrast to make all images of similar sinal
+    for (int64_t k = 0; k < nParams; k++)
+        for (int64_t l = k + 1; l < nParams; l++)
+            eq.H(k, l) = eq.H(l, k);
+}
 
-    autoContrast(img);
-    return img;
+// Largest displacement of the image corners between two transforms
+static double cornerShift(const Mat3d &A, const Mat3d &B, double width, double height)
+{
+    double shift = 0.0;
+    for (double x : {0.0, width})
+        for (double y : {0.0, height})
+            shift = std::max(shift, ((A - B) * Vec3d(x, y, 1.0)).head(2).norm());
+
+    return shift;
+}
+
+bool GPT::Align::gaussNewton(VecXd &vec, const std::function<Mat3d(const VecXd &)> &model,
+                             const std::function<Mat3d(const VecXd &, int64_t)> &diff)
+{
+    stopped = false;
+
+    const int64_t nParams = vec.size();
+    const uint64_t maxIterations = 50;
+
+    ThreadPool &pool = ThreadPool::shared();
+
+    // Pixel coordinates at this level are the full resolution ones divided by 2^level, as in evaluate
+    auto levelScale = [&](Mat3d &S, Mat3d &iS) -> void {
+        const double factor = std::ldexp(1.0, -int(level));
+
+        S = iS = Mat3d::Identity();
+        S(0, 0) = S(1, 1) = factor;
+        iS(0, 0) = iS(1, 1) = 1.0 / factor;
+    };
+
+    auto levelInverse = [&](const VecXd &p) -> Mat3d {
+        Mat3d S, iS;
+        levelScale(S, iS);
+        return S * model(p).inverse() * iS;
+    };
+
+    // Every task takes a block of rows from all the frames
+    auto solve = [&](const VecXd &p, bool withDerivatives) -> NormalEquations {
+        Mat3d S, iS;
+        levelScale(S, iS);
+
+        const Mat3d minv = model(p).inverse(), inv = S * minv * iS;
+
+        // Derivative of the inverse, d(M^-1) = -M^-1 dM M^-1
+        std::vector<Mat3d> vDiff;
+        if (withDerivatives)
+            for (int64_t k = 0; k < nParams; k++)
+                vDiff.emplace_back(-S * minv * diff(p, k) * minv * iS);
+
+        const std::vector<Image<uint8_t>> &im0 = vIm0[level], &im1 = vIm1[level];
+
+        const int64_t
+            height = im0[0].rows(),
+            numRows = int64_t(im0.size()) * height;
+
+        const uint32_t nTasks = uint32_t(std::max<int64_t>(std::min<int64_t>(pool.getNumThreads(), numRows), 1));
+        std::vector<NormalEquations> vEq(nTasks, NormalEquations(nParams));
+
+        pool.run(nTasks, [&](uint32_t tid) -> void {
+            const int64_t first = numRows * tid / nTasks, last = numRows * (tid + 1) / nTasks;
+            for (int64_t fr = first / height; fr * height < last; fr++)
+                accumulate(im0[fr], im1[fr], inv, vDiff, std::max(first - fr * height, int64_t(0)), std::min(last - fr * height, height), vEq[tid]);
+        });
+
+        NormalEquations eq(nParams);
+        for (const NormalEquations &val : vEq)
+            eq.add(val);
+
+        return eq;
+    };
+
+    // Mean over the pixels mapped inside, so moving pixels out of the image isn't rewarded
+    auto meanEnergy = [](const NormalEquations &eq) -> double {
+        return eq.count > 0 ? eq.energy / double(eq.count) : INFINITY;
+    };
+
+    for (int64_t lv = int64_t(vIm0.size()) - 1; lv >= 0; lv--)
+    {
+        level = uint64_t(lv);
+
+        const double
+            width = double(vIm0[level][0].cols()),
+            height = double(vIm0[level][0].rows());
+
+        double lambda = 1e-3;
+        bool converged = false;
+
+        for (uint64_t it = 0; it < maxIterations && !converged; it++)
+        {
+            if (stopped)
+                return false;
+
+            NormalEquations eq = solve(vec, true);
+            const double energy = meanEnergy(eq);
+            if (!std::isfinite(energy))
+            {
+                pout("ERROR (Align::gaussNewton) ==> No pixels overlap between images!");
+                return false;
+            }
+
+            // Levenberg-Marquardt damping, increased until the energy goes down
+            bool accepted = false;
+            while (!accepted && lambda < 1e10)
+            {
+                MatXd H = eq.H;
+                H.diagonal() *= 1.0 + lambda;
+
+                VecXd next = vec - H.ldlt().solve(eq.g);
+                if (meanEnergy(solve(next, false)) < energy)
+                {
+                    // Converged once the image corners move less than a hundredth of a pixel at this level
+                    double shift = cornerShift(levelInverse(next), levelInverse(vec), width, height);
+
+                    vec = next;
+                    lambda = std::max(0.1 * lambda, 1e-8);
+                    accepted = true;
+                    converged = shift < 1e-2;
+                }
+                else
+                    lambda *= 10.0;
+            }
+
+            // No step improves the energy, so we are at the minimum
+            if (!accepted)
+                break;
+        }
+    }
+
+    return true;
 }
 
 /*******************************************************************/
 /*******************************************************************/
 
-GPT::Align::Align(uint64_t nFrames, const MatXd *im1, const MatXd *im2)
+// 2D transform in place, along columns and then along rows. Eigen's inverse transform is already normalized
+static void fft2(MatXcd &mat, bool inverse)
 {
+    Eigen::FFT<double> fft;
+    VecXcd src, dst;
 
-    vIm0.resize(nFrames);
-    vIm1.resize(nFrames);
-    RT = TransformData(im1[0].cols(), im1[0].rows());
+    for (int64_t c = 0; c < mat.cols(); c++)
+    {
+        src = mat.col(c);
+        if (inverse)
+            fft.inv(dst, src);
+        else
+            fft.fwd(dst, src);
 
-    // Setup transform properties
-    auto parallel_image_treatment = [&](uint64_t tid, uint64_t nThr) -> void
+        mat.col(c) = dst;
+    }
+
+    for (int64_t r = 0; r < mat.rows(); r++)
     {
-        for (uint64_t k = tid; k < nFrames; k += nThr)
+        src = mat.row(r).transpose();
+        if (inverse)
+            fft.inv(dst, src);
+        else
+            fft.fwd(dst, src);
+
+        mat.row(r) = dst.transpose();
+    }
+}
+
+// Spectrum of the image times a Hann window, so borders don't show up as a cross in the spectrum
+static MatXcd windowedSpectrum(const MatXd &img)
+{
+    const int64_t nRows = img.rows(), nCols = img.cols();
+
+    VecXd winRow(nRows), winCol(nCols);
+    for (int64_t r = 0; r < nRows; r++)
+        winRow(r) = 0.5 - 0.5 * std::cos(2.0 * EIGEN_PI * (r + 0.5) / double(nRows));
+
+    for (int64_t c = 0; c < nCols; c++)
+        winCol(c) = 0.5 - 0.5 * std::cos(2.0 * EIGEN_PI * (c + 0.5) / double(nCols));
+
+    MatXcd spec = ((img.array() - img.mean()) * (winRow * winCol.transpose()).array()).cast<std::complex<double>>();
+    fft2(spec, false);
+    return spec;
+}
+
+// Offsets s in (rows, cols) such that b(x + s) matches a(x), with offsets taken as periodic. Local maxima
+// of the inverse of the normalized cross power spectrum, highest first, refined with a parabola along each axis
+static std::vector<Vec2d> phaseShifts(const MatXcd &specA, const MatXcd &specB, size_t num)
+{
+    const int64_t nRows = specA.rows(), nCols = specA.cols();
+
+    MatXcd cross = specB.array() * specA.array().conjugate();
+    cross = cross.array() / (cross.array().abs() + 1e-12);
+    fft2(cross, true);
+
+    const MatXd corr = cross.real();
+    auto at = [&](int64_t r, int64_t c) -> double { return corr((r + nRows) % nRows, (c + nCols) % nCols); };
+
+    std::vector<std::tuple<double, int64_t, int64_t>> vPeaks;
+    for (int64_t c = 0; c < nCols; c++)
+        for (int64_t r = 0; r < nRows; r++)
         {
-            vIm0[k] = (255.0 * treatImage(im1[k], 9, 5.0, 32, 32)).array().round().cast<uint8_t>();
-            vIm1[k] = (255.0 * treatImage(im2[k], 9, 5.0, 32, 32)).array().round().cast<uint8_t>();
+            bool isMax = true;
+            for (int64_t dr = -1; dr <= 1 && isMax; dr++)
+                for (int64_t dc = -1; dc <= 1 && isMax; dc++)
+                    isMax = (dr == 0 && dc == 0) || at(r + dr, c + dc) < corr(r, c);
+
+            if (isMax)
+                vPeaks.emplace_back(corr(r, c), r, c);
         }
+
+    num = std::min(num, vPeaks.size());
+    std::partial_sort(vPeaks.begin(), vPeaks.begin() + num, vPeaks.end(), std::greater<>());
+
+    auto refine = [](double left, double center, double right) -> double {
+        double den = left - 2.0 * center + right;
+        return den < 0.0 ? std::min(std::max(0.5 * (left - right) / den, -0.5), 0.5) : 0.0;
     };
 
-    std::vector<std::thread> vThr(std::thread::hardware_concurrency());
-    for (uint64_t tid = 0; tid < vThr.size(); tid++)
-        vThr[tid] = std::thread(parallel_image_treatment, tid, vThr.size());
+    std::vector<Vec2d> shifts;
+    for (size_t k = 0; k < num; k++)
+    {
+        const auto [top, row, col] = vPeaks[k];
+
+        // Peaks past the middle are negative offsets
+        double
+            sr = double(row) + refine(at(row - 1, col), top, at(row + 1, col)),
+            sc = double(col) + refine(at(row, col - 1), top, at(row, col + 1));
+
+        if (sr > 0.5 * nRows)
+            sr -= double(nRows);
 
-    for (auto &thr : vThr)
-        thr.join();
+        if (sc > 0.5 * nCols)
+            sc -= double(nCols);
+
+        shifts.emplace_back(sr, sc);
+    }
 
+    // A constant correlation has no local maximum, so the zero offset is kept
+    if (shifts.empty())
+        shifts.emplace_back(Vec2d::Zero());
+
+    return shifts;
 }
 
-void GPT::Align::calcEnergy(const uint64_t id, const uint64_t nThr)
+static Vec2d phaseShift(const MatXcd &specA, const MatXcd &specB) { return phaseShifts(specA, specB, 1)[0]; }
+
+// Log-polar resampling of the centered magnitude spectrum, rows are angles in [0, pi) and columns are log radii.
+// Rotating the image rotates its magnitude spectrum by the same angle, which becomes a shift along the rows
+static MatXd logPolar(const MatXcd &spec, int64_t nAngles, int64_t nRadii)
 {
-    global_energy[id] = 0.0;
+    const int64_t nRows = spec.rows(), nCols = spec.cols();
 
-    const int64_t
-        width = vIm0[0].cols(),
-        height = vIm0[0].rows();
+    // Logarithm compresses the range, so the low frequencies don't dominate
+    MatXd mag = (1.0 + spec.array().abs()).log();
+
+    const double
+        rMin = 2.0,
+        rMax = 0.45 * double(std::min(nRows, nCols)),
+        logStep = std::log(rMax / rMin) / double(nRadii - 1);
+
+    // Bilinear interpolation of the spectrum with zero frequency at the center
+    auto sample = [&](double y, double x) -> double {
+        double fy = std::floor(y), fx = std::floor(x), b = y - fy, a = x - fx;
+        auto at = [&](int64_t r, int64_t c) -> double {
+            return mag(((r % nRows) + nRows) % nRows, ((c % nCols) + nCols) % nCols);
+        };
 
-    for (uint64_t fr = id; fr < vIm0.size(); fr += nThr)
+        int64_t r = int64_t(fy), c = int64_t(fx);
+        return (1.0 - b) * ((1.0 - a) * at(r, c) + a * at(r, c + 1)) + b * ((1.0 - a) * at(r + 1, c) + a * at(r + 1, c + 1));
+    };
+
+    MatXd out(nAngles, nRadii);
+    for (int64_t k = 0; k < nAngles; k++)
     {
-        // Evaluating transformed img2
-        for (int64_t y = 0; y < height; y++)
-            for (int64_t x = 0; x < width; x++)
-            {
-                int64_t i = static_cast<int64_t>(itrf(0, 0) * (x + 0.5) + itrf(0, 1) * (y + 0.5) + itrf(0, 2) + 0.5);
-                int64_t j = static_cast<int64_t>(itrf(1, 0) * (x + 0.5) + itrf(1, 1) * (y + 0.5) + itrf(1, 2) + 0.5);
+        double angle = EIGEN_PI * double(k) / double(nAngles);
+        for (int64_t l = 0; l < nRadii; l++)
+        {
+            double radius = rMin * std::exp(logStep * double(l));
+            out(k, l) = sample(radius * std::sin(angle), radius * std::cos(angle));
+        }
+    }
 
-                double dr = double(vIm0[fr](y, x));
-                if (i >= 0 && i < int(width) && j >= 0 && j < int(height))
-                    dr -= double(vIm1[fr](j, i));
+    return out;
+}
 
-                global_energy[id] += dr * dr;
-            }
+bool GPT::Align::phaseCorrelation(void)
+{
+    // Half resolution is enough for an initial guess, and is less sensitive to scale differences
+    level = std::min<uint64_t>(1, vIm0.size() - 1);
+    const double factor = std::ldexp(1.0, int(level));
+
+    // Frames are averaged, as noise doesn't correlate
+    const std::vector<Image<uint8_t>> &im0 = vIm0[level], &im1 = vIm1[level];
+    const int64_t nRows = im0[0].rows(), nCols = im0[0].cols();
+
+    MatXd mean0 = MatXd::Zero(nRows, nCols), mean1 = MatXd::Zero(nRows, nCols);
+    for (size_t fr = 0; fr < im0.size(); fr++)
+    {
+        mean0 += im0[fr].cast<double>();
+        mean1 += im1[fr].cast<double>();
+    }
+
+    if (mean0.isZero() || mean1.isZero())
+    {
+        pout("ERROR (Align::phaseCorrelation) ==> Images have no features to correlate!");
+        return false;
+    }
+
+    const MatXcd spec0 = windowedSpectrum(mean0);
+
+    // Rotations are around the image center, in pixels at this level
+    const double cx = 0.5 * double(nCols), cy = 0.5 * double(nRows);
+
+    // Candidates as (translation, center, angle) in full resolution pixels, starting from the current guess
+    std::vector<VecXd> candidates(1, VecXd(5));
+    candidates[0] << RT.translate(0), RT.translate(1), RT.rotate(0), RT.rotate(1), RT.rotate(2) * arcRadius();
+
+    auto addCandidate = [&](const Vec2d &shift, double angle) -> void {
+        // Image 1 at x + shift matches image 0 at x, so the transform moves points by minus the shift
+        VecXd vec(5);
+        vec << -factor * shift(1), -factor * shift(0), factor * cx, factor * cy, angle * arcRadius();
+        candidates.emplace_back(std::move(vec));
+    };
+
+    if (phaseTranslation)
+        addCandidate(phaseShift(spec0, windowedSpectrum(mean1)), 0.0);
+
+    if (phaseRotation)
+    {
+        const int64_t nAngles = 360, nRadii = 128;
+        MatXcd
+            lp0 = logPolar(spec0, nAngles, nRadii).cast<std::complex<double>>(),
+            lp1 = logPolar(windowedSpectrum(mean1), nAngles, nRadii).cast<std::complex<double>>();
+
+        fft2(lp0, false);
+        fft2(lp1, false);
+
+        // Noise at high frequencies and the isotropic spot profile also correlate, so the true rotation is
+        // not always the highest peak and the few highest ones are all tried.
+        // Magnitude spectra are symmetric, so angles are only known up to pi and the smallest one is kept
+        for (const Vec2d &shift : phaseShifts(lp0, lp1, 3))
+        {
+            const double angle = -shift(0) * EIGEN_PI / double(nAngles);
+
+            // Image 1 with the rotation undone, sampled at the nearest pixel
+            const double cs = std::cos(angle), sn = std::sin(angle);
+            MatXd derotated = MatXd::Zero(nRows, nCols);
+            for (int64_t c = 0; c < nCols; c++)
+                for (int64_t r = 0; r < nRows; r++)
+                {
+                    double x = c + 0.5 - cx, y = r + 0.5 - cy;
+                    int64_t i = int64_t(std::floor(cs * x + sn * y + cx));
+                    int64_t j = int64_t(std::floor(-sn * x + cs * y + cy));
+
+                    if (i >= 0 && i < nCols && j >= 0 && j < nRows)
+                        derotated(r, c) = mean1(j, i);
+                }
+
+            addCandidate(phaseTranslation ? phaseShift(spec0, windowedSpectrum(derotated)) : Vec2d::Zero(), angle);
+        }
     }
+
+    // Correlation peaks of sparse images are noisy, so the alignment energy picks the best candidate
+    size_t best = 0;
+    double bestEnergy = evaluate(transRotMatrix(candidates[0]));
+    for (size_t k = 1; k < candidates.size(); k++)
+    {
+        double energy = evaluate(transRotMatrix(candidates[k]));
+        if (energy < bestEnergy)
+        {
+            best = k;
+            bestEnergy = energy;
+        }
+    }
+
+    const VecXd &vec = candidates[best];
+    RT.translate = {vec(0), vec(1)};
+    RT.rotate = {vec(2), vec(3), vec(4) / arcRadius()};
+    RT.update();
+
+    return true;
 }
 
-double GPT::Align::weightTransRot(const VecXd &p)
+// Bead centroids, as local maxima well above the background refined by a gaussian fit.
+// Background and noise come from the median and the median absolute deviation
+static std::vector<Vec2d> findBeads(const MatXd &img, uint64_t spotSize)
 {
-    double 
-        dx = p[0], dy = p[1],
-        cx = p[2], cy = p[3], angle = p[4];
+    const int64_t nRows = img.rows(), nCols = img.cols(), size = int64_t(spotSize), sRoi = 2 * size + 1;
 
-    // Transformation matrices
-    Mat3d A, B, C;
+    std::vector<double> values(img.data(), img.data() + img.size());
+    auto median = [](std::vector<double> &vec) -> double {
+        std::nth_element(vec.begin(), vec.begin() + vec.size() / 2, vec.end());
+        return vec[vec.size() / 2];
+    };
 
-    A << 1.0, 0.0, dx + cx,
-         0.0, 1.0, dy + cy,
-         0.0, 0.0, 1.0;
+    const double bg = median(values);
+    for (double &val : values)
+        val = std::abs(val - bg);
 
-    B << cos(angle), -sin(angle), 0.0,
-         sin(angle), cos(angle), 0.0,
-         0.0, 0.0, 1.0;
+    const double thres = bg + 5.0 * 1.4826 * median(values);
 
-    C << 1.0, 0.0, -cx,
-         0.0, 1.0, -cy,
-         0.0, 0.0, 1.0;
+    std::vector<std::pair<int64_t, int64_t>> vPeak;
+    for (int64_t c = size; c < nCols - size; c++)
+        for (int64_t r = size; r < nRows - size; r++)
+            if (img(r, c) > thres && img(r, c) >= img.block(r - size, c - size, sRoi, sRoi).maxCoeff())
+                vPeak.emplace_back(r, c);
 
-    // Complete transformation
-    Mat3d trf = A * B * C;
-    itrf = trf.inverse();
+    // Fitting is the expensive part, so peaks are split on the shared pool
+    std::vector<Vec2d> vPos(vPeak.size());
+    std::vector<bool> vGood(vPeak.size(), false);
 
-    // Splitting log-likelihood calculationg to threads
-    const uint64_t nThr = std::thread::hardware_concurrency();
+    GPT::ThreadPool::shared().run(uint32_t(vPeak.size()), [&](uint32_t id) -> void {
+        const auto [r, c] = vPeak[id];
+        MatXd roi = img.block(r - size, c - size, sRoi, sRoi);
 
-    global_energy.resize(nThr);
-    std::vector<std::thread> vThr(nThr);
+        // Correcting contrast as for trajectories
+        double bot = roi.minCoeff(), top = roi.maxCoeff();
+        if (top <= bot)
+            return;
 
-    for (uint64_t tid = 0; tid < nThr; tid++)
-        vThr[tid] = std::thread(&Align::calcEnergy, this, tid, nThr);
+        roi.array() -= bot;
+        roi.array() *= 255.0 / (top - bot);
 
-    for (auto &thr : vThr)
-        thr.join();
+        GPT::Spot spot(roi, false);
+        if (!spot.successful())
+            return;
 
-    double energy = 0.0;
-    for (double val : global_energy)
-        energy += val;
+        const Vec2d &mu = spot.getSpotInfo().mu;
+        vPos[id] = {double(c) + 0.5 + mu(0) - 0.5 * double(sRoi), double(r) + 0.5 + mu(1) - 0.5 * double(sRoi)};
+        vGood[id] = true;
+    });
 
-    // We want to minimize, therefore the negative of the maximize
-    return 0.5 * RT.size(0) * RT.size(1) * log(energy);
+    std::vector<Vec2d> beads;
+    for (size_t k = 0; k < vPos.size(); k++)
+        if (vGood[k])
+            beads.push_back(vPos[k]);
 
-} 
+    return beads;
+}
 
-double GPT::Align::weightScale(const VecXd &p)
+// Uniform grid over points, so nearest neighbours only look at the surrounding cells
+class PointGrid
 {
-    double 
-        sx = p[0], sy = p[1],
-        width = static_cast<double>(vIm0[0].cols()), 
-        height = static_cast<double>(vIm0[0].rows());
+public:
+    PointGrid(const std::vector<Vec2d> &points, double cellSize) : pts(points), cell(cellSize)
+    {
+        for (size_t k = 0; k < pts.size(); k++)
+            cells[key(cellOf(pts[k](0)), cellOf(pts[k](1)))].push_back(k);
+    }
+
+    // Index of the closest point within radius, or -1. Radius must not be larger than a cell
+    int64_t nearest(const Vec2d &pos, double radius) const
+    {
+        int64_t best = -1;
+        double bestDist = radius * radius;
+
+        const int64_t cx = cellOf(pos(0)), cy = cellOf(pos(1));
+        for (int64_t dy = -1; dy <= 1; dy++)
+            for (int64_t dx = -1; dx <= 1; dx++)
+            {
+                auto it = cells.find(key(cx + dx, cy + dy));
+                if (it == cells.end())
+                    continue;
+
+                for (size_t id : it->second)
+                {
+                    double dist = (pts[id] - pos).squaredNorm();
+                    if (dist <= bestDist)
+                    {
+                        best = int64_t(id);
+                        bestDist = dist;
+                    }
+                }
+            }
+
+        return best;
+    }
+
+private:
+    const std::vector<Vec2d> &pts;
+    double cell;
+    std::unordered_map<uint64_t, std::vector<size_t>> cells;
+
+    int64_t cellOf(double val) const { return int64_t(std::floor(val / cell)); }
+    // Cells left of or above the origin are negative, so the halves are packed as unsigned
+    static uint64_t key(int64_t cx, int64_t cy) { return (uint64_t(uint32_t(cx)) << 32) | uint32_t(cy); }
+};
+
+// Similarity z0 = a * z1 + b from two correspondences, with points as complex numbers
+static Mat3d similarity(const Vec2d &p0, const Vec2d &q0, const Vec2d &p1, const Vec2d &q1)
+{
+    using cd = std::complex<double>;
+    const cd z0(p0(0), p0(1)), w0(q0(0), q0(1)), z1(p1(0), p1(1)), w1(q1(0), q1(1));
+
+    const cd a = (w0 - z0) / (w1 - z1), b = z0 - a * z1;
 
-    // Transformation matrices
     Mat3d A;
-    A << sx, 0.0, 0.5 * width * (1.0 - sx),
-         0.0, sy, 0.5 * height * (1.0 - sy),
+    A << a.real(), -a.imag(), b.real(),
+         a.imag(), a.real(), b.imag(),
          0.0, 0.0, 1.0;
 
-    // Inverse of transfomation for mapping
-    Mat3d trf = A * RT.trf;
-    itrf = trf.inverse();
+    return A;
+}
 
-    // Splitting log-likelihood calculationg to threads
-    const uint64_t nThr = std::thread::hardware_concurrency();
+bool GPT::Align::registerBeads(bool withScale)
+{
+    stopped = false;
 
-    global_energy.resize(nThr);
-    std::vector<std::thread> vThr(nThr);
+    if (beads0.empty() || beads1.empty())
+    {
+        beads0 = findBeads(avg0, spotSize);
+        beads1 = findBeads(avg1, spotSize);
+    }
 
-    for (uint64_t tid = 0; tid < nThr; tid++)
-        vThr[tid] = std::thread(&Align::calcEnergy, this, tid, nThr);
+    if (beads0.size() < 3 || beads1.size() < 3)
+    {
+        pout("ERROR (Align::registerBeads) ==> Not enough beads were found!");
+        return false;
+    }
 
-    for (auto &thr : vThr)
-        thr.join();
+    // Inliers are beads of channel 1 landing next to a bead of channel 0. Tolerance of the
+    // similarities leaves room for the anisotropic scale fitted later
+    const double tolRansac = 3.0, tolFinal = 1.0;
+    const PointGrid grid(beads0, tolRansac);
 
-    double energy = 0.0;
-    for (double val : global_energy)
-        energy += val;
+    auto findInliers = [&](const Mat3d &trf, double tol, std::vector<std::pair<size_t, size_t>> *inliers) -> size_t {
+        size_t count = 0;
+        for (size_t k = 0; k < beads1.size(); k++)
+        {
+            Vec3d pos = trf * Vec3d(beads1[k](0), beads1[k](1), 1.0);
+            int64_t id = grid.nearest(pos.head<2>(), tol);
+            if (id < 0)
+                continue;
+
+            count++;
+            if (inliers)
+                inliers->emplace_back(size_t(id), k);
+        }
+        return count;
+    };
 
-    // We want to minimize, therefore the negative of the maximize
-    return 0.5 * width * height * log(energy);
+    // Bead pairs of channel 0 sorted by length, so pairs of channel 1 only meet the ones of similar length
+    const double minLength = 4.0 * double(2 * spotSize + 1), maxScale = 0.05; // short pairs give poorly defined rotations
+    std::vector<std::tuple<double, size_t, size_t>> vLength;
+    for (size_t i = 0; i < beads0.size(); i++)
+        for (size_t j = i + 1; j < beads0.size(); j++)
+        {
+            double length = (beads0[j] - beads0[i]).norm();
+            if (length > minLength)
+                vLength.emplace_back(length, i, j);
+        }
+
+    std::sort(vLength.begin(), vLength.end());
+
+    // RANSAC over similarities from two correspondences, starting from the current transform
+    std::default_random_engine ran(0); // Fixed seed, so calibrations are reproducible
+    std::uniform_int_distribution<size_t> unif(0, beads1.size() - 1);
+
+    // Most candidates are wrong and map few beads of a small random subset next to a bead, so they
+    // are only counted on all beads when they do at least half as well as the best one on the subset
+    std::vector<size_t> probes(beads1.size());
+    std::iota(probes.begin(), probes.end(), 0);
+    std::shuffle(probes.begin(), probes.end(), ran);
+    probes.resize(std::min<size_t>(probes.size(), 32));
+
+    auto probeInliers = [&](const Mat3d &trf) -> size_t {
+        size_t count = 0;
+        for (size_t k : probes)
+        {
+            Vec3d pos = trf * Vec3d(beads1[k](0), beads1[k](1), 1.0);
+            count += grid.nearest(pos.head<2>(), tolRansac) >= 0;
+        }
+        return count;
+    };
+
+    Mat3d bestTrf = RT.trf;
+    size_t bestCount = findInliers(bestTrf, tolRansac, nullptr), bestProbe = probeInliers(bestTrf);
+
+    // Enough iterations to draw two inliers with 99% confidence, given the best inlier ratio so far
+    auto numIterations = [&](void) -> uint64_t {
+        double ratio = double(bestCount) / double(beads1.size());
+        return ratio < 0.05 ? 500 : std::min<uint64_t>(500, uint64_t(std::ceil(std::log(0.01) / std::log(1.0 - ratio * ratio + 1e-12))));
+    };
+
+    uint64_t maxIter = numIterations();
+    for (uint64_t it = 0; it < maxIter && !stopped; it++)
+    {
+        const Vec2d &p1 = beads1[unif(ran)], &q1 = beads1[unif(ran)];
+        const double length = (q1 - p1).norm();
+        if (length < minLength)
+            continue;
+
+        auto first = std::lower_bound(vLength.begin(), vLength.end(), std::make_tuple((1.0 - maxScale) * length - tolRansac, size_t(0), size_t(0)));
+        for (auto pr = first; pr != vLength.end() && std::get<0>(*pr) < (1.0 + maxScale) * length + tolRansac; pr++)
+        {
+            const Vec2d &p0 = beads0[std::get<1>(*pr)], &q0 = beads0[std::get<2>(*pr)];
+
+            // Pairs have no direction, so both correspondences are tried
+            for (const Mat3d &trf : {similarity(p0, q0, p1, q1), similarity(q0, p0, p1, q1)})
+            {
+                size_t probe = probeInliers(trf);
+                if (2 * probe < bestProbe)
+                    continue;
+
+                size_t count = probes.size() == beads1.size() ? probe : findInliers(trf, tolRansac, nullptr);
+                if (count > bestCount)
+                {
+                    bestCount = count;
+                    bestProbe = probe;
+                    bestTrf = trf;
+                    maxIter = numIterations();
+                }
+            }
+        }
+    }
+
+    // Similarity as transform parameters, keeping the current rotation center
+    const double
+        sc = std::hypot(bestTrf(0, 0), bestTrf(1, 0)),
+        angle = std::atan2(bestTrf(1, 0), bestTrf(0, 0)),
+        cx = RT.rotate(0), cy = RT.rotate(1),
+        mx = 0.5 * double(RT.size(0)), my = 0.5 * double(RT.size(1));
+
+    TransformData data = RT;
+    if (withScale)
+        data.scale = {sc, sc};
+
+    // Undoing scale about the image center, then rotation about the rotation center
+    const Vec2d &scl = data.scale;
+    Vec2d shift((bestTrf(0, 2) - (1.0 - scl(0)) * mx) / scl(0), (bestTrf(1, 2) - (1.0 - scl(1)) * my) / scl(1));
+    data.translate = shift - Vec2d(cx, cy) + Vec2d(std::cos(angle) * cx - std::sin(angle) * cy, std::sin(angle) * cx + std::cos(angle) * cy);
+    data.rotate(2) = angle;
+    data.update();
+
+    // Gauss-Newton on the inliers, parameters are translation and rotation followed by scale
+    const int64_t nPar = withScale ? 5 : 3;
+    auto apply = [&](const VecXd &p) -> TransformData {
+        TransformData out = data;
+        out.translate = {p(0), p(1)};
+        out.rotate(2) = p(2);
+        if (withScale)
+            out.scale = {p(3), p(4)};
+
+        out.update();
+        return out;
+    };
+
+    VecXd par(nPar);
+    par.head<3>() << data.translate(0), data.translate(1), data.rotate(2);
+    if (withScale)
+        par.tail<2>() = data.scale;
+
+    for (double tol : {tolRansac, tolFinal})
+    {
+        std::vector<std::pair<size_t, size_t>> inliers;
+        findInliers(apply(par).trf, tol, &inliers);
+
+        if (int64_t(inliers.size()) < nPar)
+        {
+            pout("ERROR (Align::registerBeads) ==> Not enough beads agree on a transform!");
+            return false;
+        }
+
+        for (int32_t it = 0; it < 10; it++)
+        {
+            // Few parameters and points, so central differences are cheap
+            auto residuals = [&](const VecXd &p) -> VecXd {
+                const Mat3d trf = apply(p).trf;
+                VecXd res(2 * inliers.size());
+                for (size_t k = 0; k < inliers.size(); k++)
+                {
+                    const auto &[i0, i1] = inliers[k];
+                    Vec3d pos = trf * Vec3d(beads1[i1](0), beads1[i1](1), 1.0);
+                    res.segment<2>(2 * k) = pos.head<2>() - beads0[i0];
+                }
+                return res;
+            };
+
+            const VecXd res = residuals(par);
+            MatXd jac(res.size(), nPar);
+            for (int64_t k = 0; k < nPar; k++)
+            {
+                const double h = k < 2 ? 1e-3 : 1e-7;
+                VecXd up = par, down = par;
+                up(k) += h;
+                down(k) -= h;
+                jac.col(k) = (residuals(up) - residuals(down)) / (2.0 * h);
+            }
+
+            const VecXd step = (jac.transpose() * jac).ldlt().solve(-jac.transpose() * res);
+            par += step;
+
+            if (step.head<2>().norm() < 1e-6)
+                break;
+        }
+    }
+
+    RT = apply(par);
+    return true;
 }
 
 bool GPT::Align::alignCameras(void)
 {
+    // Bead matching searches all similarities on its own, so it needs no starting point
+    if (method == BEADS)
+        return registerBeads(false);
+
+    // Refinement starts close to the optimum, whatever the offset between cameras
+    if ((phaseTranslation || phaseRotation) && !phaseCorrelation())
+        return false;
+
     VecXd vec(5);
-    vec << RT.translate(0), RT.translate(1), RT.rotate(0), RT.rotate(1), RT.rotate(2);
+    vec << RT.translate(0), RT.translate(1), RT.rotate(0), RT.rotate(1), RT.rotate(2) * arcRadius();
+
+    if (method == GAUSS_NEWTON)
+    {
+        // Rotation center and translation are redundant, so the center stays where it is
+        VecXd par(3);
+        par << vec(0), vec(1), vec(4);
+
+        auto expand = [&](const VecXd &p) -> VecXd {
+            VecXd full(vec);
+            full << p(0), p(1), vec(2), vec(3), p(2);
+            return full;
+        };
+
+        auto model = [&](const VecXd &p) -> Mat3d { return transRotMatrix(expand(p)); };
+        auto diff = [&](const VecXd &p, int64_t k) -> Mat3d { return transRotDiff(expand(p), k < 2 ? k : 4); };
+
+        if (!gaussNewton(par, model, diff))
+            return false;
 
-    nms = std::make_unique<GOptimize::NMSimplex>(vec, 1e-8, 15.0);
-    if (!nms->runSimplex(&Align::weightTransRot, this))
+        vec << par(0), par(1), vec(2), vec(3), par(2);
+    }
+    else if (!optimize(vec, 15.0, &Align::weightTransRot))
         return false;
 
     // Update TransformData
-    vec = nms->getResults();
     RT.translate = {vec(0), vec(1)};
-    RT.rotate = {vec(2), vec(3), vec(4)};
+    RT.rotate = {vec(2), vec(3), vec(4) / arcRadius()};
     RT.update();
 
     return true;
@@ -360,15 +1252,24 @@ bool GPT::Align::alignCameras(void)
 
 bool GPT::Align::correctAberrations(void)
 {
+    if (method == BEADS)
+        return registerBeads(true);
+
     VecXd vec(2);
     vec << RT.scale(0), RT.scale(1);
 
-    nms = std::make_unique<GOptimize::NMSimplex>(vec, 1e-8, 0.1);
-    if (!nms->runSimplex(&Align::weightScale, this))
+    if (method == GAUSS_NEWTON)
+    {
+        auto model = [&](const VecXd &p) -> Mat3d { return scaleMatrix(p); };
+        auto diff = [&](const VecXd &p, int64_t k) -> Mat3d { return scaleDiff(p, k); };
+
+        if (!gaussNewton(vec, model, diff))
+            return false;
+    }
+    else if (!optimize(vec, 0.1, &Align::weightScale))
         return false;
 
     // Saving to main vector
-    vec = nms->getResults();
     RT.scale = {vec(0), vec(1)};
     RT.update();
 
@@ -377,6 +1278,9 @@ bool GPT::Align::correctAberrations(void)
 
 void GPT::Align::stop(void)
 {
+    std::lock_guard<std::mutex> lock(mtxSimplex);
+
+    stopped = true;
     if (nms)
         nms->stop();
 }
\ No newline at end of file
@@ -1,231 +1,1821 @@
 #include "filters.h"
 
 #include <Eigen/SVD>
+#include <Eigen/Eigenvalues>
+
+#include <complex>
+#include <sstream>
+#include <iomanip>
 
 namespace GPT::Filter
 {
-    void Contrast::apply(MatXd& img)
+    // Other precisions go through double unless the filter has its own kernel.
+    // Integer images use their full range as the 0 to 1 interval
+    void Filter::apply(MatXf& img)
+    {
+        MatXd mat = img.cast<double>();
+        apply(mat);
+        img = mat.cast<float>();
+    }
+
+    void Filter::apply(Image<uint16_t>& img)
+    {
+        MatXd mat = img.cast<double>() / 65535.0;
+        apply(mat);
+        img = (65535.0 * mat.array().max(0.0).min(1.0)).round().cast<uint16_t>();
+    }
+
+    // Thread budget of the Pipeline stage applying filters on this thread, zero outside of pipelines
+    static thread_local uint32_t stageThreads = 0;
+
+    // Sets the budget of the filters applied on this thread while in scope
+    struct StageThreads
     {
-        if (low < 0)
-            low = img.minCoeff();
+        uint32_t previous;
 
-        if (high < 0)
-            high = img.maxCoeff();
+        StageThreads(uint32_t value) : previous(stageThreads) { stageThreads = value; }
+        ~StageThreads(void) { stageThreads = previous; }
+    };
 
-        img.array() = (img.array() - low) / (high - low); // Images are always in between 0 and 1
+    uint32_t Filter::threads(void) const { return stageThreads > 0 ? stageThreads : numThreads; }
 
-        // To make sure
-        for (int64_t k = 0; k < img.size(); k++)
+    // Splits work in nThreads tasks on the pool running the caller, func receives the task id.
+    // Budgets are read when filters start, so filters applied inside the tasks use their own
+    template <typename Func>
+    static void runThreads(uint32_t nThreads, Func&& func)
+    {
+        if (nThreads <= 1)
         {
-            double& val = img.data()[k];
-            val = std::max<double>(0, val);
-            val = std::min<double>(1, val);
+            func(0);
+            return;
         }
+
+        ThreadPool::current().run(nThreads, [&](uint32_t tid) -> void {
+            StageThreads none(0);
+            func(tid);
+        });
     }
-    
+
+    // Every task takes a contiguous block of [0, size), so neighbouring lines are read by the same thread.
+    // Kernels read the halo around their block from the unfiltered copy of the image
+    template <typename Func>
+    static void runBlocks(uint32_t nThreads, int64_t size, Func&& func)
+    {
+        runThreads(nThreads, [&](uint32_t tid) -> void {
+            int64_t first = size * tid / nThreads, last = size * (tid + 1) / nThreads;
+            if (last > first)
+                func(first, last);
+        });
+    }
+
+    // Parameters are written with full precision, so any change gives a new signature
+    template <typename... Args>
+    static std::string makeSignature(const char* name, const Args&... args)
+    {
+        std::ostringstream ss;
+        ss << std::setprecision(17) << name;
+        ((ss << ' ' << args), ...);
+        return ss.str();
+    }
+
     /**************************************************************************/
     /**************************************************************************/
 
-	void Median::apply(MatXd& img)
-	{
-        MatXd mat(img);
+    Histogram::Histogram(double low, double high, uint32_t numBins) : low(low)
+    {
+        numBins = std::max<uint32_t>(numBins, 2);
+        width = (high - low) / double(numBins - 1);
+        bins.resize(numBins, 0);
+    }
 
-        int64_t
-            radiusX = static_cast<int64_t>(0.5 * double(sizeX)),
-            radiusY = static_cast<int64_t>(0.5 * double(sizeY));
+    template <typename T>
+    void Histogram::addValues(const T* data, int64_t size, double scale)
+    {
+        const double
+            factor = scale / width,
+            top = double(bins.size() - 1);
 
-        for (int64_t k = 0; k < mat.rows(); k++)
-            for (int64_t l = 0; l < mat.cols(); l++)
-            {
-                // Getting region
-                int64_t
-                    xo = std::max<int64_t>(l - radiusX, 0),
-                    yo = std::max<int64_t>(k - radiusY, 0),
-                    xf = std::min<int64_t>(l + radiusX + 1, mat.cols()),
-                    yf = std::min<int64_t>(k + radiusY + 1, mat.rows());
+        for (int64_t k = 0; k < size; k++)
+        {
+            double pos = std::round(double(data[k]) * factor - low / width);
+            bins[static_cast<size_t>(std::min(std::max(pos, 0.0), top))]++;
+        }
+
+        count += size;
+    }
+
+    void Histogram::add(const MatXd& img) { addValues(img.data(), img.size(), 1.0); }
+    void Histogram::add(const MatXf& img) { addValues(img.data(), img.size(), 1.0); }
+    void Histogram::add(const Image<uint16_t>& img) { addValues(img.data(), img.size(), 1.0 / 65535.0); }
+
+    void Histogram::merge(const Histogram& other)
+    {
+        if (other.bins.size() != bins.size())
+        {
+            pout("ERROR (Histogram::merge) ==> Histograms have different number of bins!!");
+            return;
+        }
 
-                int64_t size = (yf - yo) * (xf - xo);
+        for (size_t k = 0; k < bins.size(); k++)
+            bins[k] += other.bins[k];
 
-                std::vector<double> vec;
-                vec.reserve(size);
+        count += other.count;
+    }
 
-                for (int64_t y = yo; y < yf; y++)
-                    for (int64_t x = xo; x < xf; x++)
-                        vec.push_back(mat(y, x));
+    double Histogram::percentile(double value) const
+    {
+        if (count == 0)
+            return low;
 
-                std::sort(vec.begin(), vec.end());
+        const double target = std::min(std::max(value, 0.0), 1.0) * double(count - 1);
 
-                int64_t pos = static_cast<int64_t>(0.5 * double(vec.size()));
-                img(k, l) = vec.at(pos);
-            }
-	}
+        uint64_t sum = 0;
+        for (size_t k = 0; k < bins.size(); k++)
+        {
+            sum += bins[k];
+            if (double(sum) > target)
+                return low + double(k) * width;
+        }
+
+        return low + double(bins.size() - 1) * width;
+    }
 
     /**************************************************************************/
     /**************************************************************************/
 
-	void CLAHE::apply(MatXd& img)
-	{
+    template <typename Mat>
+    static void contrastApply(Mat& img, double low, double high, uint32_t nThreads)
+    {
+        using T = typename Mat::Scalar;
+        const double unit = std::is_integral_v<T> ? double(std::numeric_limits<T>::max()) : 1.0;
+
+        nThreads = std::max<uint32_t>(nThreads, 1);
+        T* data = img.data();
+
+        // Auto-contrast is computed for every frame. Parameters are not modified, so frames can be filtered concurrently
+        double bot = unit * low, top = unit * high;
+
+        if (low < 0 || high < 0)
+        {
+            std::vector<T> vMin(nThreads, std::numeric_limits<T>::max()), vMax(nThreads, std::numeric_limits<T>::lowest());
+            runThreads(nThreads, [&](uint32_t tid) -> void {
+                int64_t first = img.size() * tid / nThreads, last = img.size() * (tid + 1) / nThreads;
+                if (last > first)
+                {
+                    auto [itMin, itMax] = std::minmax_element(data + first, data + last);
+                    vMin[tid] = *itMin;
+                    vMax[tid] = *itMax;
+                }
+            });
+
+            bot = low < 0 ? double(*std::min_element(vMin.begin(), vMin.end())) : bot;
+            top = high < 0 ? double(*std::max_element(vMax.begin(), vMax.end())) : top;
+        }
+
+        const double scale = top > bot ? unit / (top - bot) : 0.0;
+
+        // Images are always in between 0 and 1, or the full range of integer types
+        runBlocks(nThreads, img.size(), [&](int64_t first, int64_t last) -> void {
+            auto vec = Eigen::Map<Eigen::Array<T, Eigen::Dynamic, 1>>(data + first, last - first);
+
+            if constexpr (std::is_integral_v<T>)
+                vec = ((vec.template cast<float>() - float(bot)) * float(scale)).max(0.0f).min(float(unit)).round().template cast<T>();
+            else
+                vec = ((vec - T(bot)) * T(scale)).max(T(0)).min(T(1));
+        });
+    }
+
+    void Contrast::setLimits(const Histogram& hist)
+    {
+        movieLow = hist.percentile(lowPercentile);
+        movieHigh = hist.percentile(highPercentile);
+    }
+
+    void Contrast::apply(MatXd& img) { contrastApply(img, wholeMovie ? movieLow : low, wholeMovie ? movieHigh : high, threads()); }
+    void Contrast::apply(MatXf& img) { contrastApply(img, wholeMovie ? movieLow : low, wholeMovie ? movieHigh : high, threads()); }
+    void Contrast::apply(Image<uint16_t>& img) { contrastApply(img, wholeMovie ? movieLow : low, wholeMovie ? movieHigh : high, threads()); }
+    std::string Contrast::signature(void) const { return makeSignature("Contrast", low, high, wholeMovie, lowPercentile, highPercentile); }
+    
+    /**************************************************************************/
+    /**************************************************************************/
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    // Compare-exchange used by sorting networks
+    template <typename T>
+    static inline void sort2(T& a, T& b)
+    {
+        T lo = std::min(a, b);
+        b = std::max(a, b);
+        a = lo;
+    }
+
+    template <typename T>
+    static T median9(T* p)
+    {
+        sort2(p[1], p[2]); sort2(p[4], p[5]); sort2(p[7], p[8]);
+        sort2(p[0], p[1]); sort2(p[3], p[4]); sort2(p[6], p[7]);
+        sort2(p[1], p[2]); sort2(p[4], p[5]); sort2(p[7], p[8]);
+        sort2(p[0], p[3]); sort2(p[5], p[8]); sort2(p[4], p[7]);
+        sort2(p[3], p[6]); sort2(p[1], p[4]); sort2(p[2], p[5]);
+        sort2(p[4], p[7]); sort2(p[4], p[2]); sort2(p[6], p[4]);
+        sort2(p[4], p[2]);
+        return p[4];
+    }
+
+    template <typename T>
+    static T median25(T* p)
+    {
+        sort2(p[0], p[1]);   sort2(p[3], p[4]);   sort2(p[2], p[4]);   sort2(p[2], p[3]);   sort2(p[6], p[7]);
+        sort2(p[5], p[7]);   sort2(p[5], p[6]);   sort2(p[9], p[10]);  sort2(p[8], p[10]);  sort2(p[8], p[9]);
+        sort2(p[12], p[13]); sort2(p[11], p[13]); sort2(p[11], p[12]); sort2(p[15], p[16]); sort2(p[14], p[16]);
+        sort2(p[14], p[15]); sort2(p[18], p[19]); sort2(p[17], p[19]); sort2(p[17], p[18]); sort2(p[21], p[22]);
+        sort2(p[20], p[22]); sort2(p[20], p[21]); sort2(p[23], p[24]); sort2(p[2], p[5]);   sort2(p[3], p[6]);
+        sort2(p[0], p[6]);   sort2(p[0], p[3]);   sort2(p[4], p[7]);   sort2(p[1], p[7]);   sort2(p[1], p[4]);
+        sort2(p[11], p[14]); sort2(p[8], p[14]);  sort2(p[8], p[11]);  sort2(p[12], p[15]); sort2(p[9], p[15]);
+        sort2(p[9], p[12]);  sort2(p[13], p[16]); sort2(p[10], p[16]); sort2(p[10], p[13]); sort2(p[20], p[23]);
+        sort2(p[17], p[23]); sort2(p[17], p[20]); sort2(p[21], p[24]); sort2(p[18], p[24]); sort2(p[18], p[21]);
+        sort2(p[19], p[22]); sort2(p[8], p[17]);  sort2(p[9], p[18]);  sort2(p[0], p[18]);  sort2(p[0], p[9]);
+        sort2(p[10], p[19]); sort2(p[1], p[19]);  sort2(p[1], p[10]);  sort2(p[11], p[20]); sort2(p[2], p[20]);
+        sort2(p[2], p[11]);  sort2(p[12], p[21]); sort2(p[3], p[21]);  sort2(p[3], p[12]);  sort2(p[13], p[22]);
+        sort2(p[4], p[22]);  sort2(p[4], p[13]);  sort2(p[14], p[23]); sort2(p[5], p[23]);  sort2(p[5], p[14]);
+        sort2(p[15], p[24]); sort2(p[6], p[24]);  sort2(p[6], p[15]);  sort2(p[7], p[16]);  sort2(p[7], p[19]);
+        sort2(p[13], p[21]); sort2(p[15], p[23]); sort2(p[7], p[13]);  sort2(p[7], p[15]);  sort2(p[1], p[9]);
+        sort2(p[3], p[11]);  sort2(p[5], p[17]);  sort2(p[11], p[17]); sort2(p[9], p[17]);  sort2(p[4], p[10]);
+        sort2(p[6], p[12]);  sort2(p[7], p[14]);  sort2(p[4], p[6]);   sort2(p[4], p[7]);   sort2(p[12], p[14]);
+        sort2(p[10], p[14]); sort2(p[6], p[7]);   sort2(p[10], p[12]); sort2(p[6], p[10]);  sort2(p[6], p[17]);
+        sort2(p[12], p[17]); sort2(p[7], p[17]);  sort2(p[7], p[10]);  sort2(p[12], p[18]); sort2(p[7], p[12]);
+        sort2(p[10], p[18]); sort2(p[12], p[20]); sort2(p[10], p[20]); sort2(p[10], p[12]);
+        return p[12];
+    }
+
+    // Image is seen as nLines contiguous lines of given length. The window spans
+    // 2*radLines+1 lines and 2*radAlong+1 pixels along each line, shrinking at the borders
+    template <typename T>
+    static void medianNetwork(const T* in, T* out, int64_t nLines, int64_t length, int64_t radLines, int64_t radAlong, int64_t line)
+    {
+        T vec[25];
+
+        for (int64_t p = 0; p < length; p++)
+        {
+            int64_t
+                lo = std::max<int64_t>(line - radLines, 0),
+                lf = std::min<int64_t>(line + radLines + 1, nLines),
+                po = std::max<int64_t>(p - radAlong, 0),
+                pf = std::min<int64_t>(p + radAlong + 1, length);
+
+            int64_t size = 0;
+            for (int64_t l = lo; l < lf; l++)
+                for (int64_t q = po; q < pf; q++)
+                    vec[size++] = in[l * length + q];
+
+            if (size == 9)
+                out[line * length + p] = median9(vec);
+            else if (size == 25)
+                out[line * length + p] = median25(vec);
+            else
+            {
+                std::nth_element(vec, vec + size / 2, vec + size);
+                out[line * length + p] = vec[size / 2];
+            }
+        }
+    }
+
+    // Huang's running histogram, with a coarse level to skip empty regions while tracking the median
+    static void medianHistogram(const uint16_t* in, uint16_t* out, int64_t nLines, int64_t length, int64_t radLines, int64_t radAlong, int64_t line,
+                                std::vector<uint32_t>& hist, std::vector<uint32_t>& coarse)
+    {
         const int64_t
-            nCols = img.cols(),
-            nRows = img.rows(),
-            tileArea = tileSizeX * tileSizeY,
-            TX = static_cast<int64_t>(std::ceil(double(nCols) / double(tileSizeX))),
-            TY = static_cast<int64_t>(std::ceil(double(nRows) / double(tileSizeY))),
-            NT = TX * TY;
+            lo = std::max<int64_t>(line - radLines, 0),
+            lf = std::min<int64_t>(line + radLines + 1, nLines);
+
+        int64_t count = 0, lt = 0; // lt -> number of elements smaller than current median
+        uint32_t m = 0;
+
+        auto addColumn = [&](int64_t q, int64_t sign) -> void {
+            for (int64_t l = lo; l < lf; l++)
+            {
+                uint16_t v = in[l * length + q];
+                hist[v] += uint32_t(sign);
+                coarse[v >> 8] += uint32_t(sign);
+                lt += v < m ? sign : 0;
+            }
+            count += sign * (lf - lo);
+        };
+
+        for (int64_t q = 0; q < std::min<int64_t>(radAlong, length); q++)
+            addColumn(q, 1);
+
+        for (int64_t p = 0; p < length; p++)
+        {
+            if (p + radAlong < length)
+                addColumn(p + radAlong, 1);
 
-        double clipValue = clipLimit * tileArea / 256.0;
+            if (p - radAlong - 1 >= 0)
+                addColumn(p - radAlong - 1, -1);
 
-        MatXd lut = MatXd::Zero(256, NT);
+            const int64_t rank = count / 2;
 
-        for (int64_t k = 0; k < nRows; k++)
-            for (int64_t l = 0; l < nCols; l++)
+            // Moving median down
+            while (lt > rank)
             {
-                int64_t
-                    y = static_cast<int64_t>(k / double(tileSizeX)),
-                    x = static_cast<int64_t>(l / double(tileSizeY)),
-                    tid = y * TX + x;
+                m--;
+                if ((m & 0xFF) == 0xFF && coarse[m >> 8] == 0)
+                {
+                    m -= 0xFF;
+                    continue;
+                }
+                lt -= hist[m];
+            }
 
-                int64_t id = static_cast<int64_t>(255.0 * img(k, l));
-                lut(id, tid)++;
+            // Moving median up
+            while (lt + hist[m] <= rank)
+            {
+                lt += hist[m++];
+                while ((m & 0xFF) == 0 && coarse[m >> 8] == 0)
+                    m += 0x100;
             }
 
-        // Normalization all look up tables
-        for (int64_t tid = 0; tid < NT; tid++)
+            out[line * length + p] = uint16_t(m);
+        }
+
+        // Cleaning histogram for the next line
+        for (int64_t q = std::max<int64_t>(length - radAlong - 1, 0); q < length; q++)
+            addColumn(q, -1);
+    }
+
+    template <typename T>
+    static void medianKernel(const T* in, T* out, int64_t nLines, int64_t length, int64_t radLines, int64_t radAlong, uint32_t nThreads)
+    {
+        const bool useNetwork = (radLines == radAlong) && (radLines == 1 || radLines == 2);
+
+        // Quantizing data to 16 bits for histogram approach
+        std::vector<uint16_t> qin, qout;
+        double low = 0.0, scale = 1.0;
+
+        const uint16_t* hin = nullptr;
+        uint16_t* hout = nullptr;
+
+        if constexpr (std::is_same_v<T, uint16_t>)
+        {
+            // Native 16-bit data goes straight into the histogram
+            hin = in;
+            hout = out;
+        }
+        else if (!useNetwork)
         {
-            // To avoid contrast differences at borders, let's clip the histogram
-            while (true)
+            const int64_t N = nLines * length;
+
+            std::vector<T> vLow(nThreads, in[0]), vHigh(nThreads, in[0]);
+            std::vector<uint8_t> vInteger(nThreads, 1);
+            runThreads(nThreads, [&](uint32_t tid) -> void {
+                int64_t first = N * tid / nThreads, last = N * (tid + 1) / nThreads;
+                if (last > first)
+                {
+                    auto [itLow, itHigh] = std::minmax_element(in + first, in + last);
+                    vLow[tid] = *itLow;
+                    vHigh[tid] = *itHigh;
+                    vInteger[tid] = std::all_of(in + first, in + last, [](T val) { return double(val) == std::round(double(val)); });
+                }
+            });
+
+            low = double(*std::min_element(vLow.begin(), vLow.end()));
+            const double high = double(*std::max_element(vHigh.begin(), vHigh.end()));
+
+            if (high == low)
+            {
+                std::copy(in, in + N, out);
+                return;
+            }
+
+            // Integer data that fits in 16 bits is kept exact
+            const double range = high - low;
+            bool exact = range <= 65535.0 && std::all_of(vInteger.begin(), vInteger.end(), [](uint8_t val) { return val == 1; });
+
+            scale = exact ? 1.0 : 65535.0 / range;
+
+            qin.resize(N);
+            qout.resize(N);
+            runBlocks(nThreads, N, [&](int64_t first, int64_t last) -> void {
+                for (int64_t k = first; k < last; k++)
+                    qin[k] = static_cast<uint16_t>(std::round((double(in[k]) - low) * scale));
+            });
+
+            hin = qin.data();
+            hout = qout.data();
+        }
+
+        runBlocks(nThreads, nLines, [&](int64_t first, int64_t last) -> void {
+            std::vector<uint32_t> hist, coarse;
+            if (!useNetwork)
+            {
+                hist.resize(65536, 0);
+                coarse.resize(256, 0);
+            }
+
+            for (int64_t line = first; line < last; line++)
+                if (useNetwork)
+                    medianNetwork(in, out, nLines, length, radLines, radAlong, line);
+                else
+                    medianHistogram(hin, hout, nLines, length, radLines, radAlong, line, hist, coarse);
+        });
+
+        // Back to the original values
+        if (!qout.empty())
+            runBlocks(nThreads, nLines * length, [&](int64_t first, int64_t last) -> void {
+                for (int64_t k = first; k < last; k++)
+                    out[k] = static_cast<T>(low + double(qout[k]) / scale);
+            });
+    }
+
+    template <typename Mat>
+    static void medianApply(Mat& img, int64_t sizeX, int64_t sizeY, uint32_t nThreads)
+    {
+        Mat mat(img);
+
+        int64_t
+            radiusX = static_cast<int64_t>(0.5 * double(sizeX)),
+            radiusY = static_cast<int64_t>(0.5 * double(sizeY));
+
+        // Contiguous lines are columns for MatXd and rows for MatXf and Image<T>
+        nThreads = std::max<uint32_t>(nThreads, 1);
+        if constexpr (Mat::IsRowMajor)
+            medianKernel(mat.data(), img.data(), img.rows(), img.cols(), radiusY, radiusX, nThreads);
+        else
+            medianKernel(mat.data(), img.data(), img.cols(), img.rows(), radiusX, radiusY, nThreads);
+    }
+
+	void Median::apply(MatXd& img) { medianApply(img, sizeX, sizeY, threads()); }
+	void Median::apply(MatXf& img) { medianApply(img, sizeX, sizeY, threads()); }
+	void Median::apply(Image<uint16_t>& img) { medianApply(img, sizeX, sizeY, threads()); }
+	std::string Median::signature(void) const { return makeSignature("Median", sizeX, sizeY); }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    // Image is seen as nLines contiguous lines of given length, tiles are set in the same way.
+    // Values are expected in between 0 and 1, or in the full range for integer types
+    template <typename T>
+    static void claheKernel(const T* in, T* out, int64_t nLines, int64_t length, int64_t tileLines, int64_t tileAlong, double clipLimit, uint32_t nThreads)
+    {
+        const int64_t
+            N = nLines * length,
+            TL = static_cast<int64_t>(std::ceil(double(nLines) / double(tileLines))),
+            TA = static_cast<int64_t>(std::ceil(double(length) / double(tileAlong))),
+            NT = TL * TA;
+
+        // Converting image to histogram bins only once
+        std::vector<uint8_t> bin(N);
+        runBlocks(nThreads, N, [&](int64_t first, int64_t last) -> void {
+            for (int64_t k = first; k < last; k++)
+                if constexpr (std::is_integral_v<T>)
+                    bin[k] = static_cast<uint8_t>(uint64_t(in[k]) * 255 / std::numeric_limits<T>::max());
+                else
+                {
+                    float val = 255.0f * float(in[k]);
+                    bin[k] = static_cast<uint8_t>(std::min(std::max(val, 0.0f), 255.0f));
+                }
+        });
+
+        // Look-up table of every tile is contiguous in memory
+        std::vector<float> lut(NT * 256);
+        const uint32_t clipValue = std::max<uint32_t>(1, static_cast<uint32_t>(clipLimit * double(tileLines * tileAlong) / 256.0));
+
+        runBlocks(nThreads, NT, [&](int64_t first, int64_t last) -> void {
+            uint32_t hist[256];
+
+            for (int64_t t = first; t < last; t++)
             {
-                double extra = 0.0;
+                const int64_t
+                    lo = (t / TA) * tileLines, lf = std::min(lo + tileLines, nLines),
+                    po = (t % TA) * tileAlong, pf = std::min(po + tileAlong, length);
+
+                std::fill(hist, hist + 256, 0);
+                for (int64_t l = lo; l < lf; l++)
+                    for (int64_t p = po; p < pf; p++)
+                        hist[bin[l * length + p]]++;
+
+                // To avoid contrast differences at borders, let's clip the histogram and redistribute the excess
+                uint32_t extra = 0;
                 for (int64_t r = 0; r < 256; r++)
-                    if (lut(r, tid) > clipValue)
+                    if (hist[r] > clipValue)
                     {
-                        extra += lut(r, tid) - clipValue;
-                        lut(r, tid) = clipValue;
+                        extra += hist[r] - clipValue;
+                        hist[r] = clipValue;
                     }
 
-                if (extra < 0.00001)
-                    break;
+                uint32_t add = extra / 256, residual = extra % 256;
+                for (int64_t r = 0; r < 256; r++)
+                    hist[r] += add;
 
-                lut.col(tid).array() += extra / 256.0;
-            } 
+                for (int64_t r = 0, step = std::max<int64_t>(256 / std::max<uint32_t>(residual, 1), 1); r < 256 && residual > 0; r += step, residual--)
+                    hist[r]++;
 
-            double norm = lut.col(tid).sum();
-            lut.col(tid).array() /= norm;
+                // Normalized cumulative distribution
+                for (int64_t r = 1; r < 256; r++)
+                    hist[r] += hist[r - 1];
 
-            for (int64_t k = 1; k < 256; k++)
-                lut(k, tid) += lut(k - 1, tid);
+                float
+                    bot = float(hist[0]),
+                    norm = hist[255] > hist[0] ? 1.0f / (float(hist[255]) - bot) : 0.0f;
 
-            double bot = lut.col(tid).minCoeff();
-            lut.col(tid).array() = (lut.col(tid).array() - bot) / (1.0 - bot);
-        }
+                float* loc = lut.data() + 256 * t;
+                for (int64_t r = 0; r < 256; r++)
+                    loc[r] = (float(hist[r]) - bot) * norm;
+            }
+        });
 
-        // Applying clahe algorithm
-        for (int64_t k = 0; k < nRows; k++)
-            for (int64_t l = 0; l < nCols; l++)
-            {
-                // Determining tile
-                int64_t x = l / tileSizeX, y = k / tileSizeY;
+        // For every pixel we interpolate between the closest tiles' centers.
+        // Tiles and weights along lines are the same for all lines
+        std::vector<int64_t> tileA(length), neighA(length);
+        std::vector<float> weightA(length);
 
-                double px = double(l) / tileSizeX - x,
-                    py = double(k) / tileSizeY - y;
+        auto setup = [](int64_t pos, int64_t tileSize, int64_t numTiles, int64_t& tile, int64_t& neigh, float& weight) -> void {
+            tile = pos / tileSize;
 
-                int dx = round(px) == 1.0 ? 1 : -1,
-                    dy = round(py) == 1.0 ? 1 : -1;
+            double frac = double(pos) / double(tileSize) - double(tile);
+            int64_t delta = frac >= 0.5 ? 1 : -1;
 
-                // boundary conditions
-                if (y == 0 && dy == -1)
-                    dy = 0;
+            // boundary conditions
+            if ((tile == 0 && delta == -1) || (tile == numTiles - 1 && delta == 1))
+                delta = 0;
 
-                if (y == (TY - 1) && dy == 1)
-                    dy = 0;
+            neigh = tile + delta;
+            weight = static_cast<float>(std::abs(frac - 0.5)); // distance from tile's center
+        };
 
-                if (x == 0 && dx == -1)
-                    dx = 0;
+        for (int64_t p = 0; p < length; p++)
+            setup(p, tileAlong, TA, tileA[p], neighA[p], weightA[p]);
 
-                if (x == (TX - 1) && dx == 1)
-                    dx = 0;
+        runBlocks(nThreads, nLines, [&](int64_t first, int64_t last) -> void {
+            for (int64_t l = first; l < last; l++)
+            {
+                int64_t tileL, neighL;
+                float wL;
+                setup(l, tileLines, TL, tileL, neighL, wL);
+
+                const float
+                    *lut0 = lut.data() + 256 * tileL * TA,
+                    *lut1 = lut.data() + 256 * neighL * TA;
 
-                // getting distance from tile's center
-                px = px > 0.5 ? px - 0.5 : 0.5 - px;
-                py = py > 0.5 ? py - 0.5 : 0.5 - py;
+                const uint8_t* lbin = bin.data() + l * length;
+                T* lout = out + l * length;
 
-                int64_t
-                    bin = static_cast<int64_t>(255.0 * img(k, l)),
-                    tid0 = (y + 0) * TX + (x + 0),
-                    tid1 = (y + 0) * TX + (x + dx),
-                    tid2 = (y + dy) * TX + (x + 0),
-                    tid3 = (y + dy) * TX + (x + dx);
+                for (int64_t p = 0; p < length; p++)
+                {
+                    const int64_t
+                        b = lbin[p],
+                        t0 = 256 * tileA[p] + b,
+                        t1 = 256 * neighA[p] + b;
 
-                double valx1 = (1.0 - px) * lut(bin, tid0) + px * (lut(bin, tid1));
-                double valx2 = (1.0 - px) * lut(bin, tid2) + px * (lut(bin, tid3));
+                    const float wA = weightA[p];
+                    float val0 = lut0[t0] + wA * (lut0[t1] - lut0[t0]);
+                    float val1 = lut1[t0] + wA * (lut1[t1] - lut1[t0]);
 
-                img(k, l) = (1.0 - py) * valx1 + py * valx2;
+                    if constexpr (std::is_integral_v<T>)
+                        lout[p] = static_cast<T>(std::round(float(std::numeric_limits<T>::max()) * (val0 + wL * (val1 - val0))));
+                    else
+                        lout[p] = static_cast<T>(val0 + wL * (val1 - val0));
+                }
             }
-	}
+        });
+    }
+
+    template <typename Mat>
+    static void claheApply(Mat& img, int64_t tileSizeX, int64_t tileSizeY, double clipLimit, uint32_t nThreads)
+    {
+        Mat mat(img);
+
+        // Contiguous lines are columns for MatXd and rows for MatXf and Image<T>
+        nThreads = std::max<uint32_t>(nThreads, 1);
+        if constexpr (Mat::IsRowMajor)
+            claheKernel(mat.data(), img.data(), img.rows(), img.cols(), tileSizeY, tileSizeX, clipLimit, nThreads);
+        else
+            claheKernel(mat.data(), img.data(), img.cols(), img.rows(), tileSizeX, tileSizeY, clipLimit, nThreads);
+    }
+
+	void CLAHE::apply(MatXd& img) { claheApply(img, tileSizeX, tileSizeY, clipLimit, threads()); }
+	void CLAHE::apply(MatXf& img) { claheApply(img, tileSizeX, tileSizeY, clipLimit, threads()); }
+	void CLAHE::apply(Image<uint16_t>& img) { claheApply(img, tileSizeX, tileSizeY, clipLimit, threads()); }
+	std::string CLAHE::signature(void) const { return makeSignature("CLAHE", clipLimit, tileSizeX, tileSizeY); }
 
     /**************************************************************************/
     /**************************************************************************/
 
-    void SVD::importImages(const std::vector<MatXd>& vec)
+    // Accumulation type for kernels working on a copy of the image
+    template <typename T>
+    using Accum = std::conditional_t<std::is_same_v<T, double>, double, float>;
+
+    // Copies image into buffer and back, rounding and clamping for integer types
+    template <typename Mat>
+    static std::vector<Accum<typename Mat::Scalar>> toBuffer(const Mat& img)
     {
-        denoised.resize(vec.size());
-        vImages.resize(vec.size());
-        std::copy(vec.begin(), vec.end(), vImages.begin());
+        return std::vector<Accum<typename Mat::Scalar>>(img.data(), img.data() + img.size());
     }
 
-	void SVD::run(bool &trigger)
-	{
-        int64_t
-            maxFrames = vImages.size(),
-            width = vImages[0].cols(),
-            height = vImages[0].rows(),
-            rows = width * height;
+    template <typename Mat, typename Acc>
+    static void fromBuffer(const std::vector<Acc>& buf, Mat& img, uint32_t nThreads)
+    {
+        using T = typename Mat::Scalar;
+        runBlocks(nThreads, img.size(), [&](int64_t first, int64_t last) -> void {
+            for (int64_t k = first; k < last; k++)
+                if constexpr (std::is_integral_v<T>)
+                    img.data()[k] = static_cast<T>(std::min<Acc>(std::max<Acc>(std::round(buf[k]), 0), Acc(std::numeric_limits<T>::max())));
+                else
+                    img.data()[k] = static_cast<T>(buf[k]);
+        });
+    }
+
+    // Deriche, "Recursively implementing the Gaussian and its derivatives", INRIA RR-1893 (1993).
+    // The Gaussian is fitted by two damped cosines, each one being a complex first order recursion
+    template <typename Acc>
+    struct Deriche
+    {
+        Acc poleRe[2], poleIm[2], resRe[2], resIm[2], norm;
+    };
 
-        // We will take the average over every rank approximated image for different slices
-        std::vector<float> counter(maxFrames, 0);
+    template <typename Acc>
+    static bool dericheCoefficients(double sigma, Deriche<Acc>& coef)
+    {
+        if (sigma < 0.5)
+            return false;
 
-        for (int64_t fr = 0; fr < maxFrames; fr++)
-            denoised[fr] = MatXd::Zero(height, width);
+        const double
+            a[2] = { 1.680, -0.6803 }, b[2] = { 3.735, -0.2598 },
+            decay[2] = { 1.783, 1.723 }, freq[2] = { 0.6318, 1.997 };
 
-        MatXd mat(rows, slice);
-        for (int64_t fr = 0; fr <= maxFrames - slice; fr++)
+        // Normalization is the sum of both sides, with the center counted once
+        double norm = -(a[0] + a[1]);
+        for (int32_t j = 0; j < 2; j++)
         {
-            for (int64_t k = 0; k < slice; k++)
-                mat.col(k) = vImages[fr + k].reshaped();
+            std::complex<double>
+                pole = std::exp(std::complex<double>(-decay[j], freq[j]) / sigma),
+                res(a[j], -b[j]);
 
-            Eigen::BDCSVD<MatXd> svd(mat, Eigen::ComputeThinU | Eigen::ComputeThinV);
-            MatXd U = svd.matrixU();
-            MatXd V = svd.matrixV().transpose();
-            const VecXd& S = svd.singularValues();
+            norm += 2.0 * (res / (1.0 - pole)).real();
 
+            coef.poleRe[j] = Acc(pole.real());
+            coef.poleIm[j] = Acc(pole.imag());
+            coef.resRe[j] = Acc(res.real());
+            coef.resIm[j] = Acc(res.imag());
+        }
 
-            mat = S(0) * U.col(0) * V.row(0);
+        coef.norm = Acc(1.0 / norm);
+        return true;
+    }
 
-            for (int64_t k = 1; k < rank; k++)
-                mat += S(k) * U.col(k) * V.row(k);
+    // Runs over n elements separated by stride. Every element is a vector of width contiguous values,
+    // so going across lines runs over whole line segments at once. Borders are replicated
+    template <typename Acc>
+    static void derichePass(Acc* data, int64_t n, int64_t stride, int64_t width, const Deriche<Acc>& coef, std::vector<Acc>& buf)
+    {
+        buf.assign((n + 2) * width, Acc(0));
+        Acc
+            *sumAfter = buf.data(),
+            *stRe = buf.data() + n * width,
+            *stIm = stRe + width;
 
+        // Anti-causal part, sum over the samples after the current one: t[k] = p * (x[k+1] + t[k+1])
+        for (int32_t j = 0; j < 2; j++)
+        {
+            const Acc
+                pr = coef.poleRe[j], pi = coef.poleIm[j],
+                rr = coef.resRe[j], ri = coef.resIm[j],
+                den = (1 - pr) * (1 - pr) + pi * pi;
 
-            for (int64_t k = 0; k < slice; k++)
+            // Steady state for a constant signal is t = x * p / (1 - p)
+            const Acc* last = data + (n - 1) * stride;
+            for (int64_t w = 0; w < width; w++)
             {
-                denoised[fr + k] += mat.col(k).reshaped();
-                counter[fr + k]++;
+                stRe[w] = last[w] * ((1 - pr) / den - 1);
+                stIm[w] = last[w] * pi / den;
             }
 
-            // In case we want to stop this function from outside
-            if (trigger)
-                return;
+            for (int64_t k = n - 1; k >= 0; k--)
+            {
+                if (k < n - 1)
+                {
+                    const Acc* next = data + (k + 1) * stride;
+                    for (int64_t w = 0; w < width; w++)
+                    {
+                        Acc re = next[w] + stRe[w], im = stIm[w];
+                        stRe[w] = pr * re - pi * im;
+                        stIm[w] = pr * im + pi * re;
+                    }
+                }
+
+                Acc* out = sumAfter + k * width;
+                for (int64_t w = 0; w < width; w++)
+                    out[w] += rr * stRe[w] - ri * stIm[w];
+            }
+        }
+
+        // Causal part, including the current sample: s[k] = x[k] + p * s[k-1]
+        for (int32_t j = 0; j < 2; j++)
+        {
+            const Acc
+                pr = coef.poleRe[j], pi = coef.poleIm[j],
+                rr = coef.resRe[j], ri = coef.resIm[j],
+                den = (1 - pr) * (1 - pr) + pi * pi;
+
+            // Steady state for a constant signal is s = x / (1 - p)
+            for (int64_t w = 0; w < width; w++)
+            {
+                stRe[w] = data[w] * (1 - pr) / den;
+                stIm[w] = data[w] * pi / den;
+            }
+
+            for (int64_t k = 0; k < n; k++)
+            {
+                const Acc* x = data + k * stride;
+                Acc* out = sumAfter + k * width;
+
+                for (int64_t w = 0; w < width; w++)
+                {
+                    Acc re = x[w] + pr * stRe[w] - pi * stIm[w], im = pr * stIm[w] + pi * stRe[w];
+                    stRe[w] = re;
+                    stIm[w] = im;
+                    out[w] += rr * re - ri * im;
+                }
+            }
+        }
+
+        for (int64_t k = 0; k < n; k++)
+        {
+            Acc* x = data + k * stride;
+            const Acc* out = sumAfter + k * width;
+
+            for (int64_t w = 0; w < width; w++)
+                x[w] = out[w] * coef.norm;
         }
+    }
 
-        for (int64_t fr = 0; fr < maxFrames; fr++)
-            denoised[fr] /= counter[fr];
+    template <typename Acc>
+    static void gaussianKernel(Acc* data, int64_t nLines, int64_t length, double sigmaLines, double sigmaAlong, uint32_t nThreads)
+    {
+        Deriche<Acc> coef;
+
+        if (dericheCoefficients(sigmaAlong, coef))
+            runBlocks(nThreads, nLines, [&](int64_t first, int64_t last) -> void {
+                std::vector<Acc> buf;
+                for (int64_t l = first; l < last; l++)
+                    derichePass(data + l * length, length, 1, 1, coef, buf);
+            });
 
+        // Threads take blocks of columns and run over all lines together
+        if (dericheCoefficients(sigmaLines, coef))
+            runBlocks(nThreads, length, [&](int64_t first, int64_t last) -> void {
+                std::vector<Acc> buf;
+                derichePass(data + first, nLines, length, last - first, coef, buf);
+            });
     }
 
-    const MatXd& SVD::getImage(int64_t frame) { return denoised[frame]; }
-    
-    void SVD::updateImages(std::vector<MatXd>& vec)
+    template <typename Mat>
+    static void gaussianApply(Mat& img, double sigmaX, double sigmaY, uint32_t nThreads)
     {
-        assert(vec.size() == denoised.size());
-        std::copy(denoised.begin(), denoised.end(), vec.begin());
+        auto buf = toBuffer(img);
+
+        // Contiguous lines are columns for MatXd and rows for MatXf and Image<T>
+        nThreads = std::max<uint32_t>(nThreads, 1);
+        if constexpr (Mat::IsRowMajor)
+            gaussianKernel(buf.data(), img.rows(), img.cols(), sigmaY, sigmaX, nThreads);
+        else
+            gaussianKernel(buf.data(), img.cols(), img.rows(), sigmaX, sigmaY, nThreads);
+
+        fromBuffer(buf, img, nThreads);
+    }
+
+	void Gaussian::apply(MatXd& img) { gaussianApply(img, sigmaX, sigmaY, threads()); }
+	void Gaussian::apply(MatXf& img) { gaussianApply(img, sigmaX, sigmaY, threads()); }
+	void Gaussian::apply(Image<uint16_t>& img) { gaussianApply(img, sigmaX, sigmaY, threads()); }
+	std::string Gaussian::signature(void) const { return makeSignature("Gaussian", sigmaX, sigmaY); }
+
+    template <typename Mat>
+    static void dogApply(Mat& img, double sigmaLow, double sigmaHigh, uint32_t nThreads)
+    {
+        Mat wide(img);
+        gaussianApply(img, sigmaLow, sigmaLow, nThreads);
+        gaussianApply(wide, sigmaHigh, sigmaHigh, nThreads);
+        img -= wide;
+    }
+
+	void DoG::apply(MatXd& img) { dogApply(img, sigmaLow, sigmaHigh, threads()); }
+	void DoG::apply(MatXf& img) { dogApply(img, sigmaLow, sigmaHigh, threads()); }
+	std::string DoG::signature(void) const { return makeSignature("DoG", sigmaLow, sigmaHigh); }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    // Running minimum or maximum over windows of 2*radius+1 elements with van Herk/Gil-Werman: prefix and
+    // suffix extrema inside blocks of window size, so three comparisons per element whatever the radius.
+    // Elements are vectors as in derichePass, and borders are padded with values that never win
+    template <bool isMin, typename Acc>
+    static void vhgwPass(Acc* data, int64_t n, int64_t stride, int64_t width, int64_t radius, std::vector<Acc>& g, std::vector<Acc>& h)
+    {
+        if (radius <= 0)
+            return;
+
+        const int64_t
+            size = 2 * radius + 1,
+            nPad = ((n + 2 * radius + size - 1) / size) * size;
+
+        const Acc pad = isMin ? std::numeric_limits<Acc>::max() : std::numeric_limits<Acc>::lowest();
+        auto op = [](Acc a, Acc b) -> Acc { return isMin ? std::min(a, b) : std::max(a, b); };
+
+        g.resize(nPad * width);
+        h.resize(nPad * width);
+
+        // Blocks start over at their first element, prev is only used otherwise
+        auto fill = [&](int64_t k, Acc* dst, const Acc* prev) -> void {
+            int64_t id = k - radius;
+            bool inside = id >= 0 && id < n;
+
+            for (int64_t w = 0; w < width; w++)
+            {
+                Acc val = inside ? data[id * stride + w] : pad;
+                dst[w] = prev ? op(prev[w], val) : val;
+            }
+        };
+
+        for (int64_t k = 0; k < nPad; k++)
+            fill(k, g.data() + k * width, k % size == 0 ? nullptr : g.data() + (k - 1) * width);
+
+        for (int64_t k = nPad - 1; k >= 0; k--)
+            fill(k, h.data() + k * width, k % size == size - 1 ? nullptr : h.data() + (k + 1) * width);
+
+        // Window centered at k covers padded positions k to k + 2 * radius
+        for (int64_t k = 0; k < n; k++)
+        {
+            Acc* dst = data + k * stride;
+            const Acc
+                *left = h.data() + k * width,
+                *right = g.data() + (k + 2 * radius) * width;
+
+            for (int64_t w = 0; w < width; w++)
+                dst[w] = op(left[w], right[w]);
+        }
+    }
+
+    template <bool isMin, typename Acc>
+    static void minMaxKernel(Acc* data, int64_t nLines, int64_t length, int64_t radLines, int64_t radAlong, uint32_t nThreads)
+    {
+        runBlocks(nThreads, nLines, [&](int64_t first, int64_t last) -> void {
+            std::vector<Acc> g, h;
+            for (int64_t l = first; l < last; l++)
+                vhgwPass<isMin>(data + l * length, length, 1, 1, radAlong, g, h);
+        });
+
+        runBlocks(nThreads, length, [&](int64_t first, int64_t last) -> void {
+            std::vector<Acc> g, h;
+            vhgwPass<isMin>(data + first, nLines, length, last - first, radLines, g, h);
+        });
+    }
+
+    template <typename Mat>
+    static void topHatApply(Mat& img, int64_t radiusX, int64_t radiusY, uint32_t nThreads)
+    {
+        auto buf = toBuffer(img);
+
+        // Contiguous lines are columns for MatXd and rows for MatXf and Image<T>
+        int64_t nLines = img.cols(), length = img.rows(), radLines = radiusX, radAlong = radiusY;
+        if constexpr (Mat::IsRowMajor)
+        {
+            std::swap(nLines, length);
+            std::swap(radLines, radAlong);
+        }
+
+        // Opening is an erosion followed by a dilation, and it is never above the image
+        nThreads = std::max<uint32_t>(nThreads, 1);
+        minMaxKernel<true>(buf.data(), nLines, length, radLines, radAlong, nThreads);
+        minMaxKernel<false>(buf.data(), nLines, length, radLines, radAlong, nThreads);
+
+        runBlocks(nThreads, img.size(), [&](int64_t first, int64_t last) -> void {
+            for (int64_t k = first; k < last; k++)
+                buf[k] = img.data()[k] - buf[k];
+        });
+
+        fromBuffer(buf, img, nThreads);
+    }
+
+	void TopHat::apply(MatXd& img) { topHatApply(img, radiusX, radiusY, threads()); }
+	void TopHat::apply(MatXf& img) { topHatApply(img, radiusX, radiusY, threads()); }
+	void TopHat::apply(Image<uint16_t>& img) { topHatApply(img, radiusX, radiusY, threads()); }
+	std::string TopHat::signature(void) const { return makeSignature("TopHat", radiusX, radiusY); }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    // Immerkaer, "Fast noise variance estimation", CVIU 64 (1996). Mean absolute response to the
+    // difference of two Laplacians, which cancels smooth structures
+    static double estimateNoise(const MatXd& img)
+    {
+        const int64_t nRows = img.rows(), nCols = img.cols();
+        if (nRows < 3 || nCols < 3)
+            return 0.0;
+
+        double sum = 0.0;
+        for (int64_t c = 1; c < nCols - 1; c++)
+            for (int64_t r = 1; r < nRows - 1; r++)
+            {
+                double val = 4.0 * img(r, c)
+                    - 2.0 * (img(r - 1, c) + img(r + 1, c) + img(r, c - 1) + img(r, c + 1))
+                    + img(r - 1, c - 1) + img(r + 1, c - 1) + img(r - 1, c + 1) + img(r + 1, c + 1);
+
+                sum += std::abs(val);
+            }
+
+        return sum * std::sqrt(0.5 * EIGEN_PI) / (6.0 * double(nRows - 2) * double(nCols - 2));
+    }
+
+    // Copy with pad pixels mirrored around every border, the edge itself is not repeated
+    static MatXd mirrorPad(const MatXd& img, int64_t pad)
+    {
+        auto mirror = [](int64_t k, int64_t n) -> int64_t {
+            if (n == 1)
+                return 0;
+
+            while (k < 0 || k >= n)
+                k = k < 0 ? -k : 2 * (n - 1) - k;
+
+            return k;
+        };
+
+        const int64_t nRows = img.rows(), nCols = img.cols();
+
+        std::vector<int64_t> rowId(nRows + 2 * pad);
+        for (int64_t r = 0; r < int64_t(rowId.size()); r++)
+            rowId[r] = mirror(r - pad, nRows);
+
+        MatXd out(nRows + 2 * pad, nCols + 2 * pad);
+        for (int64_t c = 0; c < out.cols(); c++)
+        {
+            const double* src = img.data() + mirror(c - pad, nCols) * nRows;
+            double* dst = out.data() + c * out.rows();
+
+            for (int64_t r = 0; r < out.rows(); r++)
+                dst[r] = src[rowId[r]];
+        }
+
+        return out;
+    }
+
+    // Weighted average of the pixels around center in all the padded frames, with weights given by the distance between
+    // their patches. The center pixel takes the largest weight of the others, as it would always match perfectly
+    static void nlmApply(const std::vector<const MatXd*>& frames, size_t centerId, double sigma, double strength,
+                         int64_t patchRadius, int64_t searchRadius, MatXd& out, uint32_t nThreads)
+    {
+        const int64_t
+            pad = patchRadius + searchRadius,
+            nRows = frames[centerId]->rows() - 2 * pad,
+            nCols = frames[centerId]->cols() - 2 * pad,
+            patch = 2 * patchRadius + 1;
+
+        const MatXd& center = *frames[centerId];
+        out.resize(nRows, nCols);
+
+        const double
+            h2 = strength * strength * sigma * sigma,
+            offset = 2.0 * sigma * sigma,
+            norm = 1.0 / double(patch * patch);
+
+        if (h2 <= 0.0)
+        {
+            out = center.block(pad, pad, nRows, nCols);
+            return;
+        }
+
+        // Weights below exp(-30) are left out, which also skips most calls to exp
+        const double cutoff = 30.0;
+
+        // Columns are contiguous, so every task takes a block of columns
+        runBlocks(std::max<uint32_t>(nThreads, 1), nCols, [&](int64_t first, int64_t last) -> void {
+            const int64_t
+                width = last - first,
+                sRows = nRows + patch - 1,
+                sCols = width + patch - 1;
+
+            MatXd
+                num = MatXd::Zero(nRows, width),
+                den = MatXd::Zero(nRows, width),
+                best = MatXd::Zero(nRows, width);
+
+            // Integral image of squared differences, with a row and a column of zeros in front
+            MatXd sat = MatXd::Zero(sRows + 1, sCols + 1);
+
+            for (size_t id = 0; id < frames.size(); id++)
+            {
+                const MatXd& other = *frames[id];
+
+                for (int64_t dc = -searchRadius; dc <= searchRadius; dc++)
+                    for (int64_t dr = -searchRadius; dr <= searchRadius; dr++)
+                    {
+                        if (id == centerId && dr == 0 && dc == 0)
+                            continue;
+
+                        // Patches of the block start at row and column searchRadius of the padded frames
+                        for (int64_t c = 0; c < sCols; c++)
+                        {
+                            const double
+                                *a = center.data() + (first + searchRadius + c) * center.rows() + searchRadius,
+                                *b = other.data() + (first + searchRadius + c + dc) * other.rows() + searchRadius + dr,
+                                *prev = sat.data() + c * sat.rows();
+
+                            double* col = sat.data() + (c + 1) * sat.rows();
+
+                            double acc = 0.0;
+                            for (int64_t r = 0; r < sRows; r++)
+                            {
+                                double diff = a[r] - b[r];
+                                acc += diff * diff;
+                                col[r + 1] = prev[r + 1] + acc;
+                            }
+                        }
+
+                        for (int64_t c = 0; c < width; c++)
+                        {
+                            const double
+                                *left = sat.data() + c * sat.rows(),
+                                *right = sat.data() + (c + patch) * sat.rows(),
+                                *val = other.data() + (first + pad + c + dc) * other.rows() + pad + dr;
+
+                            for (int64_t r = 0; r < nRows; r++)
+                            {
+                                double dist = right[r + patch] - right[r] - left[r + patch] + left[r];
+                                double arg = std::max(norm * dist - offset, 0.0) / h2;
+                                if (arg > cutoff)
+                                    continue;
+
+                                double wgt = std::exp(-arg);
+                                num(r, c) += wgt * val[r];
+                                den(r, c) += wgt;
+                                best(r, c) = std::max(best(r, c), wgt);
+                            }
+                        }
+                    }
+            }
+
+            for (int64_t c = 0; c < width; c++)
+                for (int64_t r = 0; r < nRows; r++)
+                {
+                    double wgt = best(r, c) > 0.0 ? best(r, c) : 1.0;
+                    out(r, first + c) = (num(r, c) + wgt * center(pad + r, pad + first + c)) / (den(r, c) + wgt);
+                }
+        });
+    }
+
+    std::string NLMeans::signature(void) const { return makeSignature("NLMeans", sigma, strength, patchRadius, searchRadius); }
+
+    void NLMeans::apply(MatXd& img)
+    {
+        const int64_t pad = std::max<int64_t>(patchRadius, 0) + std::max<int64_t>(searchRadius, 0);
+        MatXd padded = mirrorPad(img, pad);
+
+        double noise = sigma < 0.0 ? estimateNoise(img) : sigma;
+        nlmApply({ &padded }, 0, noise, strength, std::max<int64_t>(patchRadius, 0), std::max<int64_t>(searchRadius, 0), img, threads());
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    void SVD::importImages(const std::vector<MatXd>& vec)
+    {
+        denoised.resize(vec.size());
+        vImages.resize(vec.size());
+        std::copy(vec.begin(), vec.end(), vImages.begin());
+    }
+
+	void SVD::run(bool &trigger)
+	{
+        // Windows are independent, so every thread streams its own block of frames. Blocks are
+        // extended by slice-1 frames on both sides to include every window covering them
+        const uint32_t nThreads = threads();
+        int64_t
+            maxFrames = int64_t(vImages.size()),
+            nBlocks = std::max<int64_t>(std::min<int64_t>(nThreads, maxFrames / slice), 1);
+
+        runThreads(uint32_t(nBlocks), [&](uint32_t tid) -> void {
+            int64_t
+                first = maxFrames * tid / nBlocks,
+                last = maxFrames * (tid + 1) / nBlocks,
+                begin = std::max<int64_t>(first - slice + 1, 0),
+                end = std::min<int64_t>(last + slice - 1, maxFrames);
+
+            SVD block;
+            block.slice = slice;
+            block.rank = rank;
+            block.truncated = truncated;
+            block.numThreads = nBlocks > 1 ? 1 : nThreads;
+
+            block.emit = [&](int64_t frame, MatXd& img) -> void {
+                frame += begin;
+                if (frame >= first && frame < last)
+                    denoised[frame] = std::move(img);
+            };
+
+            for (int64_t fr = begin; fr < end; fr++)
+            {
+                // In case we want to stop this function from outside
+                if (trigger)
+                    break;
+
+                block.push(vImages[fr]);
+            }
+
+            block.flush();
+        });
+    }
+
+    std::string SVD::signature(void) const { return makeSignature("SVD", slice, rank, truncated); }
+
+    void SVD::push(const MatXd& img)
+    {
+        int64_t nRing = 2 * slice - 1;
+        if (numPushed == 0)
+        {
+            ring.assign(nRing, MatXd());
+            counter.assign(nRing, 0);
+            gram = MatXd::Zero(slice, nRing);
+            weight = MatXd::Zero(nRing, nRing);
+        }
+
+        // Replacing a frame that was already emitted
+        int64_t fr = numPushed++, id = fr % nRing;
+        ring[id] = img;
+        counter[id] = 0;
+        gram.col(id).setZero();
+        weight.col(id).setZero();
+
+        // Windows share frames, so every inner product is computed only once
+        int64_t
+            nDots = std::min<int64_t>(slice, fr + 1),
+            size = img.size();
+
+        uint32_t nThreads = std::max<uint32_t>(threads(), 1);
+        MatXd partial(nDots, nThreads);
+
+        runThreads(nThreads, [&](uint32_t tid) -> void {
+            int64_t
+                first = size * tid / nThreads,
+                length = size * (tid + 1) / nThreads - first;
+
+            auto cur = ring[id].reshaped().segment(first, length);
+            for (int64_t d = 0; d < nDots; d++)
+                partial(d, tid) = ring[(fr - d) % nRing].reshaped().segment(first, length).dot(cur);
+        });
+
+        for (int64_t d = 0; d < nDots; d++)
+            gram(d, (fr - d) % nRing) = partial.row(d).sum();
+
+        // The window starting at fr - slice + 1 is complete, and it was the last one covering that frame
+        if (fr >= slice - 1)
+        {
+            addWindow(fr - slice + 1, slice);
+            emitFrame(numEmitted++);
+        }
+    }
+
+    void SVD::flush(void)
+    {
+        if (numPushed == 0)
+            return;
+
+        // Not enough frames for a single window, so we use all of them
+        if (numPushed < slice)
+            addWindow(0, numPushed);
+
+        while (numEmitted < numPushed)
+            emitFrame(numEmitted++);
+
+        numPushed = numEmitted = 0;
+        ring.clear();
+    }
+
+    void SVD::addWindow(int64_t first, int64_t size)
+    {
+        // With X = U S V^T, the rank-r approximation of the window is X V_r V_r^T, so
+        // every window only contributes a size x size projector onto its own frames
+
+        int64_t
+            nRing = int64_t(ring.size()),
+            nRank = std::min<int64_t>(rank, size);
+
+        MatXd V;
+        if (truncated)
+        {
+            // V are the eigenvectors of the Gram matrix X^T X, sorted by increasing eigenvalues
+            MatXd G(size, size);
+            for (int64_t i = 0; i < size; i++)
+                for (int64_t j = i; j < size; j++)
+                    G(i, j) = G(j, i) = gram(j - i, (first + i) % nRing);
+
+            Eigen::SelfAdjointEigenSolver<MatXd> eigen(G);
+            V = eigen.eigenvectors().rightCols(nRank);
+        }
+        else
+        {
+            MatXd mat(ring[first % nRing].size(), size);
+            for (int64_t k = 0; k < size; k++)
+                mat.col(k) = ring[(first + k) % nRing].reshaped();
+
+            Eigen::BDCSVD<MatXd> svd(mat, Eigen::ComputeThinV);
+            V = svd.matrixV().leftCols(nRank);
+        }
+
+        MatXd P = V * V.transpose();
+        for (int64_t k = 0; k < size; k++)
+        {
+            int64_t id = (first + k) % nRing;
+            for (int64_t j = 0; j < size; j++)
+                weight(j - k + slice - 1, id) += P(j, k);
+
+            counter[id]++;
+        }
+    }
+
+    void SVD::emitFrame(int64_t frame)
+    {
+        int64_t nRing = int64_t(ring.size()), id = frame % nRing;
+
+        // We take the average over every window covering this frame
+        MatXd img = MatXd::Zero(ring[id].rows(), ring[id].cols());
+
+        uint32_t nThreads = std::max<uint32_t>(threads(), 1);
+        runThreads(nThreads, [&](uint32_t tid) -> void {
+            int64_t
+                first = img.size() * tid / nThreads,
+                length = img.size() * (tid + 1) / nThreads - first;
+
+            auto out = img.reshaped().segment(first, length);
+            for (int64_t d = 0; d < nRing; d++)
+            {
+                int64_t fr = frame + d - (slice - 1);
+                if (fr >= 0 && fr < numPushed && weight(d, id) != 0.0)
+                    out += weight(d, id) * ring[fr % nRing].reshaped().segment(first, length);
+            }
+
+            out /= counter[id];
+        });
+
+        if (emit)
+            emit(frame, img);
+    }
+
+    const MatXd& SVD::getImage(int64_t frame) { return denoised[frame]; }
+    
+    void SVD::updateImages(std::vector<MatXd>& vec)
+    {
+        assert(vec.size() == denoised.size());
+        std::copy(denoised.begin(), denoised.end(), vec.begin());
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    void Temporal::push(const MatXd& img)
+    {
+        const int64_t size = 2 * radius + 1;
+        if (numPushed == 0)
+            ring.assign(size, MatXd());
+
+        // Frames older than the window of the next frame to emit can go
+        int64_t fr = numPushed++;
+        while (oldest < fr - 2 * radius)
+        {
+            remove(ring[oldest++ % size]);
+            count--;
+        }
+
+        ring[fr % size] = img;
+        insert(ring[fr % size]);
+        count++;
+
+        if (fr >= radius)
+            emitFrame(fr - radius);
+    }
+
+    void Temporal::flush(void)
+    {
+        const int64_t size = 2 * radius + 1;
+
+        // Windows shrink at the end of the movie
+        while (numEmitted < numPushed)
+        {
+            while (oldest < numEmitted - radius)
+            {
+                remove(ring[oldest++ % size]);
+                count--;
+            }
+
+            emitFrame(numEmitted);
+        }
+
+        while (oldest < numPushed)
+        {
+            remove(ring[oldest++ % size]);
+            count--;
+        }
+
+        restart();
+    }
+
+    void Temporal::restart(void)
+    {
+        numPushed = numEmitted = oldest = count = 0;
+        ring.clear();
+    }
+
+    void Temporal::emitFrame(int64_t frame)
+    {
+        const MatXd& center = ring[frame % ring.size()];
+
+        MatXd img(center.rows(), center.cols());
+        compute(center, img);
+        numEmitted = frame + 1;
+
+        if (emit)
+            emit(frame, img);
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    std::string RunningMean::signature(void) const { return makeSignature("RunningMean", radius); }
+
+    void RunningMean::insert(const MatXd& img)
+    {
+        if (count == 0)
+            sum = MatXd::Zero(img.rows(), img.cols());
+
+        sum += img;
+    }
+
+    void RunningMean::remove(const MatXd& img) { sum -= img; }
+
+    void RunningMean::compute(const MatXd& /*center*/, MatXd& out) { out = sum / double(count); }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    std::string TemporalMedian::signature(void) const { return makeSignature("TemporalMedian", radius); }
+
+    void TemporalMedian::insert(const MatXd& img)
+    {
+        const int64_t size = 2 * radius + 1;
+        if (count == 0)
+            sorted.assign(size * img.size(), 0.0);
+
+        uint32_t nThreads = std::max<uint32_t>(threads(), 1);
+        runThreads(nThreads, [&](uint32_t tid) -> void {
+            int64_t first = img.size() * tid / nThreads, last = img.size() * (tid + 1) / nThreads;
+
+            for (int64_t k = first; k < last; k++)
+            {
+                double* loc = sorted.data() + k * size;
+                double* pos = std::upper_bound(loc, loc + count, img.data()[k]);
+                std::copy_backward(pos, loc + count, loc + count + 1);
+                *pos = img.data()[k];
+            }
+        });
+    }
+
+    void TemporalMedian::remove(const MatXd& img)
+    {
+        const int64_t size = 2 * radius + 1;
+
+        uint32_t nThreads = std::max<uint32_t>(threads(), 1);
+        runThreads(nThreads, [&](uint32_t tid) -> void {
+            int64_t first = img.size() * tid / nThreads, last = img.size() * (tid + 1) / nThreads;
+
+            for (int64_t k = first; k < last; k++)
+            {
+                double* loc = sorted.data() + k * size;
+                double* pos = std::lower_bound(loc, loc + count, img.data()[k]);
+                std::copy(pos + 1, loc + count, pos);
+            }
+        });
+    }
+
+    void TemporalMedian::compute(const MatXd& /*center*/, MatXd& out)
+    {
+        const int64_t size = 2 * radius + 1;
+        for (int64_t k = 0; k < out.size(); k++)
+            out.data()[k] = sorted[k * size + count / 2];
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    MatXd BackgroundSubtraction::normalize(const MatXd& img) const
+    {
+        double mean = img.mean();
+        return (compensateBleaching && mean > 0.0) ? MatXd(img / mean) : img;
+    }
+
+    // Normalization is deterministic, so removed values are found exactly as they were inserted
+    std::string BackgroundSubtraction::signature(void) const { return makeSignature("BackgroundSubtraction", radius, compensateBleaching); }
+
+    void BackgroundSubtraction::insert(const MatXd& img) { TemporalMedian::insert(normalize(img)); }
+    void BackgroundSubtraction::remove(const MatXd& img) { TemporalMedian::remove(normalize(img)); }
+
+    void BackgroundSubtraction::compute(const MatXd& center, MatXd& out)
+    {
+        TemporalMedian::compute(center, out);
+
+        double mean = center.mean();
+        if (compensateBleaching && mean > 0.0)
+            out *= mean;
+
+        out = center - out;
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    std::string TemporalNLMeans::signature(void) const { return makeSignature("TemporalNLMeans", radius, sigma, strength, patchRadius, searchRadius); }
+
+    // Window frames point into the ring of this instance, so copies start their own stream
+    std::unique_ptr<Filter> TemporalNLMeans::clone(void) const
+    {
+        auto copy = std::make_unique<TemporalNLMeans>(*this);
+        copy->restart();
+        copy->frames.clear();
+        copy->padded.clear();
+        return copy;
+    }
+
+    // Frames leave the window in the same order they entered it
+    void TemporalNLMeans::insert(const MatXd& img)
+    {
+        frames.push_back(&img);
+        padded.push_back(mirrorPad(img, std::max<int64_t>(patchRadius, 0) + std::max<int64_t>(searchRadius, 0)));
+    }
+
+    void TemporalNLMeans::remove(const MatXd& /*img*/)
+    {
+        frames.pop_front();
+        padded.pop_front();
+    }
+
+    void TemporalNLMeans::compute(const MatXd& center, MatXd& out)
+    {
+        std::vector<const MatXd*> vPadded;
+        size_t centerId = 0;
+
+        for (size_t k = 0; k < frames.size(); k++)
+        {
+            if (frames[k] == &center)
+                centerId = k;
+
+            vPadded.push_back(&padded[k]);
+        }
+
+        double noise = sigma < 0.0 ? estimateNoise(center) : sigma;
+        nlmApply(vPadded, centerId, noise, strength, std::max<int64_t>(patchRadius, 0), std::max<int64_t>(searchRadius, 0), out, threads());
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    void Pipeline::add(Filter* filter)
+    {
+        if (filter)
+            chain.push_back(filter);
+    }
+
+    // Whole movie contrast needs every frame before it can start
+    static Contrast* wholeMovie(Filter* filter)
+    {
+        Contrast* contrast = dynamic_cast<Contrast*>(filter);
+        return contrast && contrast->wholeMovie ? contrast : nullptr;
+    }
+
+    // Consecutive per-frame filters are fused into a single stage
+    static std::vector<std::vector<Filter*>> splitStages(const std::vector<Filter*>& chain)
+    {
+        std::vector<std::vector<Filter*>> vStages;
+        for (Filter* filter : chain)
+        {
+            bool isBarrier = dynamic_cast<Window*>(filter) != nullptr || wholeMovie(filter) != nullptr;
+
+            if (isBarrier || vStages.empty() || dynamic_cast<Window*>(vStages.back().front()))
+                vStages.emplace_back();
+
+            vStages.back().push_back(filter);
+        }
+
+        return vStages;
+    }
+
+    template <typename Mat>
+    static void runPipeline(const std::vector<Filter*>& chain, std::vector<Mat>& frames, ThreadPool& pool, bool& trigger,
+                            const std::function<void(float)>& onProgress, const std::function<void(size_t)>& onStage)
+    {
+        std::vector<std::vector<Filter*>> vStages = splitStages(chain);
+
+        int64_t
+            nFrames = int64_t(frames.size()),
+            total = nFrames * int64_t(vStages.size());
+
+        std::atomic<int64_t> counter = 0;
+        auto tick = [&](void) -> void {
+            int64_t value = ++counter;
+            if (onProgress)
+                onProgress(float(value) / float(total));
+        };
+
+        // Short movies leave threads without frames, so those split the frames instead
+        const uint32_t
+            nThreads = pool.getNumThreads(),
+            nImageThreads = uint32_t(std::max<int64_t>(int64_t(nThreads) / std::max<int64_t>(nFrames, 1), 1));
+
+        size_t numDone = 0;
+        for (const std::vector<Filter*>& stage : vStages)
+        {
+            Window* window = dynamic_cast<Window*>(stage.front());
+
+            if (window)
+            {
+                // Streaming in place, frames are emitted after the window has read them
+                window->emit = [&](int64_t frame, MatXd& img) -> void {
+                    if constexpr (std::is_same_v<Mat, MatXd>)
+                        frames[frame] = std::move(img);
+                    else
+                        frames[frame] = img.cast<typename Mat::Scalar>();
+
+                    tick();
+                };
+
+                // Streaming as a task of the pool, so the window splits its work on it
+                pool.run(1, [&](uint32_t) -> void {
+                    StageThreads budget(nThreads);
+                    for (const Mat& img : frames)
+                    {
+                        if (trigger)
+                            break;
+
+                        if constexpr (std::is_same_v<Mat, MatXd>)
+                            window->push(img);
+                        else
+                            window->push(img.template cast<double>());
+                    }
+
+                    window->flush();
+                });
+
+                window->emit = nullptr;
+            }
+            else
+            {
+                // Every thread fills its own histogram, which are merged at the end
+                if (Contrast* contrast = wholeMovie(stage.front()))
+                {
+                    Histogram hist;
+                    std::mutex mtx;
+                    std::atomic<int64_t> next = 0;
+
+                    pool.run(nThreads, [&](uint32_t) -> void {
+                        Histogram local;
+                        for (int64_t fr = next++; fr < nFrames && !trigger; fr = next++)
+                            local.add(frames[fr]);
+
+                        std::lock_guard<std::mutex> lock(mtx);
+                        hist.merge(local);
+                    });
+
+                    contrast->setLimits(hist);
+                }
+
+                // Frames are handed out dynamically, as filters might take different times per frame
+                std::atomic<int64_t> next = 0;
+                pool.run(nThreads, [&](uint32_t) -> void {
+                    StageThreads budget(nImageThreads);
+                    for (int64_t fr = next++; fr < nFrames; fr = next++)
+                    {
+                        if (trigger)
+                            return;
+
+                        for (Filter* filter : stage)
+                            filter->apply(frames[fr]);
+
+                        tick();
+                    }
+                });
+            }
+
+            // In case we want to stop this function from outside
+            if (trigger)
+                return;
+
+            numDone += stage.size();
+            if (onStage)
+                onStage(numDone);
+        }
+    }
+
+    void Pipeline::run(std::vector<MatXd>& frames, ThreadPool& pool, bool& trigger) { runPipeline(chain, frames, pool, trigger, onProgress, onStage); }
+    void Pipeline::run(std::vector<MatXf>& frames, ThreadPool& pool, bool& trigger) { runPipeline(chain, frames, pool, trigger, onProgress, onStage); }
+
+    void Pipeline::push(MatXd img, ThreadPool& pool)
+    {
+        if (vStream.empty())
+        {
+            this->pool = &pool;
+
+            for (std::vector<Filter*>& filters : splitStages(chain))
+            {
+                size_t id = vStream.size();
+                vStream.push_back({ std::move(filters), {} });
+
+                // Windows hand their frames directly to the next stage
+                if (Window* window = dynamic_cast<Window*>(vStream.back().filters.front()))
+                    window->emit = [this, id](int64_t, MatXd& out) -> void { feed(id + 1, out); };
+            }
+        }
+
+        // Running as a task of the pool, so windows split their work on it
+        pool.run(1, [&](uint32_t) -> void {
+            StageThreads budget(pool.getNumThreads());
+            feed(0, img);
+        });
+    }
+
+    void Pipeline::flush(void)
+    {
+        // Stages are drained in order, so everything reaches the end of the chain
+        if (pool)
+            pool->run(1, [&](uint32_t) -> void {
+                StageThreads budget(pool->getNumThreads());
+                for (size_t id = 0; id < vStream.size(); id++)
+                {
+                    if (Window* window = dynamic_cast<Window*>(vStream[id].filters.front()))
+                    {
+                        window->flush();
+                        window->emit = nullptr;
+                    }
+                    else if (vStream[id].pending.size() > 0)
+                        process(id);
+                }
+            });
+
+        vStream.clear();
+        numEmitted = 0;
+        pool = nullptr;
+    }
+
+    void Pipeline::feed(size_t id, MatXd& img)
+    {
+        if (id == vStream.size())
+        {
+            if (emit)
+                emit(numEmitted, img);
+
+            numEmitted++;
+            return;
+        }
+
+        Stage& stage = vStream[id];
+
+        if (Window* window = dynamic_cast<Window*>(stage.filters.front()))
+        {
+            window->push(img);
+            return;
+        }
+
+        stage.pending.push_back(std::move(img));
+
+        if (!wholeMovie(stage.filters.front()) && int64_t(stage.pending.size()) >= std::max<int64_t>(batchSize, 1))
+            process(id);
+    }
+
+    void Pipeline::process(size_t id)
+    {
+        // Downstream stages might come back to this one, so the batch is taken out first
+        std::vector<MatXd> batch = std::move(vStream[id].pending);
+        vStream[id].pending.clear();
+
+        const std::vector<Filter*>& stage = vStream[id].filters;
+        const int64_t nFrames = int64_t(batch.size());
+
+        const uint32_t nImageThreads = uint32_t(std::max<int64_t>(int64_t(pool->getNumThreads()) / std::max<int64_t>(nFrames, 1), 1));
+
+        if (Contrast* contrast = wholeMovie(stage.front()))
+        {
+            Histogram hist;
+            std::mutex mtx;
+            std::atomic<int64_t> next = 0;
+
+            pool->run(pool->getNumThreads(), [&](uint32_t) -> void {
+                Histogram local;
+                for (int64_t fr = next++; fr < nFrames; fr = next++)
+                    local.add(batch[fr]);
+
+                std::lock_guard<std::mutex> lock(mtx);
+                hist.merge(local);
+            });
+
+            contrast->setLimits(hist);
+        }
+
+        std::atomic<int64_t> next = 0;
+        pool->run(pool->getNumThreads(), [&](uint32_t) -> void {
+            StageThreads budget(nImageThreads);
+            for (int64_t fr = next++; fr < nFrames; fr = next++)
+                for (Filter* filter : stage)
+                    filter->apply(batch[fr]);
+        });
+
+        for (MatXd& img : batch)
+            feed(id + 1, img);
+    }
+
+    /**************************************************************************/
+    /**************************************************************************/
+
+    void PrefixCache::clear(void)
+    {
+        entries.clear();
+        memory = 0;
+    }
+
+    std::vector<std::string> PrefixCache::keys(const std::string& input, const std::vector<Filter*>& chain) const
+    {
+        // Key of every prefix, which stops at the first filter that cannot be cached
+        std::vector<std::string> vKeys;
+        std::string key = input;
+
+        for (Filter* filter : chain)
+        {
+            std::string sig = filter->signature();
+            if (sig.empty())
+                break;
+
+            key += "\n" + sig;
+            vKeys.push_back(key);
+        }
+
+        return vKeys;
+    }
+
+    size_t PrefixCache::cached(const std::string& input, const std::vector<Filter*>& chain) const
+    {
+        std::vector<std::string> vKeys = keys(input, chain);
+
+        for (size_t k = vKeys.size(); k > 0; k--)
+            for (const Entry& entry : entries)
+                if (entry.key == vKeys[k - 1])
+                    return k;
+
+        return 0;
+    }
+
+    void PrefixCache::run(const std::string& input, const std::vector<Filter*>& chain, std::vector<MatXf>& frames, ThreadPool& pool, bool& trigger)
+    {
+        std::vector<std::string> vKeys = keys(input, chain);
+
+        // Longest prefix we already have
+        size_t start = 0;
+        for (size_t k = vKeys.size(); k > 0 && start == 0; k--)
+            for (auto it = entries.begin(); it != entries.end(); it++)
+                if (it->key == vKeys[k - 1])
+                {
+                    entries.splice(entries.begin(), entries, it);
+                    frames = it->frames;
+                    start = k;
+                    break;
+                }
+
+        // The rest of the chain runs fused, and frames are only stored at the end of its stages
+        Pipeline pipeline;
+        for (size_t k = start; k < chain.size(); k++)
+            pipeline.add(chain[k]);
+
+        uint64_t bytes = 0;
+        for (const MatXf& img : frames)
+            bytes += uint64_t(img.size()) * sizeof(float);
+
+        pipeline.onProgress = onProgress;
+        pipeline.onStage = [&](size_t numFilters) -> void {
+            size_t k = start + numFilters - 1;
+            if (k >= vKeys.size() || bytes > budget)
+                return;
+
+            while (memory + bytes > budget)
+            {
+                memory -= entries.back().bytes;
+                entries.pop_back();
+            }
+
+            entries.push_front({ vKeys[k], frames, bytes });
+            memory += bytes;
+        };
+
+        pipeline.run(frames, pool, trigger);
+
+        if (trigger)
+            return;
+
+        if (onProgress)
+            onProgress(1.0f);
     }
 }
\ No newline at end of file
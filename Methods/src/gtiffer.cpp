@@ -255,17 +255,34 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
         return;
     }
 
-    // Let's check where the first IFD begins
-    uint32_t offset = get_uint32(4);
+    // Let's read all the directories available, starting at the first IFD
+    nextPos = 4;
+    readDirectories();
+
+} // constructor
+
+bool GPT::Tiffer::Read::readDirectories(void)
+{
+    const size_t len = buffer.size();
+    uint32_t offset = get_uint32(nextPos);
 
     // Reading all IFDs
     while (offset != 0)
     {
+        // File might still be written, so we only accept complete directories
+        if (size_t(offset) + 2 > len)
+            break;
+
         IFD ifd;
 
         // Get number of tags
         ifd.dir_count = get_uint16(offset);
 
+        // Position in which the offset for the next IFD is stored
+        uint32_t next = offset + 12 * ifd.dir_count + 2;
+        if (size_t(next) + 4 > len)
+            break;
+
         // Running tags
         for (uint32_t k = 0; k < ifd.dir_count; k++)
         {
@@ -278,7 +295,7 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
             {
                 success = false;
                 pout("ERROR (GPT::Tiffer::Read) ==> Tiff file might be corrupted:", movie_path);
-                return;
+                return false;
             }
 
             uint32_t count = get_uint32(ct + 4);
@@ -300,7 +317,7 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
                 {
                     success = false;
                     pout("ERROR (GPT::Tiffer::Read) ==> Compression format is not supported! ::", movie_path);
-                    return;
+                    return false;
                 }
 
             } // compression
@@ -309,7 +326,7 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
             {
                 success = false;
                 pout("ERROR (GPT::Tiffer::Read::load) ==> Only grayscale format is supported! ::", movie_path);
-                return;
+                return false;
             }
 
             if (tag == BITSPERSAMPLE)
@@ -330,7 +347,7 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
                 {
                     success = false;
                     pout("ERROR (GPT::Tiffer::Read::load) ==> Only 8/16/32 bits grayscale images are accepted! ::", movie_path);
-                    return;
+                    return false;
                 }
 
             } // bitsPerSample
@@ -339,9 +356,13 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
 
         } // loop tags
 
+        // Checking if image data was already written to disk
+        if (!isComplete(ifd))
+            break;
+
         // Searching more directories
-        uint32_t next = offset + 12 * ifd.dir_count + 2;
         offset = get_uint32(next);
+        nextPos = next;
 
         // Append this directory to class
         ifd.offsetNext = offset;
@@ -352,7 +373,75 @@ GPT::Tiffer::Read::Read(const fs::path &movie_path) : movie_path(movie_path)
     // to simplify verifications later
     this->numDir = uint32_t(vIFD.size());
 
-} // constructor
+    return true;
+} // readDirectories
+
+bool GPT::Tiffer::Read::isComplete(IFD &ifd)
+{
+    auto &dir = ifd.field;
+    if (dir.find(STRIPOFFSETS) == dir.end() || dir.find(STRIPBYTECOUNTS) == dir.end())
+        return false;
+
+    const IFD::Tag
+        &start = dir[STRIPOFFSETS],
+        &size = dir[STRIPBYTECOUNTS];
+
+    const size_t len = buffer.size();
+
+    if (start.count == 1)
+        return size_t(start.value) + size_t(size.value) <= len;
+
+    // Arrays with strip offsets and sizes must be within the buffer too
+    if (size_t(start.value) + 4 * size_t(start.count) > len || size_t(size.value) + 4 * size_t(size.count) > len)
+        return false;
+
+    size_t end = 0;
+    for (uint32_t k = 0; k < start.count; k++)
+    {
+        size_t a1 = start.type == LONG ? get_uint32(start.value + 4 * k) : get_uint16(start.value + 2 * k);
+        size_t a2 = size.type == LONG ? get_uint32(size.value + 4 * k) : get_uint16(size.value + 2 * k);
+        end = std::max(end, a1 + a2);
+    }
+
+    return end <= len;
+} // isComplete
+
+uint32_t GPT::Tiffer::Read::update(void)
+{
+    if (!success)
+        return 0;
+
+    std::ifstream arq(movie_path, std::ios::binary);
+    if (arq.fail())
+    {
+        pout("ERROR (GPT::Tiffer::Read::update) ==> Cannot read file:", movie_path);
+        return 0;
+    }
+
+    arq.seekg(0, std::ios::end);
+    size_t len = size_t(arq.tellg()), old = buffer.size();
+
+    if (len <= old)
+        return 0;
+
+    // Appending new bytes to buffer
+    buffer.resize(len);
+    arq.seekg(old, std::ios::beg);
+    arq.read((char *)buffer.data() + old, len - old);
+
+    // The offset for next directory was probably updated by the writer
+    arq.seekg(nextPos, std::ios::beg);
+    arq.read((char *)buffer.data() + nextPos, 4);
+    arq.close();
+
+    uint32_t before = numDir;
+    if (!readDirectories())
+        return 0;
+
+    return numDir - before;
+
+} // update
+
 
 uint32_t GPT::Tiffer::Read::getBitCount(void) { return vIFD.at(0).field[BITSPERSAMPLE].value; }
 uint32_t GPT::Tiffer::Read::getWidth(void) { return vIFD.at(0).field[IMAGEWIDTH].value; }
@@ -542,4 +631,118 @@ void GPT::Tiffer::Write::save(const fs::path& filename)
     outfile.write((const char*)vOut.data(), vOut.size());
     outfile.close();
 
-}
\ No newline at end of file
+}
+
+GPT::Tiffer::Write::Write(const fs::path& filename, std::string metadata) : metadata(metadata)
+{
+    stream.open(filename, std::ios::binary);
+    if (!stream.is_open())
+    {
+        pout("ERROR (GPT::Tiffer::Write) ==> Cannot open file for writing ::", filename);
+        return;
+    }
+
+    // Little endian tif file, the offset to the first ifd is only known after the first image
+    Buffer vOut = { 'I', 'I', 0x2A, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    stream.write((const char*)vOut.data(), vOut.size());
+
+    streamOffset = 8;
+    nextPos = 4;
+}
+
+GPT::Tiffer::Write::~Write(void) { close(); }
+
+void GPT::Tiffer::Write::close(void)
+{
+    if (stream.is_open())
+        stream.close();
+}
+
+bool GPT::Tiffer::Write::appendData(const uint8_t* data, uint64_t size, uint32_t width, uint32_t height, uint16_t bits)
+{
+    if (!stream.is_open())
+    {
+        pout("ERROR (GPT::Tiffer::Write::append) ==> File is not open for streaming!");
+        return false;
+    }
+
+    const bool hasMeta = nextPos == 4 && metadata.size() > 0;
+    const uint64_t metaSize = hasMeta ? metadata.size() + 1 : 0;
+
+    // Image data, metadata and ifd, with word alignment as required by the tiff standard
+    uint64_t
+        dataPos = streamOffset,
+        metaPos = dataPos + size + (size & 1),
+        ifdPos = metaPos + metaSize + (metaSize & 1),
+        numTags = hasMeta ? 10 : 9,
+        endPos = ifdPos + 2 + 12 * numTags + 4;
+
+    if (endPos > UINT32_MAX)
+    {
+        pout("ERROR (GPT::Tiffer::Write::append) ==> Tiff file would exceed 4 GB!");
+        return false;
+    }
+
+    Buffer vOut;
+    vOut.reserve(endPos - dataPos);
+    vOut.insert(vOut.end(), data, data + size);
+
+    if (size & 1)
+        vOut.push_back(0);
+
+    if (hasMeta)
+    {
+        vOut.insert(vOut.end(), metadata.begin(), metadata.end());
+        vOut.push_back(0); // ascii count includes null terminator
+
+        if (metaSize & 1)
+            vOut.push_back(0);
+    }
+
+    // Tags have to be sorted in ascending order
+    auto addTag = [&](uint16_t tag, uint16_t type, uint32_t count, uint32_t value) -> void {
+        writeValue(&vOut, tag);
+        writeValue(&vOut, type);
+        writeValue(&vOut, count);
+        writeValue(&vOut, value);
+    };
+
+    writeValue(&vOut, uint16_t(numTags));
+    addTag(IMAGEWIDTH, LONG, 1, width);
+    addTag(IMAGEHEIGHT, LONG, 1, height);
+    addTag(BITSPERSAMPLE, SHORT, 1, bits);
+    addTag(COMPRESSION, SHORT, 1, 1);
+    addTag(PHOTOMETRIC, SHORT, 1, 1);
+
+    if (hasMeta)
+        addTag(DESCRIPTION, ASCII, uint32_t(metaSize), uint32_t(metaPos));
+
+    addTag(STRIPOFFSETS, LONG, 1, uint32_t(dataPos));
+    addTag(SAMPLESPERPIXEL, SHORT, 1, 1);
+    addTag(ROWSPERSTRIP, LONG, 1, height);
+    addTag(STRIPBYTECOUNTS, LONG, 1, uint32_t(size));
+    writeValue(&vOut, uint32_t(0)); // last ifd until another image is appended
+
+    stream.write((const char*)vOut.data(), vOut.size());
+
+    // Linking previous ifd to this one
+    Buffer link;
+    writeValue(&link, uint32_t(ifdPos));
+    stream.seekp(nextPos);
+    stream.write((const char*)link.data(), link.size());
+    stream.seekp(endPos);
+
+    // Readers following the file only see complete directories
+    stream.flush();
+
+    nextPos = endPos - 4;
+    streamOffset = endPos;
+
+    if (!stream.good())
+    {
+        pout("ERROR (GPT::Tiffer::Write::append) ==> Failed writing to file!");
+        return false;
+    }
+
+    return true;
+}
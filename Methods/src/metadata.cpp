@@ -2,6 +2,167 @@
 
 namespace GPT
 {
+    // Minimal XML scanning utilities used to stream OME metadata
+    struct XMLElement
+    {
+        std::vector<std::pair<std::string_view, std::string_view>> attr;
+
+        std::string_view attribute(std::string_view name) const
+        {
+            for (auto &[key, value] : attr)
+                if (key == name)
+                    return value;
+
+            return {};
+        }
+    };
+
+    static bool nextElement(std::string_view xml, size_t &pos, std::string_view name, XMLElement &elem)
+    {
+        auto isSpace = [](char c) -> bool { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+
+        while (true)
+        {
+            pos = xml.find(name, pos);
+            if (pos == std::string::npos)
+                return false;
+
+            // Make sure we found the whole tag name and not a prefix or the closing tag
+            size_t loc = pos + name.size();
+            bool isTag = pos > 0 && xml[pos - 1] == '<' && loc < xml.size() && (isSpace(xml[loc]) || xml[loc] == '/' || xml[loc] == '>');
+
+            pos = loc;
+            if (isTag)
+                break;
+        }
+
+        elem.attr.clear();
+
+        // Reading attributes until the tag is closed
+        while (pos < xml.size())
+        {
+            while (pos < xml.size() && isSpace(xml[pos]))
+                pos++;
+
+            if (pos >= xml.size() || xml[pos] == '/' || xml[pos] == '>')
+                break;
+
+            size_t eq = xml.find('=', pos);
+            if (eq == std::string::npos)
+                return false;
+
+            size_t keyEnd = eq;
+            while (keyEnd > pos && isSpace(xml[keyEnd - 1]))
+                keyEnd--;
+
+            size_t quote = xml.find_first_of("\"'", eq);
+            if (quote == std::string::npos)
+                return false;
+
+            size_t close = xml.find(xml[quote], quote + 1);
+            if (close == std::string::npos)
+                return false;
+
+            elem.attr.emplace_back(xml.substr(pos, keyEnd - pos), xml.substr(quote + 1, close - quote - 1));
+            pos = close + 1;
+        }
+
+        return true;
+    } // nextElement
+
+    void appendUTF8(std::string& out, uint32_t code)
+    {
+        if (code < 0x80)
+            out += char(code);
+        else if (code < 0x800)
+        {
+            out += char(0xC0 | (code >> 6));
+            out += char(0x80 | (code & 0x3F));
+        }
+        else if (code < 0x10000)
+        {
+            out += char(0xE0 | (code >> 12));
+            out += char(0x80 | ((code >> 6) & 0x3F));
+            out += char(0x80 | (code & 0x3F));
+        }
+        else
+        {
+            out += char(0xF0 | (code >> 18));
+            out += char(0x80 | ((code >> 12) & 0x3F));
+            out += char(0x80 | ((code >> 6) & 0x3F));
+            out += char(0x80 | (code & 0x3F));
+        }
+    } // appendUTF8
+
+    static std::string decodeXML(std::string_view value)
+    {
+        std::string out;
+        out.reserve(value.size());
+
+        for (size_t k = 0; k < value.size(); k++)
+        {
+            size_t end = value[k] == '&' ? value.find(';', k) : std::string::npos;
+            if (end == std::string::npos)
+            {
+                out += value[k];
+                continue;
+            }
+
+            std::string_view ent = value.substr(k + 1, end - k - 1);
+            if (ent == "amp") out += '&';
+            else if (ent == "lt") out += '<';
+            else if (ent == "gt") out += '>';
+            else if (ent == "quot") out += '"';
+            else if (ent == "apos") out += '\'';
+            else if (ent.size() > 1 && ent[0] == '#')
+            {
+                bool hex = ent[1] == 'x' || ent[1] == 'X';
+                std::string_view digits = ent.substr(hex ? 2 : 1);
+
+                uint32_t code = 0;
+                auto [ptr, ec] = std::from_chars(digits.data(), digits.data() + digits.size(), code, hex ? 16 : 10);
+
+                // Malformed references are kept as they are
+                if (digits.empty() || ec != std::errc() || ptr != digits.data() + digits.size() || code == 0 || code > 0x10FFFF)
+                    out.append(value.substr(k, end - k + 1));
+
+                else
+                    appendUTF8(out, code);
+            }
+            else
+                out.append(value.substr(k, end - k + 1));
+
+            k = end;
+        }
+
+        return out;
+    } // decodeXML
+
+    // Numbers are always followed by the closing quote, so strtod/strtoul stop there
+    static uint64_t toUInt(std::string_view value) { return value.empty() ? 0 : std::strtoull(value.data(), nullptr, 10); }
+    static float toFloat(std::string_view value) { return value.empty() ? 0.0f : std::strtof(value.data(), nullptr); }
+
+    uint16_t Metadata::PlaneTable::intern(std::string_view unit)
+    {
+        std::string value = decodeXML(unit);
+
+        for (size_t k = 0; k < names.size(); k++)
+            if (names[k] == value)
+                return uint16_t(k);
+
+        if (names.size() > std::numeric_limits<uint16_t>::max())
+        {
+            pout("WARN (Metadata::PlaneTable::intern) => Too many different units, ignoring:", value);
+            return 0;
+        }
+
+        names.emplace_back(std::move(value));
+        return uint16_t(names.size() - 1);
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+    ///////////////////////////////////////////////////////////////////////////////
+
    Metadata::Metadata(Tiffer::Read *tif)
     {
         this->movie_name = tif->getMoviePath().filename().string();
@@ -66,8 +227,14 @@ namespace GPT
 
     bool Metadata::parseOME(const std::string &inputString)
     {
-        pugi::xml_document doc;
-        if (!doc.load_string(inputString.c_str()))
+        // OME-XML is scanned element by element instead of creating a full DOM.
+        // Planes can be tens of thousands of elements in long movies
+        const std::string_view xml(inputString);
+
+        XMLElement Pixels;
+        size_t pos = 0, end = xml.find("</Pixels>");
+
+        if (!nextElement(xml, pos, "Pixels", Pixels) || end == std::string::npos)
         {
             pout("ERROR (Metadata::parseOME) ==> Cannot parse OME metadata!! ::", movie_name);
             return false;
@@ -75,57 +242,62 @@ namespace GPT
 
         metaString = inputString; // hard copy for display in gui
 
-        pugi::xml_node ome = doc.child("OME");
-        pugi::xml_node main = ome.child("Image");
-        pugi::xml_node Pixels = main.child("Pixels");
-
         // Loading image info
-        acquisitionDate = main.child_value("AcquisitionDate");
+        size_t beg = xml.find("<AcquisitionDate>");
+        if (beg != std::string::npos)
+        {
+            beg += 17;
+            acquisitionDate = decodeXML(xml.substr(beg, xml.find('<', beg) - beg));
+        }
 
         // Loading pixel info
-        SizeC = Pixels.attribute("SizeC").as_uint();
-        SizeT = Pixels.attribute("SizeT").as_uint();
-        SizeX = Pixels.attribute("SizeX").as_uint();
-        SizeY = Pixels.attribute("SizeY").as_uint();
-        SizeZ = Pixels.attribute("SizeZ").as_uint();
-        SignificantBits = Pixels.attribute("SignificantBits").as_uint();
-
-        PhysicalSizeXY = Pixels.attribute("PhysicalSizeX").as_float();
-        PhysicalSizeZ = Pixels.attribute("PhysicalSizeZ").as_float();
-        TimeIncrement = Pixels.attribute("TimeIncrement").as_float();
-
-        DimensionOrder = Pixels.attribute("DimensionOrder").as_string();
-        PhysicalSizeXYUnit = Pixels.attribute("PhysicalSizeXUnit").as_string();
-        PhysicalSizeZUnit = Pixels.attribute("PhysicalSizeZUnit").as_string();
-        TimeIncrementUnit = Pixels.attribute("TimeIncrementUnit").as_string();
+        SizeC = toUInt(Pixels.attribute("SizeC"));
+        SizeT = toUInt(Pixels.attribute("SizeT"));
+        SizeX = toUInt(Pixels.attribute("SizeX"));
+        SizeY = toUInt(Pixels.attribute("SizeY"));
+        SizeZ = toUInt(Pixels.attribute("SizeZ"));
+        SignificantBits = toUInt(Pixels.attribute("SignificantBits"));
+
+        PhysicalSizeXY = toFloat(Pixels.attribute("PhysicalSizeX"));
+        PhysicalSizeZ = toFloat(Pixels.attribute("PhysicalSizeZ"));
+        TimeIncrement = toFloat(Pixels.attribute("TimeIncrement"));
+
+        DimensionOrder = decodeXML(Pixels.attribute("DimensionOrder"));
+        PhysicalSizeXYUnit = decodeXML(Pixels.attribute("PhysicalSizeXUnit"));
+        PhysicalSizeZUnit = decodeXML(Pixels.attribute("PhysicalSizeZUnit"));
+        TimeIncrementUnit = decodeXML(Pixels.attribute("TimeIncrementUnit"));
+
+        // Only elements inside Pixels are considered
+        const std::string_view body = xml.substr(0, end);
 
         // Loafing channels's name
-        for (auto &ch : Pixels.children("Channel"))
-            nameCH.push_back(ch.attribute("Name").as_string());
-
-        // Loading planes
-        for (auto &pl : Pixels.children("Plane"))
-        {
-            Plane pne;
-            pne.TheC = pl.attribute("TheC").as_uint();
-            pne.TheT = pl.attribute("TheT").as_uint();
-            pne.TheZ = pl.attribute("TheZ").as_uint();
-
-            pne.DeltaT = pl.attribute("DeltaT").as_float();
-            pne.ExposureTime = pl.attribute("ExposureTime").as_float();
-            pne.PositionX = pl.attribute("PositionX").as_float();
-            pne.PositionY = pl.attribute("PositionY").as_float();
-            pne.PositionZ = pl.attribute("PositionZ").as_float();
-
-            pne.DeltaTUnit = pl.attribute("DeltaTUnit").as_string();
-            pne.ExposureTimeUnit = pl.attribute("ExposureTimeUnit").as_string();
-            pne.PositionXUnit = pl.attribute("PositionXUnit").as_string();
-            pne.PositionYUnit = pl.attribute("PositionYUnit").as_string();
-            pne.PositionZUnit = pl.attribute("PositionZUnit").as_string();
-
-            vPlanes.emplace_back(pne);
+        XMLElement elem;
+        for (size_t loc = pos; nextElement(body, loc, "Channel", elem);)
+            nameCH.push_back(decodeXML(elem.attribute("Name")));
+
+        // Streaming planes into columnar storage
+        for (size_t loc = pos; nextElement(body, loc, "Plane", elem);)
+        {
+            vPlanes.TheC.push_back(toUInt(elem.attribute("TheC")));
+            vPlanes.TheT.push_back(toUInt(elem.attribute("TheT")));
+            vPlanes.TheZ.push_back(toUInt(elem.attribute("TheZ")));
+
+            vPlanes.DeltaT.push_back(toFloat(elem.attribute("DeltaT")));
+            vPlanes.ExposureTime.push_back(toFloat(elem.attribute("ExposureTime")));
+            vPlanes.PositionX.push_back(toFloat(elem.attribute("PositionX")));
+            vPlanes.PositionY.push_back(toFloat(elem.attribute("PositionY")));
+            vPlanes.PositionZ.push_back(toFloat(elem.attribute("PositionZ")));
+
+            vPlanes.units.push_back({
+                vPlanes.intern(elem.attribute("DeltaTUnit")),
+                vPlanes.intern(elem.attribute("ExposureTimeUnit")),
+                vPlanes.intern(elem.attribute("PositionXUnit")),
+                vPlanes.intern(elem.attribute("PositionYUnit")),
+                vPlanes.intern(elem.attribute("PositionZUnit"))});
         } // loop-planes
 
+        indexPlanes();
+
         return true;
     } // parseOME
 
@@ -226,21 +398,89 @@ namespace GPT
     ///////////////////////////////////////////////////////////////////////////////
     ///////////////////////////////////////////////////////////////////////////////
 
-    const Plane &Metadata::getPlane(uint64_t c, uint64_t z, uint64_t t) const
+    void Metadata::indexPlanes(void)
     {
-        for (const Plane &pl : vPlanes)
+        // Planes are stored in the same order as DimensionOrder XYCZT
+        planeIndex.assign(SizeC * SizeZ * SizeT, -1);
+
+        for (uint64_t k = 0; k < vPlanes.size(); k++)
+        {
+            uint64_t
+                c = vPlanes.TheC[k],
+                z = vPlanes.TheZ[k],
+                t = vPlanes.TheT[k];
+
+            if (c >= SizeC || z >= SizeZ || t >= SizeT)
+                continue;
+
+            planeIndex[(t * SizeZ + z) * SizeC + c] = int64_t(k);
+        }
+
+        // Gathering time points for every channel
+        vDeltaT.resize(SizeC);
+        for (uint64_t c = 0; c < SizeC; c++)
         {
-            bool check = true;
-            check &= pl.TheC == c;
-            check &= pl.TheZ == z;
-            check &= pl.TheT == t;
+            vDeltaT[c].resize(SizeT);
+            for (uint64_t t = 0; t < SizeT; t++)
+            {
+                // Frames without a plane, e.g. acquired after the metadata was written, are evenly spaced
+                int64_t id = planeIndex[t * SizeZ * SizeC + c];
+                vDeltaT[c](t) = id < 0 ? double(t) * TimeIncrement : vPlanes.DeltaT[id];
+            }
+        }
+
+    } // indexPlanes
 
-            if (check)
-                return pl;
+    void Metadata::grow(uint64_t numFrames)
+    {
+        if (numFrames <= SizeT)
+            return;
+
+        SizeT = numFrames;
+        if (hasPlanes())
+            indexPlanes();
+    } // grow
+
+    Plane Metadata::getPlane(uint64_t c, uint64_t z, uint64_t t) const
+    {
+        int64_t id = -1;
+        if (c < SizeC && z < SizeZ && t < SizeT && !planeIndex.empty())
+            id = planeIndex[(t * SizeZ + z) * SizeC + c];
+
+        Plane pne;
+        if (id < 0)
+        {
+            // Same fallback as the time points in indexPlanes
+            pout("WARN (Metadata::getPlane) => No plane was found for (c,z,t): ", c, z, t);
+
+            pne.TheC = c;
+            pne.TheZ = z;
+            pne.TheT = t;
+            pne.DeltaT = float(double(t) * TimeIncrement);
+            pne.DeltaTUnit = TimeIncrementUnit;
+            return pne;
         }
 
-        pout("WARN (Metadata::getPlane) => No plane was found for (c,z,t): ", c, z, t);
-        return vPlanes.front();
+        // Expanding columns into a plane
+        const auto &units = vPlanes.units[id];
+
+        pne.TheC = vPlanes.TheC[id];
+        pne.TheT = vPlanes.TheT[id];
+        pne.TheZ = vPlanes.TheZ[id];
+
+        pne.DeltaT = vPlanes.DeltaT[id];
+        pne.ExposureTime = vPlanes.ExposureTime[id];
+        pne.PositionX = vPlanes.PositionX[id];
+        pne.PositionY = vPlanes.PositionY[id];
+        pne.PositionZ = vPlanes.PositionZ[id];
+
+        pne.DeltaTUnit = vPlanes.names[units[0]];
+        pne.ExposureTimeUnit = vPlanes.names[units[1]];
+        pne.PositionXUnit = vPlanes.names[units[2]];
+        pne.PositionYUnit = vPlanes.names[units[3]];
+        pne.PositionZUnit = vPlanes.names[units[4]];
+
+        return pne;
 
     } // getPlane
 
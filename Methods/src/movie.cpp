@@ -28,8 +28,12 @@ namespace GPT
         // Emplacing empty matrices
         for (uint64_t k =0; k < tif->getNumDirectories(); k++)
             vImg.emplace_back(0,0);
+
+        available = std::min<uint64_t>(meta->SizeT, tif->getNumDirectories() / meta->SizeC);
     }
 
+    Movie::~Movie(void) { unfollow(); }
+
     const Metadata &Movie::getMetadata(void) const
     {
         assert(meta != nullptr);
@@ -44,25 +48,310 @@ namespace GPT
 
     const MatXd &Movie::getImage(uint64_t channel, uint64_t frame)
     {
-        assert(channel < meta->SizeC && frame < meta->SizeT);
+        uint32_t id = 0;
+        MatXd img;
+
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            assert(channel < meta->SizeC && frame < meta->SizeT);
+
+            id = static_cast<uint32_t>(frame * meta->SizeC + channel);
+
+            if (id >= vImg.size())
+            {
+                pout("ERROR (Movie::getImage) ==> Frame was not acquired yet:", frame);
+                static const MatXd empty(0, 0);
+                return empty;
+            }
+
+            if (vImg[id].size() > 0)
+                return vImg[id];
+
+            img = decode(id);
+        }
+
+        // Storing needs the exclusive lock. If another thread decoded the same frame meanwhile, we keep theirs
+        std::unique_lock<std::shared_mutex> lock(mtx);
+        if (vImg[id].size() == 0)
+            vImg[id] = std::move(img);
+
+        return vImg[id];
+    }
+
+    MatXd Movie::decode(uint32_t id)
+    {
+        // Decoding only reads the file buffer, so frames are decoded in parallel
+        if (meta->SignificantBits == 8)
+            return tif->getImage<uint8_t>(id).cast<double>();
+
+        else if (meta->SignificantBits == 16)
+            return tif->getImage<uint16_t>(id).cast<double>();
+
+        else if (meta->SignificantBits == 32)
+            return tif->getImage<uint32_t>(id).cast<double>();
+
+        return MatXd();
+    }
+
+    void Movie::release(uint64_t channel, uint64_t frame)
+    {
+        std::shared_ptr<Layer> layer = nullptr;
+
+        {
+            std::unique_lock<std::shared_mutex> lock(mtx);
+
+            uint64_t id = frame * meta->SizeC + channel;
+            if (id < vImg.size())
+                MatXd().swap(vImg[id]);
+
+            if (channel < vLayer.size())
+                layer = vLayer[channel];
+        }
+
+        if (layer)
+        {
+            std::lock_guard<std::mutex> layerLock(layer->mtx);
+            if (frame < layer->vFiltered.size())
+                MatXd().swap(layer->vFiltered[frame]);
+        }
+    }
+
+    std::pair<double, double> Movie::getChannelLimits(uint64_t channel)
+    {
+        // Frames not loaded yet are decoded into temporaries, so the whole channel is never kept in memory
+        auto frameAt = [&](uint64_t k) -> MatXd {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            uint32_t id = static_cast<uint32_t>(k * meta->SizeC + channel);
+            return vImg[id].size() > 0 ? vImg[id] : decode(id);
+        };
 
-        uint32_t id = static_cast<uint32_t>(frame * meta->SizeC + channel);
+        const uint64_t numFrames = available;
 
-        if (vImg[id].size() > 0)
-            return vImg.at(id);
-        else {
-            if (meta->SignificantBits == 8)
-                vImg[id] = tif->getImage<uint8_t>(id).cast<double>();
+        // Integer values up to 16 bits have their own bins, wider types are binned up to their largest value
+        double maxValue = 0.0;
+        if (meta->SignificantBits > 0 && meta->SignificantBits <= 16)
+            maxValue = double((uint64_t(1) << meta->SignificantBits) - 1);
+        else
+            for (uint64_t k = 0; k < numFrames; k++)
+            {
+                MatXd img = frameAt(k);
+                if (img.size() > 0)
+                    maxValue = std::max(maxValue, img.maxCoeff());
+            }
 
-            else if (meta->SignificantBits == 16)
-                vImg[id] = tif->getImage<uint16_t>(id).cast<double>();
+        maxValue = std::max(maxValue, 1.0);
+        Filter::Histogram hist(0.0, maxValue, uint32_t(std::min(maxValue + 1.0, 65536.0)));
 
-            else if (meta->SignificantBits == 32)
-                vImg[id] = tif->getImage<uint32_t>(id).cast<double>();
+        for (uint64_t k = 0; k < numFrames; k++)
+            hist.add(frameAt(k));
 
-            return vImg[id];
+        Filter::Contrast contrast;
+        return { hist.percentile(contrast.lowPercentile), hist.percentile(contrast.highPercentile) };
+    }
+
+    void Movie::setFilters(uint64_t channel, const std::vector<Filter::Filter*>& chain)
+    {
+        if (channel >= meta->SizeC)
+        {
+            pout("ERROR (Movie::setFilters) ==> Channel doesn't exist:", channel);
+            return;
         }
+
+        std::shared_ptr<Layer> layer = nullptr;
+        if (!chain.empty())
+            layer = std::make_shared<Layer>();
+
+        for (Filter::Filter* filter : chain)
+        {
+            std::unique_ptr<Filter::Filter> copy = filter->clone();
+            if (!copy)
+            {
+                pout("ERROR (Movie::setFilters) ==> Filter cannot be copied into the movie!");
+                return;
+            }
+
+            // Blocks of frames are only exact if they include every window reaching them
+            if (Filter::SVD* svd = dynamic_cast<Filter::SVD*>(copy.get()))
+                layer->reach += svd->slice - 1;
+            else if (Filter::Temporal* temp = dynamic_cast<Filter::Temporal*>(copy.get()))
+                layer->reach += temp->radius;
+            else if (Filter::Contrast* contrast = dynamic_cast<Filter::Contrast*>(copy.get()))
+                if (contrast->wholeMovie)
+                    layer->blockSize = 0;
+
+            layer->chain.emplace_back(std::move(copy));
+        }
+
+        if (layer)
+            std::tie(layer->low, layer->high) = getChannelLimits(channel);
+
+        std::shared_ptr<Layer> old = nullptr;
+        {
+            std::unique_lock<std::shared_mutex> lock(mtx);
+            vLayer.resize(meta->SizeC);
+
+            old = std::move(vLayer[channel]);
+            vLayer[channel] = std::move(layer);
+
+            // Retired layers only held here are no longer being read
+            vRetired.erase(std::remove_if(vRetired.begin(), vRetired.end(), [](const std::shared_ptr<Layer>& ptr) { return ptr.use_count() == 1; }),
+                           vRetired.end());
+
+            if (old)
+                vRetired.push_back(old);
+        }
+
+        // Frames of the old chain are dropped, as in release
+        if (old)
+        {
+            std::lock_guard<std::mutex> layerLock(old->mtx);
+            for (MatXd& img : old->vFiltered)
+                MatXd().swap(img);
+
+            old->chain.clear();
+        }
+    }
+
+    bool Movie::hasFilters(uint64_t channel)
+    {
+        std::shared_lock<std::shared_mutex> lock(mtx);
+        return channel < vLayer.size() && vLayer[channel] != nullptr;
+    }
+
+    const MatXd& Movie::getFiltered(uint64_t channel, uint64_t frame)
+    {
+        std::shared_ptr<Layer> layer = nullptr;
+        int64_t numFrames = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(mtx);
+            if (channel < vLayer.size())
+                layer = vLayer[channel];
+
+            numFrames = int64_t(meta->SizeT);
+        }
+
+        if (!layer)
+        {
+            pout("ERROR (Movie::getFiltered) ==> Channel has no filters:", channel);
+            static const MatXd empty(0, 0);
+            return empty;
+        }
+
+        if (int64_t(frame) >= numFrames)
+        {
+            pout("ERROR (Movie::getFiltered) ==> Frame was not acquired yet:", frame);
+            static const MatXd empty(0, 0);
+            return empty;
+        }
+
+        std::lock_guard<std::mutex> lock(layer->mtx);
+
+        if (int64_t(layer->vFiltered.size()) < numFrames)
+            layer->vFiltered.resize(numFrames);
+
+        if (layer->vFiltered[frame].size() > 0)
+            return layer->vFiltered[frame];
+
+        // Block containing this frame, plus its neighbours
+        int64_t
+            size = layer->blockSize > 0 ? layer->blockSize : numFrames,
+            first = (int64_t(frame) / size) * size,
+            last = std::min<int64_t>(first + size, numFrames),
+            from = std::max<int64_t>(first - layer->reach, 0),
+            to = std::min<int64_t>(last + layer->reach, numFrames);
+
+        // Filters expect values in between 0 and 1, given by the channel limits
+        const double
+            low = layer->low,
+            range = layer->high > layer->low ? layer->high - layer->low : 1.0;
+
+        std::vector<MatXd> vec;
+        for (int64_t k = from; k < to; k++)
+            vec.emplace_back(((getImage(channel, k).array() - low) / range).max(0.0).min(1.0));
+
+        Filter::Pipeline pipeline;
+        for (auto& filter : layer->chain)
+            pipeline.add(filter.get());
+
+        bool trigger = false;
+        pipeline.run(vec, ThreadPool::current(), trigger);
+
+        for (int64_t k = first; k < last; k++)
+            layer->vFiltered[k] = (range * vec[k - from]).array() + low;
+
+        return layer->vFiltered[frame];
+    }
+
+    const MatXd& Movie::getView(uint64_t channel, uint64_t frame)
+    {
+        return hasFilters(channel) ? getFiltered(channel, frame) : getImage(channel, frame);
+    }
+
+    uint64_t Movie::update(void)
+    {
+        if (!success)
+            return 0;
+
+        uint64_t before = 0, after = 0;
+
+        {
+            // Metadata grows with the file, so SizeT is only read and written under this lock
+            std::unique_lock<std::shared_mutex> lock(mtx);
+            before = available;
+
+            if (tif->update() == 0)
+                return 0;
+
+            for (uint64_t k = vImg.size(); k < tif->getNumDirectories(); k++)
+                vImg.emplace_back(0, 0);
+
+            // If metadata doesn't know the final size, the movie grows with the file
+            after = tif->getNumDirectories() / meta->SizeC;
+            meta->grow(after);
+
+            after = std::min<uint64_t>(after, meta->SizeT);
+            available = after;
+        }
+
+        if (onFrame)
+            for (uint64_t fr = before; fr < after; fr++)
+                onFrame(fr);
+
+        return after - before;
+    }
+
+    void Movie::follow(std::function<void(uint64_t frame)> callback, uint32_t interval)
+    {
+        unfollow(); // Only one follower at a time
+
+        onFrame = std::move(callback);
+        following = true;
+
+        follower = std::thread([this, interval](void) -> void {
+            std::unique_lock<std::mutex> lock(followMtx);
+            while (following)
+            {
+                lock.unlock();
+                update();
+                lock.lock();
+
+                followCV.wait_for(lock, std::chrono::milliseconds(interval), [this](void) { return !following; });
+            }
+        });
+    }
+
+    void Movie::unfollow(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(followMtx);
+            following = false;
+        }
+
+        followCV.notify_all();
+
+        if (follower.joinable())
+            follower.join();
     }
 
 
-}
\ No newline at end of file
+}
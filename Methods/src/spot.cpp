@@ -23,7 +23,7 @@ namespace GPT
 
   /////////////////////////////
 
-  Spot::Spot(const MatXd &mat)
+  Spot::Spot(const MatXd &mat, bool sampleError)
   {
     this->NX = mat.cols();
     this->NY = mat.rows();
@@ -45,7 +45,7 @@ namespace GPT
     flag = findPositionAndSize();
 
     // To determine the error in centroid's position, we sample mX and mY
-    if (flag)
+    if (flag && sampleError)
       flag = refinePosition();
 
   } // Constructor
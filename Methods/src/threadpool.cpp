@@ -0,0 +1,123 @@
+#include "threadpool.h"
+
+namespace GPT
+{
+    static thread_local ThreadPool* currentPool = nullptr;
+
+    ThreadPool& ThreadPool::shared(void)
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    ThreadPool& ThreadPool::current(void) { return currentPool ? *currentPool : shared(); }
+
+    ThreadPool::ThreadPool(uint32_t numThreads)
+    {
+        if (numThreads == 0)
+            numThreads = std::max<uint32_t>(std::thread::hardware_concurrency(), 1);
+
+        // The calling thread is also a worker
+        vThr.resize(numThreads - 1);
+        for (std::thread& thr : vThr)
+            thr = std::thread(&ThreadPool::worker, this);
+    }
+
+    ThreadPool::~ThreadPool(void)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+        }
+
+        cv.notify_all();
+        for (std::thread& thr : vThr)
+            thr.join();
+    }
+
+    void ThreadPool::run(uint32_t numTasks, const std::function<void(uint32_t)>& func)
+    {
+        if (vThr.empty() || numTasks <= 1)
+        {
+            ThreadPool* previous = currentPool;
+            currentPool = this;
+
+            for (uint32_t k = 0; k < numTasks; k++)
+                func(k);
+
+            currentPool = previous;
+            return;
+        }
+
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->func = &func;
+        batch->numTasks = numTasks;
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            queue.push_back(batch);
+        }
+        cv.notify_all();
+
+        while (work(*batch)) {}
+
+        {
+            std::unique_lock<std::mutex> lock(batch->mtx);
+            batch->cv.wait(lock, [&] { return batch->done == batch->numTasks; });
+        }
+
+        // Workers might not have noticed this batch is over
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = std::find(queue.begin(), queue.end(), batch);
+        if (it != queue.end())
+            queue.erase(it);
+    }
+
+    bool ThreadPool::work(Batch& batch)
+    {
+        uint32_t id = batch.next++;
+        if (id >= batch.numTasks)
+            return false;
+
+        // Calling thread might be working for another pool
+        ThreadPool* previous = currentPool;
+        currentPool = this;
+
+        (*batch.func)(id);
+
+        currentPool = previous;
+
+        if (++batch.done == batch.numTasks)
+        {
+            std::lock_guard<std::mutex> lock(batch.mtx);
+            batch.cv.notify_all();
+        }
+
+        return true;
+    }
+
+    void ThreadPool::worker(void)
+    {
+        while (true)
+        {
+            std::shared_ptr<Batch> batch = nullptr;
+
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cv.wait(lock, [&] { return stop || !queue.empty(); });
+
+                if (stop)
+                    return;
+
+                batch = queue.front();
+                if (batch->next >= batch->numTasks)
+                {
+                    queue.pop_front();
+                    continue;
+                }
+            }
+
+            work(*batch);
+        }
+    }
+}
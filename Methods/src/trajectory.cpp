@@ -115,6 +115,31 @@ namespace GPT
 
     }
 
+    static void fillTime(MatXd &mat, const Metadata &meta, uint64_t ch)
+    {
+        if (!meta.hasPlanes())
+        {
+            mat.col(Track::TIME) = mat.col(Track::FRAME) * meta.TimeIncrement;
+            return;
+        }
+
+        // Gathering all the time points at once
+        const VecXd &vt = meta.getDeltaT(ch);
+        std::vector<int64_t> ids(mat.rows());
+
+        for (int64_t k = 0; k < mat.rows(); k++)
+        {
+            ids[k] = static_cast<int64_t>(mat(k, Track::FRAME));
+            if (ids[k] < 0 || ids[k] >= vt.size())
+            {
+                pout("WARN (Trajectory::fillTime) => No plane was found for (c,t): ", ch, ids[k]);
+                ids[k] = 0;
+            }
+        }
+
+        mat.col(Track::TIME) = vt(ids);
+    }
+
     ///////////////////////////////////////////////////////////////////////////////
     ///////////////////////////////////////////////////////////////////////////////
     // PUBLIC FUNCTIONS
@@ -130,11 +155,12 @@ namespace GPT
         // one track per channel
         m_vTrack.resize(SC);
      
+        // Channels with filters attached are enhanced on their filtered frames
         for (uint64_t ch = 0; ch < SC; ch++)
         {
             vImages.push_back(std::vector<MatXd>(FR));
             for (uint64_t fr = 0; fr < FR; fr++)
-                vImages[ch][fr] = mov->getImage(ch, fr);
+                vImages[ch][fr] = mov->getView(ch, fr);
         }
     }
 
@@ -176,14 +202,11 @@ namespace GPT
                 mat(counter, Track::POSX) = txy[1];
                 mat(counter, Track::POSY) = txy[2];
 
-                if (meta.hasPlanes())
-                    mat(counter, Track::TIME) = meta.getPlane(ch, 0, int(txy[0])).DeltaT;
-                else
-                    mat(counter, Track::TIME) = txy[0] * meta.TimeIncrement;
-
                 counter++;
             }
 
+            fillTime(mat, meta, ch);
+
             m_vTrack[ch].traj.push_back(mat);
         } // loop-tracks
 
@@ -222,19 +245,11 @@ namespace GPT
                 MatXd loc(N, uint64_t(Track::NCOLS));
                 loc.fill(0.0);
 
-                for (uint64_t r = 0; r < N; r++)
-                {
-                    uint64_t fr = static_cast<uint64_t>(particles(row + r, 1));
-
-                    loc(r, Track::FRAME) = particles(row + r, 1);
-                    loc(r, Track::POSX) = particles(row + r, 2);
-                    loc(r, Track::POSY) = particles(row + r, 3);
+                loc.col(Track::FRAME) = particles.block(row, 1, N, 1);
+                loc.col(Track::POSX) = particles.block(row, 2, N, 1);
+                loc.col(Track::POSY) = particles.block(row, 3, N, 1);
 
-                    if (meta.hasPlanes())
-                        loc(r, Track::TIME) = meta.getPlane(ch, 0, fr).DeltaT;
-                    else
-                        loc(r, Track::TIME) = fr * meta.TimeIncrement;
-                }
+                fillTime(loc, meta, ch);
 
                 track.traj.emplace_back(loc);
 
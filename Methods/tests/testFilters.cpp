@@ -1,6 +1,70 @@
 #include <gtest/gtest.h>
 #include "GPMethods.h"
 
+static MatXd randomImage(int64_t rows, int64_t cols, double scale)
+{
+    std::random_device dev;
+    std::default_random_engine ran(dev());
+    std::uniform_real_distribution<double> unif(0.0, scale);
+
+    MatXd mat(rows, cols);
+    for (int64_t k = 0; k < mat.size(); k++)
+        mat.data()[k] = unif(ran);
+
+    return mat;
+}
+
+static MatXd bruteMedian(const MatXd& mat, int64_t sizeX, int64_t sizeY)
+{
+    MatXd img(mat.rows(), mat.cols());
+    int64_t rx = sizeX / 2, ry = sizeY / 2;
+
+    for (int64_t k = 0; k < mat.rows(); k++)
+        for (int64_t l = 0; l < mat.cols(); l++)
+        {
+            std::vector<double> vec;
+            for (int64_t y = std::max<int64_t>(k - ry, 0); y < std::min<int64_t>(k + ry + 1, mat.rows()); y++)
+                for (int64_t x = std::max<int64_t>(l - rx, 0); x < std::min<int64_t>(l + rx + 1, mat.cols()); x++)
+                    vec.push_back(mat(y, x));
+
+            std::sort(vec.begin(), vec.end());
+            img(k, l) = vec[vec.size() / 2];
+        }
+
+    return img;
+}
+
+TEST(Filters, median)
+{
+    // Sorting networks are exact for any data
+    for (int64_t size : {3, 5})
+    {
+        MatXd mat = randomImage(37, 23, 1.0);
+        MatXd ref = bruteMedian(mat, size, size);
+
+        GPT::Filter::Median median(size, size);
+        median.numThreads = 3;
+        median.apply(mat);
+
+        ASSERT_DOUBLE_EQ(0.0, (mat - ref).cwiseAbs().maxCoeff()) << "Tile size: " << size;
+    }
+
+    // Running histogram is exact for integer data and within quantization otherwise
+    MatXd mat = randomImage(41, 29, 4000.0).array().round();
+    MatXd ref = bruteMedian(mat, 9, 7);
+
+    GPT::Filter::Median median(9, 7);
+    median.numThreads = 2;
+    median.apply(mat);
+    ASSERT_DOUBLE_EQ(0.0, (mat - ref).cwiseAbs().maxCoeff());
+
+    mat = randomImage(41, 29, 1.0);
+    ref = bruteMedian(mat, 11, 11);
+    median = GPT::Filter::Median(11, 11);
+    median.apply(mat);
+    ASSERT_GT(1.0 / 65535.0, (mat - ref).cwiseAbs().maxCoeff());
+}
+
 
 TEST(Filters, autocontrast)
 {
@@ -9,15 +73,757 @@ TEST(Filters, autocontrast)
 
 TEST(Filters, contrast)
 {
+    // Integer values have their own bins
+    GPT::Filter::Histogram hist(0.0, 999.0, 1000);
+
+    MatXd mat(10, 100);
+    for (int64_t k = 0; k < mat.size(); k++)
+        mat.data()[k] = double(k);
+
+    hist.add(mat);
+    ASSERT_EQ(1000, hist.getCount());
+    ASSERT_DOUBLE_EQ(0.0, hist.percentile(0.0));
+    ASSERT_DOUBLE_EQ(499.0, hist.percentile(0.5));
+    ASSERT_DOUBLE_EQ(989.0, hist.percentile(0.99));
+    ASSERT_DOUBLE_EQ(999.0, hist.percentile(1.0));
+
+    // Whole movie contrast uses the same limits for every frame
+    std::vector<MatXf> vec(8);
+    for (size_t k = 0; k < vec.size(); k++)
+        vec[k] = (0.05 * double(k) + 0.5 * randomImage(20, 20, 1.0).array()).cast<float>();
+
+    GPT::Filter::Contrast contrast;
+    contrast.wholeMovie = true;
+    contrast.lowPercentile = 0.0;
+    contrast.highPercentile = 1.0;
 
+    std::vector<MatXf> ref(vec);
+    std::string signature = contrast.signature();
+
+    GPT::Filter::Pipeline pipeline;
+    pipeline.add(&contrast);
+
+    bool trigger = false;
+    GPT::ThreadPool pool(3);
+    pipeline.run(vec, pool, trigger);
+
+    // Limits found for the movie don't replace the ones given by the user
+    ASSERT_DOUBLE_EQ(-1.0, contrast.low);
+    ASSERT_DOUBLE_EQ(-1.0, contrast.high);
+    ASSERT_EQ(signature, contrast.signature());
+
+    float
+        bot = std::min_element(ref.begin(), ref.end(), [](const MatXf& a, const MatXf& b) { return a.minCoeff() < b.minCoeff(); })->minCoeff(),
+        top = std::max_element(ref.begin(), ref.end(), [](const MatXf& a, const MatXf& b) { return a.maxCoeff() < b.maxCoeff(); })->maxCoeff();
+
+    for (size_t k = 0; k < vec.size(); k++)
+    {
+        MatXf expected = ((ref[k].array() - bot) / (top - bot)).max(0.0f).min(1.0f);
+        ASSERT_GT(1e-4, (vec[k] - expected).cwiseAbs().maxCoeff()) << "Frame: " << k;
+    }
+
+    // Back to per-frame auto-contrast once whole movie is unchecked
+    contrast.wholeMovie = false;
+
+    MatXf img = ref.back();
+    contrast.apply(img);
+    ASSERT_NEAR(0.0f, img.minCoeff(), 1e-5);
+    ASSERT_NEAR(1.0f, img.maxCoeff(), 1e-5);
 }
 
 TEST(Filters, CLAHE)
 {
+    MatXd mat = randomImage(150, 97, 1.0);
+
+    MatXd single(mat);
+    GPT::Filter::CLAHE clahe(2.0, 32, 32);
+    clahe.apply(single);
+
+    ASSERT_LE(0.0, single.minCoeff());
+    ASSERT_GE(1.0, single.maxCoeff());
+
+    // Rows are split among threads, results must not depend on it
+    MatXd multi(mat);
+    clahe.numThreads = 4;
+    clahe.apply(multi);
+    ASSERT_DOUBLE_EQ(0.0, (single - multi).cwiseAbs().maxCoeff());
+
+    // Within a single tile the mapping is a monotonic cumulative histogram
+    mat = randomImage(20, 20, 1.0);
+    MatXd img(mat);
+    GPT::Filter::CLAHE(1000.0, 64, 64).apply(img);
+
+    for (int64_t k = 0; k < mat.size(); k++)
+        for (int64_t l = 0; l < mat.size(); l++)
+            if (mat.data()[k] < mat.data()[l])
+                ASSERT_LE(img.data()[k], img.data()[l]);
+}
+
+TEST(Filters, gaussian)
+{
+    // Impulse response should be close to a sampled Gaussian
+    for (double sigma : {1.0, 2.0, 6.0})
+    {
+        MatXf img = MatXf::Zero(81, 81);
+        img(40, 40) = 1.0f;
+
+        GPT::Filter::Gaussian gauss(sigma, sigma);
+        gauss.numThreads = 2;
+        gauss.apply(img);
+
+        double norm = 1.0 / (2.0 * M_PI * sigma * sigma);
+        MatXd ref(81, 81);
+        for (int64_t k = 0; k < 81; k++)
+            for (int64_t l = 0; l < 81; l++)
+                ref(k, l) = norm * std::exp(-0.5 * (std::pow(k - 40.0, 2.0) + std::pow(l - 40.0, 2.0)) / (sigma * sigma));
+
+        ASSERT_NEAR(1.0, img.sum(), 1e-3) << "Sigma: " << sigma;
+        ASSERT_GT(2e-3 * ref.maxCoeff(), (ref - img.cast<double>()).cwiseAbs().maxCoeff()) << "Sigma: " << sigma;
+    }
+
+    // Constant images are not changed, including borders, and orientations agree
+    MatXd flat = MatXd::Constant(30, 20, 0.4);
+    GPT::Filter::Gaussian(3.0, 1.5).apply(flat);
+    ASSERT_GT(1e-9, (flat.array() - 0.4).abs().maxCoeff());
+
+    MatXd mat = randomImage(30, 20, 1.0);
+    MatXf fmat = mat.cast<float>();
+
+    GPT::Filter::Gaussian gauss(3.0, 1.5);
+    gauss.apply(mat);
+    gauss.apply(fmat);
+    ASSERT_GT(1e-5, (mat - fmat.cast<double>()).cwiseAbs().maxCoeff());
+
+    // Difference of Gaussians is the difference of two filters
+    MatXd dog = randomImage(30, 20, 1.0), low(dog), high(dog);
+    GPT::Filter::DoG(1.0, 4.0).apply(dog);
+    GPT::Filter::Gaussian(1.0, 1.0).apply(low);
+    GPT::Filter::Gaussian(4.0, 4.0).apply(high);
+    ASSERT_GT(1e-12, (dog - (low - high)).cwiseAbs().maxCoeff());
+}
+
+TEST(Filters, topHat)
+{
+    MatXd mat = randomImage(37, 29, 1.0);
+
+    // Brute force opening with a rectangle, windows shrink at the borders
+    auto extreme = [](const MatXd& img, int64_t rx, int64_t ry, bool isMin) -> MatXd {
+        MatXd out(img.rows(), img.cols());
+        for (int64_t k = 0; k < img.rows(); k++)
+            for (int64_t l = 0; l < img.cols(); l++)
+            {
+                int64_t
+                    y0 = std::max<int64_t>(k - ry, 0), y1 = std::min<int64_t>(k + ry, img.rows() - 1),
+                    x0 = std::max<int64_t>(l - rx, 0), x1 = std::min<int64_t>(l + rx, img.cols() - 1);
+
+                auto block = img.block(y0, x0, y1 - y0 + 1, x1 - x0 + 1);
+                out(k, l) = isMin ? block.minCoeff() : block.maxCoeff();
+            }
+        return out;
+    };
+
+    MatXd ref = mat - extreme(extreme(mat, 4, 2, true), 4, 2, false);
+
+    GPT::Filter::TopHat topHat(4, 2);
+    topHat.numThreads = 3;
+
+    MatXf fmat = mat.cast<float>();
+    topHat.apply(mat);
+    topHat.apply(fmat);
+
+    ASSERT_DOUBLE_EQ(0.0, (mat - ref).cwiseAbs().maxCoeff());
+    ASSERT_GT(1e-6, (fmat.cast<double>() - ref).cwiseAbs().maxCoeff());
+}
+
+TEST(Filters, blocks)
+{
+    MatXd mat = randomImage(61, 47, 1.0);
+
+    GPT::Filter::Contrast contrast;
+    GPT::Filter::Median median(9, 7);
+    GPT::Filter::CLAHE clahe(2.0, 16, 16);
+    GPT::Filter::Gaussian gaussian(2.0, 1.5);
+
+    // Splitting a single frame in blocks of lines on a pool gives the same image
+    GPT::ThreadPool pool(3);
+
+    for (GPT::Filter::Filter* filter : std::vector<GPT::Filter::Filter*>{ &contrast, &median, &clahe, &gaussian })
+    {
+        MatXd ref(mat), img(mat);
+        MatXf fref = mat.cast<float>(), fimg = fref;
+
+        filter->numThreads = 1;
+        filter->apply(ref);
+        filter->apply(fref);
+
+        filter->numThreads = 5;
+        pool.run(1, [&](uint32_t) -> void {
+            filter->apply(img);
+            filter->apply(fimg);
+        });
+
+        ASSERT_DOUBLE_EQ(0.0, (img - ref).cwiseAbs().maxCoeff());
+        ASSERT_FLOAT_EQ(0.0f, (fimg - fref).cwiseAbs().maxCoeff());
+    }
+}
+
+TEST(Filters, NLMeans)
+{
+    std::vector<MatXd> vec(4);
+    for (MatXd& mat : vec)
+        mat = randomImage(17, 13, 1.0);
+
+    const int64_t patch = 1, search = 2;
+    const double sigma = 0.2, strength = 0.8;
+
+    // Brute force version comparing every patch, borders are mirrored
+    auto pixel = [](const MatXd& mat, int64_t r, int64_t c) -> double {
+        r = r < 0 ? -r : (r >= mat.rows() ? 2 * (mat.rows() - 1) - r : r);
+        c = c < 0 ? -c : (c >= mat.cols() ? 2 * (mat.cols() - 1) - c : c);
+        return mat(r, c);
+    };
+
+    auto bruteForce = [&](size_t center, size_t first, size_t last) -> MatXd {
+        const MatXd& ref = vec[center];
+        MatXd out(ref.rows(), ref.cols());
+
+        for (int64_t c = 0; c < ref.cols(); c++)
+            for (int64_t r = 0; r < ref.rows(); r++)
+            {
+                double num = 0.0, den = 0.0, best = 0.0;
+                for (size_t fr = first; fr < last; fr++)
+                    for (int64_t dc = -search; dc <= search; dc++)
+                        for (int64_t dr = -search; dr <= search; dr++)
+                        {
+                            if (fr == center && dr == 0 && dc == 0)
+                                continue;
+
+                            double dist = 0.0;
+                            for (int64_t pc = -patch; pc <= patch; pc++)
+                                for (int64_t pr = -patch; pr <= patch; pr++)
+                                {
+                                    double diff = pixel(ref, r + pr, c + pc) - pixel(vec[fr], r + dr + pr, c + dc + pc);
+                                    dist += diff * diff;
+                                }
+
+                            dist /= double((2 * patch + 1) * (2 * patch + 1));
+                            double wgt = std::exp(-std::max(dist - 2.0 * sigma * sigma, 0.0) / (strength * strength * sigma * sigma));
+
+                            num += wgt * pixel(vec[fr], r + dr, c + dc);
+                            den += wgt;
+                            best = std::max(best, wgt);
+                        }
+
+                out(r, c) = (num + best * ref(r, c)) / (den + best);
+            }
+
+        return out;
+    };
+
+    GPT::Filter::NLMeans nlm(sigma, patch, search);
+    nlm.strength = strength;
+
+    MatXd img = vec[0];
+    nlm.apply(img);
+    ASSERT_GT(1e-10, (img - bruteForce(0, 0, 1)).cwiseAbs().maxCoeff());
+
+    // Splitting the frame in blocks of columns only changes the rounding of the integral images
+    GPT::ThreadPool pool(3);
+    MatXd blocks = vec[0];
+    nlm.numThreads = 4;
+    pool.run(1, [&](uint32_t) -> void { nlm.apply(blocks); });
+    ASSERT_GT(1e-12, (img - blocks).cwiseAbs().maxCoeff());
+
+    // Searching in the neighbouring frames
+    GPT::Filter::TemporalNLMeans temporal(1);
+    temporal.sigma = sigma;
+    temporal.strength = strength;
+    temporal.patchRadius = patch;
+    temporal.searchRadius = search;
+
+    std::vector<MatXd> out(vec.size());
+    temporal.emit = [&](int64_t frame, MatXd& mat) -> void { out[frame] = mat; };
+
+    for (size_t k = 0; k < 2; k++)
+        temporal.push(vec[k]);
+
+    // Copies made in the middle of a stream start their own
+    std::vector<MatXd> copied(vec.size());
+    std::unique_ptr<GPT::Filter::Filter> copy = temporal.clone();
+    GPT::Filter::TemporalNLMeans* other = dynamic_cast<GPT::Filter::TemporalNLMeans*>(copy.get());
+    other->emit = [&](int64_t frame, MatXd& mat) -> void { copied[frame] = mat; };
+
+    for (size_t k = 2; k < vec.size(); k++)
+        temporal.push(vec[k]);
+    temporal.flush();
+
+    for (const MatXd& mat : vec)
+        other->push(mat);
+    other->flush();
+
+    for (size_t fr = 0; fr < vec.size(); fr++)
+    {
+        MatXd ref = bruteForce(fr, fr > 0 ? fr - 1 : 0, std::min(fr + 2, vec.size()));
+        ASSERT_GT(1e-10, (out[fr] - ref).cwiseAbs().maxCoeff()) << "Frame: " << fr;
+        ASSERT_GT(1e-10, (copied[fr] - ref).cwiseAbs().maxCoeff()) << "Frame: " << fr;
+    }
+
+    // Noise is estimated from the image when sigma is negative
+    MatXd smooth(64, 64);
+    for (int64_t c = 0; c < 64; c++)
+        for (int64_t r = 0; r < 64; r++)
+            smooth(r, c) = 0.5 + 0.3 * std::sin(0.1 * r) * std::cos(0.15 * c);
+
+    MatXd noisy = smooth + randomImage(64, 64, 0.2) - MatXd::Constant(64, 64, 0.1);
+    img = noisy;
+
+    GPT::Filter::NLMeans automatic;
+    automatic.apply(img);
+    ASSERT_LT((img - smooth).norm(), 0.5 * (noisy - smooth).norm());
+}
+
+TEST(Filters, temporal)
+{
+    // Movie with some photobleaching
+    std::vector<MatXd> vec(11);
+    for (size_t k = 0; k < vec.size(); k++)
+        vec[k] = std::exp(-0.05 * k) * randomImage(13, 9, 1.0);
 
+    const int64_t radius = 2;
+    auto window = [&](int64_t fr) -> std::pair<int64_t, int64_t> {
+        return { std::max<int64_t>(fr - radius, 0), std::min<int64_t>(fr + radius + 1, vec.size()) };
+    };
+
+    // Brute force versions of each filter
+    std::vector<MatXd> mean(vec.size()), median(vec.size()), background(vec.size());
+    for (int64_t fr = 0; fr < int64_t(vec.size()); fr++)
+    {
+        auto [first, last] = window(fr);
+        mean[fr] = MatXd::Zero(13, 9);
+        median[fr] = background[fr] = MatXd(13, 9);
+
+        for (int64_t k = 0; k < mean[fr].size(); k++)
+        {
+            std::vector<double> values, scaled;
+            for (int64_t l = first; l < last; l++)
+            {
+                values.push_back(vec[l].data()[k]);
+                scaled.push_back(vec[l].data()[k] / vec[l].mean());
+            }
+
+            std::sort(values.begin(), values.end());
+            std::sort(scaled.begin(), scaled.end());
+
+            mean[fr].data()[k] = std::accumulate(values.begin(), values.end(), 0.0) / double(values.size());
+            median[fr].data()[k] = values[values.size() / 2];
+            background[fr].data()[k] = vec[fr].data()[k] - vec[fr].mean() * scaled[scaled.size() / 2];
+        }
+    }
+
+    GPT::Filter::RunningMean runMean(radius);
+    GPT::Filter::TemporalMedian runMedian(radius);
+    GPT::Filter::BackgroundSubtraction runBackground(radius);
+    runMedian.numThreads = 2;
+
+    std::vector<std::pair<GPT::Filter::Temporal*, const std::vector<MatXd>*>> tests = {
+        { &runMean, &mean }, { &runMedian, &median }, { &runBackground, &background } };
+
+    for (auto [filter, ref] : tests)
+    {
+        int64_t numPushed = 0, numEmitted = 0;
+        filter->emit = [&](int64_t frame, MatXd& img) -> void {
+            ASSERT_EQ(numEmitted++, frame);
+            if (numPushed < int64_t(vec.size()))
+                ASSERT_EQ(frame + radius + 1, numPushed);
+
+            ASSERT_GT(1e-12, (img - ref->at(frame)).cwiseAbs().maxCoeff()) << "Frame: " << frame;
+        };
+
+        // Running twice to make sure the stream restarts properly
+        for (int32_t rep = 0; rep < 2; rep++)
+        {
+            numPushed = numEmitted = 0;
+            for (const MatXd& img : vec)
+            {
+                numPushed++;
+                filter->push(img);
+            }
+
+            filter->flush();
+            ASSERT_EQ(numEmitted, int64_t(vec.size()));
+        }
+    }
 }
 
 TEST(Filters, SVD)
 {
+    // Low rank movie with some noise on top
+    MatXd base = randomImage(24, 18, 1.0), pattern = randomImage(24, 18, 1.0);
+
+    std::vector<MatXd> vec(15);
+    for (size_t k = 0; k < vec.size(); k++)
+        vec[k] = base + std::sin(0.4 * k) * pattern + randomImage(24, 18, 0.05);
+
+    for (int64_t slice : {1, 4, 7})
+        for (int64_t rank : {1, 2})
+        {
+            GPT::Filter::SVD exact;
+            exact.slice = slice;
+            exact.rank = rank;
+            exact.truncated = false;
+
+            GPT::Filter::SVD snapshot(exact);
+            snapshot.truncated = true;
+
+            bool trigger = false;
+            exact.importImages(vec);
+            exact.run(trigger);
+
+            snapshot.importImages(vec);
+            snapshot.run(trigger);
+
+            for (int64_t fr = 0; fr < int64_t(vec.size()); fr++)
+                ASSERT_GT(1e-8, (exact.getImage(fr) - snapshot.getImage(fr)).cwiseAbs().maxCoeff())
+                    << "Slice: " << slice << ", rank: " << rank << ", frame: " << fr;
+        }
+
+    // Threads either split the movie in blocks or split each frame
+    for (uint32_t nThreads : {2, 5})
+    {
+        GPT::Filter::SVD parallel;
+        parallel.slice = 4;
+        parallel.rank = 2;
+        parallel.numThreads = nThreads;
+
+        GPT::Filter::SVD serial(parallel);
+        serial.numThreads = 1;
+
+        bool trigger = false;
+        parallel.importImages(vec);
+        parallel.run(trigger);
+
+        serial.importImages(vec);
+        serial.run(trigger);
+
+        for (int64_t fr = 0; fr < int64_t(vec.size()); fr++)
+            ASSERT_GT(1e-12, (parallel.getImage(fr) - serial.getImage(fr)).cwiseAbs().maxCoeff()) << "Threads: " << nThreads;
+    }
+
+    // Streaming emits every frame once, in order, as soon as its last window is complete
+    GPT::Filter::SVD batch;
+    batch.slice = 5;
+    batch.rank = 2;
+
+    bool trigger = false;
+    batch.importImages(vec);
+    batch.run(trigger);
 
+    GPT::Filter::SVD stream(batch);
+    stream.numThreads = 3;
+    int64_t numPushed = 0, numEmitted = 0;
+    stream.emit = [&](int64_t frame, MatXd& img) -> void {
+        ASSERT_EQ(numEmitted++, frame);
+        if (numPushed < int64_t(vec.size()))
+            ASSERT_EQ(frame + stream.slice, numPushed);
+
+        ASSERT_GT(1e-12, (img - batch.getImage(frame)).cwiseAbs().maxCoeff());
+    };
+
+    for (const MatXd& img : vec)
+    {
+        numPushed++;
+        stream.push(img);
+    }
+
+    stream.flush();
+    ASSERT_EQ(numEmitted, int64_t(vec.size()));
+
+    // Movies shorter than a slice are treated as a single window
+    GPT::Filter::SVD shortMovie;
+    shortMovie.slice = 20;
+    shortMovie.importImages(vec);
+    shortMovie.run(trigger);
+    ASSERT_TRUE(shortMovie.getImage(3).allFinite());
 }
+
+TEST(Filters, pipeline)
+{
+    std::vector<MatXd> vec(12);
+    for (MatXd& mat : vec)
+        mat = randomImage(40, 33, 2.0);
+
+    const std::vector<MatXd> input(vec);
+
+    GPT::Filter::Median median(3, 3);
+    GPT::Filter::Contrast contrast;
+    GPT::Filter::CLAHE clahe(2.0, 16, 16);
+    GPT::Filter::SVD svd;
+    svd.slice = 3;
+
+    // Applying filters one after the other on every frame
+    std::vector<MatXd> ref(vec);
+    for (MatXd& mat : ref)
+    {
+        median.apply(mat);
+        contrast.apply(mat);
+    }
+
+    bool trigger = false;
+    svd.importImages(ref);
+    svd.run(trigger);
+    svd.updateImages(ref);
+
+    for (MatXd& mat : ref)
+        clahe.apply(mat);
+
+    // Same chain with fused stages on a pool
+    GPT::Filter::Pipeline pipeline;
+    pipeline.add(&median);
+    pipeline.add(&contrast);
+    pipeline.add(&svd);
+    pipeline.add(&clahe);
+
+    float progress = 0.0f;
+    std::mutex mtx;
+    pipeline.onProgress = [&](float value) -> void {
+        std::lock_guard<std::mutex> lock(mtx);
+        progress = std::max(progress, value);
+    };
+
+    GPT::ThreadPool pool(3);
+    pipeline.run(vec, pool, trigger);
+
+    ASSERT_FLOAT_EQ(1.0f, progress);
+    for (size_t k = 0; k < vec.size(); k++)
+        ASSERT_GT(1e-10, (vec[k] - ref[k]).cwiseAbs().maxCoeff()) << "Frame: " << k;
+
+    // Streaming the same chain in small batches
+    std::vector<MatXd> stream;
+    pipeline.batchSize = 5;
+    pipeline.emit = [&](int64_t frame, MatXd& img) -> void {
+        ASSERT_EQ(int64_t(stream.size()), frame);
+        stream.push_back(img);
+    };
+
+    for (const MatXd& mat : input)
+        pipeline.push(mat, pool);
+
+    pipeline.flush();
+
+    ASSERT_EQ(ref.size(), stream.size());
+    for (size_t k = 0; k < stream.size(); k++)
+        ASSERT_GT(1e-10, (stream[k] - ref[k]).cwiseAbs().maxCoeff()) << "Frame: " << k;
+
+    // Filters without state are shared by pipelines running at the same time, and keep their own budget
+    std::vector<MatXd> first(input), second(input), single(input);
+    for (MatXd& mat : single)
+        median.apply(mat);
+
+    GPT::Filter::Pipeline other;
+    other.add(&median);
+
+    GPT::ThreadPool pool2(2);
+    std::thread thr([&](void) -> void { other.run(second, pool2, trigger); });
+
+    GPT::Filter::Pipeline one;
+    one.add(&median);
+    one.run(first, pool, trigger);
+    thr.join();
+
+    ASSERT_EQ(1, median.numThreads);
+    for (size_t k = 0; k < single.size(); k++)
+    {
+        ASSERT_DOUBLE_EQ(0.0, (first[k] - single[k]).cwiseAbs().maxCoeff()) << "Frame: " << k;
+        ASSERT_DOUBLE_EQ(0.0, (second[k] - single[k]).cwiseAbs().maxCoeff()) << "Frame: " << k;
+    }
+}
+
+TEST(Filters, prefixCache)
+{
+    // Counts how many frames went through it
+    struct Counter : public GPT::Filter::Filter
+    {
+        int64_t calls = 0;
+        void apply(MatXd& img) override { calls++; }
+        std::string signature(void) const override { return "Counter"; }
+    };
+
+    std::vector<MatXf> input(6);
+    for (MatXf& mat : input)
+        mat = randomImage(30, 20, 1.0).cast<float>();
+
+    Counter counter;
+    GPT::Filter::Median median(3, 3);
+    GPT::Filter::RunningMean mean(1);
+
+    // Counter and median are fused into one stage, the running mean is another
+    std::vector<GPT::Filter::Filter*> chain = { &counter, &median, &mean };
+
+    GPT::ThreadPool pool(2);
+    GPT::Filter::PrefixCache cache;
+
+    bool trigger = false;
+    std::vector<MatXf> vec(input);
+    ASSERT_EQ(0, cache.cached("movie", chain));
+    cache.run("movie", chain, vec, pool, trigger);
+    ASSERT_EQ(6, counter.calls);
+    ASSERT_EQ(3, cache.cached("movie", chain));
+
+    // Only the last stage changed, so the first one is not run again
+    mean.radius = 2;
+    ASSERT_EQ(2, cache.cached("movie", chain));
+
+    vec = input;
+    cache.run("movie", chain, vec, pool, trigger);
+    ASSERT_EQ(6, counter.calls);
+
+    std::vector<MatXf> ref(input);
+    GPT::Filter::Pipeline pipeline;
+    pipeline.add(&median);
+    pipeline.add(&mean);
+    pipeline.run(ref, pool, trigger);
+
+    for (size_t k = 0; k < vec.size(); k++)
+        ASSERT_FLOAT_EQ(0.0f, (vec[k] - ref[k]).cwiseAbs().maxCoeff()) << "Frame: " << k;
+
+    // Filters within a stage are not stored apart, so changing the median runs the whole stage
+    median.sizeX = 5;
+    vec = input;
+    cache.run("movie", chain, vec, pool, trigger);
+    ASSERT_EQ(12, counter.calls);
+
+    // Another input or a budget too small for the frames runs everything
+    vec = input;
+    cache.run("other", chain, vec, pool, trigger);
+    ASSERT_EQ(18, counter.calls);
+
+    cache.clear();
+    cache.budget = 100;
+    cache.run("movie", chain, vec, pool, trigger);
+    ASSERT_EQ(24, counter.calls);
+    ASSERT_EQ(0, cache.getMemory());
+}
+
+TEST(Filters, movieLayer)
+{
+    // Small 16-bit movie written to a temporary file
+    fs::path path = fs::temp_directory_path() / "gptool_movieLayer.tif";
+
+    std::vector<MatXd> vec(75);
+    {
+        GPT::Tiffer::Write writer(path);
+        for (MatXd& mat : vec)
+        {
+            Image<uint16_t> img = (65535.0 * randomImage(24, 31, 1.0)).array().round().cast<uint16_t>();
+            mat = img.cast<double>();
+            ASSERT_TRUE(writer.append(img));
+        }
+    }
+
+    GPT::Movie movie(path);
+    ASSERT_TRUE(movie.successful());
+    ASSERT_EQ(vec.size(), movie.getMetadata().SizeT);
+
+    GPT::Filter::Median median(3, 3);
+    GPT::Filter::RunningMean mean(2);
+    GPT::Filter::SVD svd;
+    svd.slice = 3;
+
+    movie.setFilters(0, { &median, &mean, &svd });
+    ASSERT_TRUE(movie.hasFilters(0));
+
+    // Channel limits are the percentiles of every value in the movie
+    GPT::Filter::Histogram hist(0.0, 65535.0, 65536);
+    for (const MatXd& mat : vec)
+        hist.add(mat);
+
+    auto [low, high] = movie.getChannelLimits(0);
+    ASSERT_DOUBLE_EQ(hist.percentile(0.001), low);
+    ASSERT_DOUBLE_EQ(hist.percentile(0.999), high);
+
+    // Whole movie at once, in the 0 to 1 interval
+    std::vector<MatXd> ref(vec);
+    for (MatXd& mat : ref)
+        mat = ((mat.array() - low) / (high - low)).max(0.0).min(1.0);
+
+    GPT::Filter::Pipeline pipeline;
+    pipeline.add(&median);
+    pipeline.add(&mean);
+    pipeline.add(&svd);
+
+    bool trigger = false;
+    GPT::ThreadPool pool(2);
+    pipeline.run(ref, pool, trigger);
+
+    // Frames are filtered by blocks, out of order
+    for (size_t k : { 40, 0, 74, 31, 32, 63, 64, 1 })
+    {
+        MatXd expected = (high - low) * ref[k].array() + low;
+        ASSERT_GT(1e-8, (movie.getView(0, k) - expected).cwiseAbs().maxCoeff()) << "Frame: " << k;
+    }
+
+    // Frames are released and filtered again while other threads read them
+    pool.run(2, [&](uint32_t tid) -> void {
+        for (uint64_t k = 0; k < 40; k++)
+            if (tid == 0)
+                movie.release(0, (7 * k) % vec.size());
+            else
+                movie.getView(0, (11 * k) % vec.size());
+    });
+
+    ASSERT_EQ(0, movie.getFiltered(0, vec.size()).size());
+
+    // References to frames of a replaced chain stay valid, but empty
+    const MatXd& old = movie.getView(0, 10);
+    ASSERT_GT(old.size(), 0);
+
+    movie.setFilters(0, {});
+    ASSERT_FALSE(movie.hasFilters(0));
+    ASSERT_EQ(0, old.size());
+    ASSERT_DOUBLE_EQ(0.0, (movie.getView(0, 5) - vec[5]).cwiseAbs().maxCoeff());
+
+    fs::remove(path);
+}
+
+TEST(Filters, precision)
+{
+    MatXd mat = randomImage(45, 31, 1.0);
+
+    // Same filters on float and 16-bit images, which are row major
+    MatXf fmat = mat.cast<float>();
+    Image<uint16_t> imat = (65535.0 * mat).array().round().cast<uint16_t>();
+    MatXd dmat = imat.cast<double>();
+
+    GPT::Filter::Median median(7, 5);
+    GPT::Filter::Median dmedian(median);
+    median.apply(imat);
+    dmedian.apply(dmat);
+    ASSERT_DOUBLE_EQ(0.0, (dmat - imat.cast<double>()).cwiseAbs().maxCoeff());
+
+    GPT::Filter::Contrast contrast(0.2, 0.8);
+    MatXd ref(mat);
+    contrast.apply(ref);
+    contrast.apply(fmat);
+    ASSERT_GT(1e-5, (ref - fmat.cast<double>()).cwiseAbs().maxCoeff());
+
+    // Starting from the same values, so no pixel falls into a different histogram bin
+    fmat = ref.cast<float>();
+
+    GPT::Filter::CLAHE clahe(2.0, 16, 8);
+    clahe.apply(ref);
+    clahe.apply(fmat);
+    ASSERT_GT(1e-5, (ref - fmat.cast<double>()).cwiseAbs().maxCoeff());
+
+    // Filters without their own kernels still work through double precision
+    std::vector<MatXf> vec(6, fmat);
+    GPT::Filter::SVD svd;
+    svd.slice = 3;
+
+    GPT::Filter::Pipeline pipeline;
+    pipeline.add(&svd);
+
+    bool trigger = false;
+    GPT::ThreadPool pool(2);
+    pipeline.run(vec, pool, trigger);
+    ASSERT_GT(1e-5, (vec[4] - fmat).cwiseAbs().maxCoeff());
+}
\ No newline at end of file
@@ -139,6 +139,87 @@ TEST(Images, alignment)
     double zscore = (muRot - muCor) / sqrt((varRot + varCor) / double(nParticles));
     EXPECT_GE(abs(zscore), 3.0) << "Alignement :: Correction is not significant";
 
+    // Gradient based registration on the same images
+    GPT::Align gradient(1, std::vector<MatXd>{image}.data(), std::vector<MatXd>{rotated}.data());
+    gradient.setMethod(GPT::Align::GAUSS_NEWTON);
+    ASSERT_EQ(true, gradient.alignCameras());
+    ASSERT_EQ(true, gradient.correctAberrations());
+
+    const Mat3d& gtrf = gradient.getTransformData().trf;
+
+    double muGradient = 0.0;
+    for (uint64_t k = 0; k < nParticles; k++)
+    {
+        Vec3d pos = gtrf * Vec3d(posRotated(k, 0) + particles(k, 0), posRotated(k, 1) + particles(k, 1), 1.0);
+        muGradient += std::hypot(pos(0) - particles(k, 0), pos(1) - particles(k, 1)) / double(nParticles);
+    }
+
+    EXPECT_LT(muGradient, muRot) << " Alignment :: Gauss-Newton corrected avg distances are greater then raw ones";
+    EXPECT_LT(muGradient, 1.0) << " Alignment :: Gauss-Newton didn't reach subpixel accuracy";
+
+    // Phase correlation alone only recovers translation and rotation
+    GPT::Align phase(1, std::vector<MatXd>{image}.data(), std::vector<MatXd>{rotated}.data());
+    phase.setPhaseCorrelation(true);
+    ASSERT_EQ(true, phase.phaseCorrelation());
+
+    const Mat3d& ptrf = phase.getTransformData().trf;
+
+    double muPhase = 0.0;
+    for (uint64_t k = 0; k < nParticles; k++)
+    {
+        Vec3d pos = ptrf * Vec3d(posRotated(k, 0) + particles(k, 0), posRotated(k, 1) + particles(k, 1), 1.0);
+        muPhase += std::hypot(pos(0) - particles(k, 0), pos(1) - particles(k, 1)) / double(nParticles);
+    }
+
+    EXPECT_LT(muPhase, muRot) << " Alignment :: Phase correlation avg distances are greater then raw ones";
+
+    // Particles are sparse enough to be used as beads
+    GPT::Align beads(1, std::vector<MatXd>{image}.data(), std::vector<MatXd>{rotated}.data());
+    beads.setMethod(GPT::Align::BEADS);
+    beads.setSpotSize(2 * uint64_t(spotSize));
+    ASSERT_EQ(true, beads.alignCameras());
+    ASSERT_EQ(true, beads.correctAberrations());
+
+    const Mat3d& btrf = beads.getTransformData().trf;
+
+    double muBeads = 0.0;
+    for (uint64_t k = 0; k < nParticles; k++)
+    {
+        Vec3d pos = btrf * Vec3d(posRotated(k, 0) + particles(k, 0), posRotated(k, 1) + particles(k, 1), 1.0);
+        muBeads += std::hypot(pos(0) - particles(k, 0), pos(1) - particles(k, 1)) / double(nParticles);
+    }
+
+    EXPECT_LT(muBeads, 0.25) << " Alignment :: Bead registration didn't reach subpixel accuracy";
+
+}
+
+TEST(Images, warpMap)
+{
+    const uint64_t
+        iHeight = 64,
+        iWidth = 96;
+
+    MatXd image = MatXd::Random(iHeight, iWidth);
+    Mat3d itrf = transformMatrix(iWidth, iHeight).inverse();
+
+    GPT::WarpMap warp(itrf, iWidth, iHeight);
+
+    Image<float> warped;
+    warp.apply(image, warped);
+
+    ASSERT_EQ(iHeight, warped.rows());
+    ASSERT_EQ(iWidth, warped.cols());
+
+    // Nearest pixel, as done for every frame before
+    for (uint64_t k = 0; k < iHeight; k++)
+        for (uint64_t l = 0; l < iWidth; l++)
+        {
+            int64_t col = int64_t(std::floor(itrf(0, 0) * (double(l) + 0.5) + itrf(0, 1) * (double(k) + 0.5) + itrf(0, 2)));
+            int64_t row = int64_t(std::floor(itrf(1, 0) * (double(l) + 0.5) + itrf(1, 1) * (double(k) + 0.5) + itrf(1, 2)));
+
+            float value = (row >= 0 && row < int64_t(iHeight) && col >= 0 && col < int64_t(iWidth)) ? float(image(row, col)) : 0.0f;
+            ASSERT_EQ(value, warped(k, l)) << "Pixel (" << k << ", " << l << ") was not warped correctly";
+        }
 }
 
 TEST(Images, enhancement)
@@ -0,0 +1,256 @@
+#include <gtest/gtest.h>
+#include "GPMethods.h"
+
+#include <chrono>
+
+static Image<uint16_t> randomFrame(int64_t rows, int64_t cols)
+{
+    std::random_device dev;
+    std::default_random_engine ran(dev());
+    std::uniform_int_distribution<uint32_t> unif(0, 65535);
+
+    Image<uint16_t> img(rows, cols);
+    for (int64_t k = 0; k < img.size(); k++)
+        img.data()[k] = uint16_t(unif(ran));
+
+    return img;
+}
+
+// Minimal OME-XML for a single channel movie, planes and channel name are given as raw xml
+static std::string omeXML(uint64_t sizeT, const std::string &planes, const std::string &name = "GFP")
+{
+    return "<?xml version=\"1.0\" encoding=\"UTF-8\"?><OME><Image ID=\"Image:0\"><Pixels ID=\"Pixels:0\" "
+           "DimensionOrder=\"XYCZT\" Type=\"uint16\" SignificantBits=\"16\" SizeC=\"1\" SizeT=\"" + std::to_string(sizeT) +
+           "\" SizeX=\"6\" SizeY=\"5\" SizeZ=\"1\" PhysicalSizeX=\"0.1\" PhysicalSizeZ=\"1\" TimeIncrement=\"0.5\" "
+           "TimeIncrementUnit=\"s\"><Channel ID=\"Channel:0:0\" Name=\"" + name + "\"/>" + planes + "</Pixels></Image></OME>";
+}
+
+static GPT::Metadata loadOME(const std::string &xml)
+{
+    fs::path path = fs::temp_directory_path() / "gptool_metadata.tif";
+
+    {
+        GPT::Tiffer::Write writer(path, xml);
+        writer.append(randomFrame(5, 6));
+    }
+
+    GPT::Tiffer::Read reader(path);
+    GPT::Metadata meta(&reader);
+
+    fs::remove(path);
+    return meta;
+}
+
+TEST(Movie, tifferUpdate)
+{
+    fs::path path = fs::temp_directory_path() / "gptool_tifferUpdate.tif";
+
+    std::vector<Image<uint16_t>> vec;
+    for (int k = 0; k < 5; k++)
+        vec.emplace_back(randomFrame(12, 17));
+
+    GPT::Tiffer::Write writer(path);
+    for (int k = 0; k < 3; k++)
+        ASSERT_TRUE(writer.append(vec[k]));
+
+    GPT::Tiffer::Read reader(path);
+    ASSERT_TRUE(reader.successful());
+    ASSERT_EQ(3, reader.getNumDirectories());
+
+    // Nothing new yet
+    EXPECT_EQ(0, reader.update());
+
+    for (int k = 3; k < 5; k++)
+        ASSERT_TRUE(writer.append(vec[k]));
+
+    EXPECT_EQ(2, reader.update());
+    ASSERT_EQ(5, reader.getNumDirectories());
+
+    for (uint32_t k = 0; k < 5; k++)
+        EXPECT_TRUE(reader.getImage<uint16_t>(k) == vec[k]) << "Directory: " << k;
+
+    writer.close();
+    fs::remove(path);
+}
+
+TEST(Movie, follow)
+{
+    fs::path path = fs::temp_directory_path() / "gptool_follow.tif";
+
+    std::vector<Image<uint16_t>> vec;
+    for (int k = 0; k < 6; k++)
+        vec.emplace_back(randomFrame(9, 14));
+
+    GPT::Tiffer::Write writer(path);
+    for (int k = 0; k < 2; k++)
+        ASSERT_TRUE(writer.append(vec[k]));
+
+    std::vector<uint64_t> received;
+    {
+        GPT::Movie movie(path);
+        ASSERT_TRUE(movie.successful());
+        ASSERT_EQ(2, movie.getAvailableFrames());
+
+        std::mutex mtx;
+        movie.follow([&](uint64_t frame) -> void {
+            std::lock_guard<std::mutex> lock(mtx);
+            received.push_back(frame);
+            }, 10);
+
+        for (int k = 2; k < 6; k++)
+            ASSERT_TRUE(writer.append(vec[k]));
+
+        // Follower polls every 10 ms, a couple of seconds is plenty
+        for (int k = 0; k < 200 && movie.getAvailableFrames() < 6; k++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+        movie.unfollow();
+
+        ASSERT_EQ(6, movie.getAvailableFrames());
+        ASSERT_EQ(6, movie.getMetadata().SizeT);
+        EXPECT_EQ(0, movie.update());
+
+        // Every new frame is reported once and in order
+        ASSERT_EQ(4, received.size());
+        for (uint64_t k = 0; k < received.size(); k++)
+            EXPECT_EQ(k + 2, received[k]);
+
+        // New frames load from many threads at once
+        GPT::ThreadPool pool(4);
+        pool.run(12, [&](uint32_t id) -> void { movie.getImage(0, id % 6); });
+
+        for (uint64_t k = 0; k < 6; k++)
+            EXPECT_TRUE(movie.getImage(0, k) == vec[k].cast<double>()) << "Frame: " << k;
+    }
+
+    writer.close();
+    fs::remove(path);
+}
+
+TEST(Movie, planes)
+{
+    fs::path
+        path = fs::temp_directory_path() / "gptool_planes.tif",
+        csv = fs::temp_directory_path() / "gptool_planes.csv";
+
+    // Second plane is missing on purpose, planes are not in order either
+    std::string planes =
+        "<Plane TheC=\"0\" TheT=\"2\" TheZ=\"0\" DeltaT=\"1.3\" DeltaTUnit=\"s\"/>"
+        "<Plane TheC=\"0\" TheT=\"0\" TheZ=\"0\" DeltaT=\"0.1\" DeltaTUnit=\"s\" PositionX=\"4.5\"/>";
+
+    GPT::Tiffer::Write writer(path, omeXML(3, planes));
+    for (int k = 0; k < 3; k++)
+        ASSERT_TRUE(writer.append(randomFrame(5, 6)));
+
+    std::ofstream arq(csv);
+    arq << "# id,frame,x,y\n0,0,1,1\n0,1,2,2\n0,2,3,3\n0,4,4,4\n";
+    arq.close();
+
+    {
+        GPT::Movie movie(path);
+        ASSERT_TRUE(movie.successful());
+
+        const GPT::Metadata &meta = movie.getMetadata();
+        ASSERT_TRUE(meta.hasPlanes());
+        ASSERT_EQ(3, meta.SizeT);
+
+        GPT::Plane pne = meta.getPlane(0, 0, 2);
+        EXPECT_EQ(2, pne.TheT);
+        EXPECT_FLOAT_EQ(1.3f, pne.DeltaT);
+        EXPECT_EQ("s", pne.DeltaTUnit);
+
+        pne = meta.getPlane(0, 0, 0);
+        EXPECT_FLOAT_EQ(0.1f, pne.DeltaT);
+        EXPECT_FLOAT_EQ(4.5f, pne.PositionX);
+
+        // Missing planes are evenly spaced by TimeIncrement
+        const VecXd &vt = meta.getDeltaT(0);
+        ASSERT_EQ(3, vt.size());
+        EXPECT_NEAR(0.1, vt(0), 1e-6);
+        EXPECT_NEAR(0.5, vt(1), 1e-6);
+        EXPECT_NEAR(1.3, vt(2), 1e-6);
+
+        // Acquisition continues past the size written in the metadata
+        for (int k = 0; k < 2; k++)
+            ASSERT_TRUE(writer.append(randomFrame(5, 6)));
+
+        EXPECT_EQ(2, movie.update());
+        ASSERT_EQ(5, meta.SizeT);
+        ASSERT_EQ(5, meta.getDeltaT(0).size());
+        EXPECT_NEAR(1.3, meta.getDeltaT(0)(2), 1e-6);
+        EXPECT_NEAR(2.0, meta.getDeltaT(0)(4), 1e-6);
+
+        // Tracks get their time points from the planes
+        GPT::Trajectory traj(&movie);
+        ASSERT_TRUE(traj.useCSV(csv));
+
+        const MatXd &mat = traj.getTrack(0).traj.at(0);
+        ASSERT_EQ(4, mat.rows());
+        EXPECT_NEAR(0.1, mat(0, GPT::Track::TIME), 1e-6);
+        EXPECT_NEAR(0.5, mat(1, GPT::Track::TIME), 1e-6);
+        EXPECT_NEAR(1.3, mat(2, GPT::Track::TIME), 1e-6);
+        EXPECT_NEAR(2.0, mat(3, GPT::Track::TIME), 1e-6);
+    }
+
+    writer.close();
+    fs::remove(path);
+    fs::remove(csv);
+}
+
+TEST(Movie, metadataEntities)
+{
+    // Malformed character references are kept as they are
+    GPT::Metadata meta = loadOME(omeXML(1, "", "A&amp;B &lt;&#956;&#x3BC;&gt; &#x; &#zz; &#xzz; &bogus;"));
+
+    ASSERT_EQ(1, meta.nameCH.size());
+    EXPECT_EQ("A&B <\xCE\xBC\xCE\xBC> &#x; &#zz; &#xzz; &bogus;", meta.nameCH[0]);
+    EXPECT_EQ("s", meta.TimeIncrementUnit);
+    EXPECT_EQ(16, meta.SignificantBits);
+}
+
+TEST(Movie, metadataPlaneTags)
+{
+    // Single quotes, open tags with children and self-closing tags are all planes
+    std::string planes =
+        "<Plane TheC='0' TheT='1' TheZ='0' DeltaT='0.7' DeltaTUnit='&#181;s'><HashSHA1>abc</HashSHA1></Plane>"
+        "<Plane\n TheC=\"0\" TheT=\"0\" TheZ=\"0\" DeltaT=\"0.2\" ExposureTime = '30' ExposureTimeUnit=\"ms\" />"
+        "<Plane TheC=\"0\" TheT=\"2\" TheZ=\"0\" DeltaT=\"1.1\"></Plane>";
+
+    GPT::Metadata meta = loadOME(omeXML(3, planes));
+    ASSERT_TRUE(meta.hasPlanes());
+
+    GPT::Plane pne = meta.getPlane(0, 0, 1);
+    EXPECT_EQ(1, pne.TheT);
+    EXPECT_FLOAT_EQ(0.7f, pne.DeltaT);
+    EXPECT_EQ("\xC2\xB5s", pne.DeltaTUnit);
+
+    pne = meta.getPlane(0, 0, 0);
+    EXPECT_FLOAT_EQ(0.2f, pne.DeltaT);
+    EXPECT_FLOAT_EQ(30.0f, pne.ExposureTime);
+    EXPECT_EQ("ms", pne.ExposureTimeUnit);
+    EXPECT_EQ("", pne.DeltaTUnit);
+
+    pne = meta.getPlane(0, 0, 2);
+    EXPECT_FLOAT_EQ(1.1f, pne.DeltaT);
+}
+
+TEST(Movie, metadataMissingPlanes)
+{
+    // Without planes, time points come from TimeIncrement
+    GPT::Metadata meta = loadOME(omeXML(4, ""));
+    ASSERT_FALSE(meta.hasPlanes());
+
+    GPT::Plane pne = meta.getPlane(0, 0, 3);
+    EXPECT_EQ(3, pne.TheT);
+    EXPECT_FLOAT_EQ(1.5f, pne.DeltaT);
+    EXPECT_EQ("s", pne.DeltaTUnit);
+
+    // Out of range requests don't read past the planes either
+    meta = loadOME(omeXML(2, "<Plane TheC=\"0\" TheT=\"0\" TheZ=\"0\" DeltaT=\"0.3\"/>"));
+    ASSERT_TRUE(meta.hasPlanes());
+
+    EXPECT_FLOAT_EQ(0.3f, meta.getPlane(0, 0, 0).DeltaT);
+    EXPECT_FLOAT_EQ(0.5f, meta.getPlane(0, 0, 1).DeltaT);
+    EXPECT_EQ(7, meta.getPlane(0, 0, 7).TheT);
+    EXPECT_EQ(5, meta.getPlane(5, 0, 0).TheC);
+}
@@ -0,0 +1,173 @@
+#include <gtest/gtest.h>
+#include "GPMethods.h"
+
+#include "filterChain.h"
+
+using namespace GPT;
+
+TEST(Tools, json)
+{
+    Tool::Json json;
+    ASSERT_TRUE(Tool::parseJson(R"( { "a": [1, 2.5, -3e2], "b": { "c": true, "d": null }, "e": "" } )", json));
+    ASSERT_TRUE(json.isObject());
+
+    const auto& obj = json.object();
+    ASSERT_EQ(3, obj.at("a").array().size());
+    EXPECT_DOUBLE_EQ(2.5, obj.at("a").array()[1].number());
+    EXPECT_DOUBLE_EQ(-300.0, obj.at("a").array()[2].number());
+    EXPECT_TRUE(obj.at("b").object().at("c").boolean());
+    EXPECT_EQ("", obj.at("e").string());
+
+    // Escaped characters, including code points beyond the basic plane
+    ASSERT_TRUE(Tool::parseJson(R"("a\"b\\c\/d\n\t\u0041\u00b5\u20AC\ud83d\uDE00")", json));
+    EXPECT_EQ("a\"b\\c/d\n\tA\xC2\xB5\xE2\x82\xAC\xF0\x9F\x98\x80", json.string());
+
+    for (const char* text : { R"("\q")", R"("\u12")", R"("\u12G4")", R"("\ud83d")", R"("\ude00")", R"("abc)", "[1, 2", "{\"a\" 1}", "[1] 2", "" })
+        EXPECT_FALSE(Tool::parseJson(text, json)) << text;
+}
+
+TEST(Tools, chain)
+{
+    Tool::Json json;
+    ASSERT_TRUE(Tool::parseJson(R"({ "threads": 2, "memory": 64,
+        "filters": [ { "name": "Median", "sizeX": 5, "sizeY": 3 },
+                     { "name": "Background", "radius": 4, "compensateBleaching": false },
+                     { "name": "Contrast", "wholeMovie": true, "lowPercentile": 0.01 } ] })", json));
+
+    Tool::Chain chain;
+    Tool::Options opt;
+    ASSERT_TRUE(Tool::createChain(json, chain, opt));
+
+    EXPECT_EQ(2, opt.threads);
+    EXPECT_EQ(64, opt.memory);
+    EXPECT_EQ(0, opt.channel);
+
+    ASSERT_EQ(3, chain.vFilters.size());
+    EXPECT_EQ(2, chain.numStages);
+    EXPECT_EQ(18, chain.windowFrames);
+    EXPECT_TRUE(chain.buffersMovie);
+
+    auto median = dynamic_cast<Filter::Median*>(chain.vFilters[0].get());
+    ASSERT_NE(nullptr, median);
+    EXPECT_EQ(5, median->sizeX);
+    EXPECT_EQ(3, median->sizeY);
+
+    auto background = dynamic_cast<Filter::BackgroundSubtraction*>(chain.vFilters[1].get());
+    ASSERT_NE(nullptr, background);
+    EXPECT_EQ(4, background->radius);
+    EXPECT_FALSE(background->compensateBleaching);
+
+    auto contrast = dynamic_cast<Filter::Contrast*>(chain.vFilters[2].get());
+    ASSERT_NE(nullptr, contrast);
+    EXPECT_DOUBLE_EQ(0.01, contrast->lowPercentile);
+
+    // Differences of frames can be negative, until a contrast filter maps them back
+    EXPECT_DOUBLE_EQ(0.0, chain.low);
+    EXPECT_DOUBLE_EQ(1.0, chain.high);
+
+    Tool::Chain signedChain;
+    ASSERT_TRUE(Tool::parseJson(R"({ "filters": [ { "name": "DoG" }, { "name": "Background" } ] })", json));
+    ASSERT_TRUE(Tool::createChain(json, signedChain, opt));
+    EXPECT_DOUBLE_EQ(-2.0, signedChain.low);
+    EXPECT_DOUBLE_EQ(2.0, signedChain.high);
+
+    // Unknown filters, parameters and entries are errors
+    for (const char* text : { R"({ "filters": [ { "name": "Blur" } ] })",
+                              R"({ "filters": [ { "sizeX": 3 } ] })",
+                              R"({ "filters": [ { "name": "Median", "size": 3 } ] })",
+                              R"({ "filters": [ { "name": "Median", "sizeX": true } ] })",
+                              R"({ "threads": "two" })",
+                              R"([ { "name": "Median" } ])" })
+    {
+        Tool::Chain other;
+        ASSERT_TRUE(Tool::parseJson(text, json)) << text;
+        EXPECT_FALSE(Tool::createChain(json, other, opt)) << text;
+    }
+}
+
+TEST(Tools, commandLine)
+{
+    const fs::path
+        folder = fs::temp_directory_path() / "gptool_tools",
+        input = folder / "movie.tif",
+        chainPath = folder / "chain.json",
+        output = folder / "out" / "movie_filtered.tif";
+
+    fs::remove_all(folder);
+    fs::create_directories(folder);
+
+    std::string xml =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?><OME><Image ID=\"Image:0\"><Pixels ID=\"Pixels:0\" DimensionOrder=\"XYCZT\" "
+        "Type=\"uint16\" SignificantBits=\"16\" SizeC=\"1\" SizeT=\"4\" SizeX=\"11\" SizeY=\"9\" SizeZ=\"1\" "
+        "PhysicalSizeX=\"0.108\" PhysicalSizeXUnit=\"&#181;m\" PhysicalSizeZ=\"1\" TimeIncrement=\"0.25\" TimeIncrementUnit=\"s\">"
+        "<Channel ID=\"Channel:0:0\" Name=\"GFP &amp; RFP\"/>"
+        "<Plane TheC=\"0\" TheT=\"0\" TheZ=\"0\" DeltaT=\"0.1\" DeltaTUnit=\"s\"/>"
+        "<Plane TheC=\"0\" TheT=\"2\" TheZ=\"0\" DeltaT=\"0.6\" DeltaTUnit=\"s\" ExposureTime=\"20\" ExposureTimeUnit=\"ms\"/>"
+        "</Pixels></Image></OME>";
+
+    std::random_device dev;
+    std::default_random_engine ran(dev());
+    std::uniform_int_distribution<uint32_t> unif(0, 65535);
+
+    std::vector<Image<uint16_t>> vec(4, Image<uint16_t>(9, 11));
+    {
+        Tiffer::Write writer(input, xml);
+        for (Image<uint16_t>& img : vec)
+        {
+            for (int64_t k = 0; k < img.size(); k++)
+                img.data()[k] = uint16_t(unif(ran));
+
+            ASSERT_TRUE(writer.append(img));
+        }
+    }
+
+    std::ofstream arq(chainPath);
+    arq << R"({ "filters": [ { "name": "Median", "sizeX": 3, "sizeY": 3 } ] })";
+    arq.close();
+
+    // Options are validated before anything is written
+    EXPECT_EQ(EXIT_FAILURE, Tool::runFilter({ chainPath.string(), (folder / "out").string() }));
+    EXPECT_EQ(EXIT_FAILURE, Tool::runFilter({ chainPath.string(), (folder / "out").string(), input.string(), "--speed", "2" }));
+    EXPECT_EQ(EXIT_FAILURE, Tool::runFilter({ chainPath.string(), (folder / "out").string(), input.string(), "--threads", "2x" }));
+    EXPECT_EQ(EXIT_FAILURE, Tool::runFilter({ chainPath.string(), (folder / "out").string(), input.string(), "--channel", "1" }));
+    ASSERT_EQ(EXIT_SUCCESS, Tool::runFilter({ chainPath.string(), (folder / "out").string(), input.string(), "--threads", "2" }));
+    ASSERT_TRUE(fs::exists(output));
+
+    {
+        Movie movie(output);
+        ASSERT_TRUE(movie.successful());
+
+        // Metadata of the input movie is kept
+        const Metadata& meta = movie.getMetadata();
+        EXPECT_EQ(16, meta.SignificantBits);
+        EXPECT_EQ(4, meta.SizeT);
+        EXPECT_EQ(11, meta.SizeX);
+        EXPECT_EQ(9, meta.SizeY);
+        EXPECT_NEAR(0.108, meta.PhysicalSizeXY, 1e-6);
+        EXPECT_EQ("\xC2\xB5m", meta.PhysicalSizeXYUnit);
+        EXPECT_NEAR(0.25, meta.TimeIncrement, 1e-6);
+        EXPECT_EQ("s", meta.TimeIncrementUnit);
+        ASSERT_EQ(1, meta.nameCH.size());
+        EXPECT_EQ("GFP & RFP", meta.nameCH[0]);
+
+        ASSERT_TRUE(meta.hasPlanes());
+        EXPECT_NEAR(0.1, meta.getDeltaT(0)(0), 1e-6);
+        EXPECT_NEAR(0.25, meta.getDeltaT(0)(1), 1e-6);
+        EXPECT_NEAR(0.6, meta.getDeltaT(0)(2), 1e-6);
+        EXPECT_FLOAT_EQ(20.0f, meta.getPlane(0, 0, 2).ExposureTime);
+        EXPECT_EQ("ms", meta.getPlane(0, 0, 2).ExposureTimeUnit);
+
+        // Frames went through the chain
+        Filter::Median median(3, 3);
+        for (uint64_t k = 0; k < vec.size(); k++)
+        {
+            MatXd ref = vec[k].cast<double>() / 65535.0;
+            median.apply(ref);
+
+            MatXd expected = (65535.0 * ref.array() + 0.5).floor();
+            EXPECT_GT(1e-8, (movie.getImage(0, k) - expected).cwiseAbs().maxCoeff()) << "Frame: " << k;
+        }
+    }
+
+    fs::remove_all(folder);
+}
@@ -0,0 +1,709 @@
+#include "filterChain.h"
+
+#include <charconv>
+#include <sstream>
+
+namespace GPT::Tool
+{
+    namespace
+    {
+        /*****************************************************************************/
+        // Minimal json reader, enough for filter chains
+
+        class JsonParser
+        {
+        public:
+            JsonParser(const std::string& text) : text(text) {}
+
+            bool parse(Json& out)
+            {
+                if (!parseValue(out))
+                    return false;
+
+                skipSpaces();
+                if (pos != text.size())
+                    return error("unexpected characters after the end");
+
+                return true;
+            }
+
+        private:
+            const std::string& text;
+            size_t pos = 0;
+
+            bool error(const std::string& msg)
+            {
+                pout("ERROR (gp-filter::JsonParser) ==> Character", pos, ":", msg);
+                return false;
+            }
+
+            void skipSpaces(void)
+            {
+                while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos])))
+                    pos++;
+            }
+
+            bool match(const std::string& word)
+            {
+                if (text.compare(pos, word.size(), word) != 0)
+                    return false;
+
+                pos += word.size();
+                return true;
+            }
+
+            bool parseValue(Json& out)
+            {
+                skipSpaces();
+                if (pos >= text.size())
+                    return error("unexpected end of file");
+
+                char c = text[pos];
+
+                if (c == '{')
+                    return parseObject(out);
+                else if (c == '[')
+                    return parseArray(out);
+                else if (c == '"')
+                {
+                    std::string str;
+                    if (!parseString(str))
+                        return false;
+
+                    out.value = std::move(str);
+                    return true;
+                }
+                else if (match("true"))
+                    out.value = true;
+                else if (match("false"))
+                    out.value = false;
+                else if (match("null"))
+                    out.value = nullptr;
+                else
+                {
+                    const char* beg = text.c_str() + pos;
+                    char* end = nullptr;
+                    double val = strtod(beg, &end);
+
+                    if (end == beg)
+                        return error("invalid value");
+
+                    pos += end - beg;
+                    out.value = val;
+                }
+
+                return true;
+            }
+
+            // Four hexadecimal digits of an \u escape
+            bool readHex(uint32_t& code)
+            {
+                if (pos + 4 > text.size())
+                    return false;
+
+                const char* beg = text.data() + pos;
+                auto [ptr, ec] = std::from_chars(beg, beg + 4, code, 16);
+                if (ec != std::errc() || ptr != beg + 4)
+                    return false;
+
+                pos += 4;
+                return true;
+            }
+
+            bool parseString(std::string& out)
+            {
+                pos++; // opening quotes
+
+                while (pos < text.size() && text[pos] != '"')
+                {
+                    char c = text[pos++];
+                    if (c != '\\')
+                    {
+                        out.push_back(c);
+                        continue;
+                    }
+
+                    if (pos >= text.size())
+                        break;
+
+                    switch (char esc = text[pos++])
+                    {
+                    case '"':
+                    case '\\':
+                    case '/':
+                        out.push_back(esc);
+                        break;
+
+                    case 'b': out.push_back('\b'); break;
+                    case 'f': out.push_back('\f'); break;
+                    case 'n': out.push_back('\n'); break;
+                    case 'r': out.push_back('\r'); break;
+                    case 't': out.push_back('\t'); break;
+
+                    case 'u':
+                    {
+                        uint32_t code = 0;
+                        if (!readHex(code))
+                            return error("invalid unicode escape");
+
+                        // Characters beyond the basic plane come as surrogate pairs
+                        if (code >= 0xD800 && code < 0xDC00)
+                        {
+                            uint32_t low = 0;
+                            if (!match("\\u") || !readHex(low) || low < 0xDC00 || low >= 0xE000)
+                                return error("invalid surrogate pair");
+
+                            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        else if (code >= 0xDC00 && code < 0xE000)
+                            return error("invalid surrogate pair");
+
+                        appendUTF8(out, code);
+                        break;
+                    }
+
+                    default:
+                        return error("invalid escape sequence");
+                    }
+                }
+
+                if (pos >= text.size())
+                    return error("unterminated string");
+
+                pos++; // closing quotes
+                return true;
+            }
+
+            bool parseArray(Json& out)
+            {
+                std::vector<Json> vec;
+                pos++;
+
+                skipSpaces();
+                if (match("]"))
+                {
+                    out.value = std::move(vec);
+                    return true;
+                }
+
+                while (true)
+                {
+                    Json val;
+                    if (!parseValue(val))
+                        return false;
+
+                    vec.emplace_back(std::move(val));
+
+                    skipSpaces();
+                    if (match("]"))
+                        break;
+
+                    if (!match(","))
+                        return error("expected ',' or ']'");
+                }
+
+                out.value = std::move(vec);
+                return true;
+            }
+
+            bool parseObject(Json& out)
+            {
+                std::map<std::string, Json> obj;
+                pos++;
+
+                skipSpaces();
+                if (match("}"))
+                {
+                    out.value = std::move(obj);
+                    return true;
+                }
+
+                while (true)
+                {
+                    skipSpaces();
+                    std::string key;
+                    if (pos >= text.size() || text[pos] != '"' || !parseString(key))
+                        return error("expected a key");
+
+                    skipSpaces();
+                    if (!match(":"))
+                        return error("expected ':'");
+
+                    if (!parseValue(obj[key]))
+                        return false;
+
+                    skipSpaces();
+                    if (match("}"))
+                        break;
+
+                    if (!match(","))
+                        return error("expected ',' or '}'");
+                }
+
+                out.value = std::move(obj);
+                return true;
+            }
+        };
+
+        std::string escapeXML(const std::string& value)
+        {
+            std::string out;
+            out.reserve(value.size());
+
+            for (char c : value)
+                switch (c)
+                {
+                case '&': out += "&amp;"; break;
+                case '<': out += "&lt;"; break;
+                case '>': out += "&gt;"; break;
+                case '"': out += "&quot;"; break;
+                case '\'': out += "&apos;"; break;
+                default: out += c;
+                }
+
+            return out;
+        }
+
+        bool readNumber(const std::string& arg, int64_t& value)
+        {
+            try
+            {
+                size_t used = 0;
+                value = std::stoll(arg, &used);
+                return used == arg.size();
+            }
+            catch (...)
+            {
+                return false;
+            }
+        }
+    }
+
+    bool parseJson(const std::string& text, Json& out) { return JsonParser(text).parse(out); }
+
+    /*****************************************************************************/
+    // Filter chain
+
+    bool createFilter(const std::map<std::string, Json>& obj, Chain& chain)
+    {
+        auto it = obj.find("name");
+        if (it == obj.end() || !it->second.isString())
+        {
+            pout("ERROR (gp-filter::createFilter) ==> Every filter needs a name!");
+            return false;
+        }
+
+        const std::string& name = it->second.string();
+
+        // Every parameter has the name of the member it sets
+        std::map<std::string, double*> vDouble;
+        std::map<std::string, int64_t*> vInt;
+        std::map<std::string, bool*> vBool;
+
+        std::unique_ptr<Filter::Filter> filter;
+        bool perFrame = true;
+
+        if (name == "Contrast")
+        {
+            auto ptr = std::make_unique<Filter::Contrast>();
+            vDouble = { {"low", &ptr->low}, {"high", &ptr->high}, {"lowPercentile", &ptr->lowPercentile}, {"highPercentile", &ptr->highPercentile} };
+            vBool = { {"wholeMovie", &ptr->wholeMovie} };
+            filter = std::move(ptr);
+        }
+        else if (name == "Median")
+        {
+            auto ptr = std::make_unique<Filter::Median>();
+            vInt = { {"sizeX", &ptr->sizeX}, {"sizeY", &ptr->sizeY} };
+            filter = std::move(ptr);
+        }
+        else if (name == "CLAHE")
+        {
+            auto ptr = std::make_unique<Filter::CLAHE>();
+            vDouble = { {"clipLimit", &ptr->clipLimit} };
+            vInt = { {"tileSizeX", &ptr->tileSizeX}, {"tileSizeY", &ptr->tileSizeY} };
+            filter = std::move(ptr);
+        }
+        else if (name == "Gaussian")
+        {
+            auto ptr = std::make_unique<Filter::Gaussian>();
+            vDouble = { {"sigmaX", &ptr->sigmaX}, {"sigmaY", &ptr->sigmaY} };
+            filter = std::move(ptr);
+        }
+        else if (name == "DoG")
+        {
+            auto ptr = std::make_unique<Filter::DoG>();
+            vDouble = { {"sigmaLow", &ptr->sigmaLow}, {"sigmaHigh", &ptr->sigmaHigh} };
+            filter = std::move(ptr);
+        }
+        else if (name == "TopHat")
+        {
+            auto ptr = std::make_unique<Filter::TopHat>();
+            vInt = { {"radiusX", &ptr->radiusX}, {"radiusY", &ptr->radiusY} };
+            filter = std::move(ptr);
+        }
+        else if (name == "NLMeans")
+        {
+            auto ptr = std::make_unique<Filter::NLMeans>();
+            vDouble = { {"sigma", &ptr->sigma}, {"strength", &ptr->strength} };
+            vInt = { {"patchRadius", &ptr->patchRadius}, {"searchRadius", &ptr->searchRadius} };
+            filter = std::move(ptr);
+        }
+        else if (name == "SVD")
+        {
+            auto ptr = std::make_unique<Filter::SVD>();
+            vInt = { {"slice", &ptr->slice}, {"rank", &ptr->rank} };
+            vBool = { {"truncated", &ptr->truncated} };
+            filter = std::move(ptr);
+            perFrame = false;
+        }
+        else if (name == "RunningMean" || name == "TemporalMedian")
+        {
+            std::unique_ptr<Filter::Temporal> ptr;
+            if (name == "RunningMean")
+                ptr = std::make_unique<Filter::RunningMean>();
+            else
+                ptr = std::make_unique<Filter::TemporalMedian>();
+
+            vInt = { {"radius", &ptr->radius} };
+            filter = std::move(ptr);
+            perFrame = false;
+        }
+        else if (name == "Background" || name == "BackgroundSubtraction")
+        {
+            auto ptr = std::make_unique<Filter::BackgroundSubtraction>();
+            vInt = { {"radius", &ptr->radius} };
+            vBool = { {"compensateBleaching", &ptr->compensateBleaching} };
+            filter = std::move(ptr);
+            perFrame = false;
+        }
+        else if (name == "TemporalNLMeans")
+        {
+            auto ptr = std::make_unique<Filter::TemporalNLMeans>();
+            vDouble = { {"sigma", &ptr->sigma}, {"strength", &ptr->strength} };
+            vInt = { {"radius", &ptr->radius}, {"patchRadius", &ptr->patchRadius}, {"searchRadius", &ptr->searchRadius} };
+            filter = std::move(ptr);
+            perFrame = false;
+        }
+        else
+        {
+            pout("ERROR (gp-filter::createFilter) ==> Unknown filter:", name);
+            return false;
+        }
+
+        for (auto& [key, value] : obj)
+        {
+            if (key == "name")
+                continue;
+
+            bool ok = false;
+            if (vDouble.count(key) && value.isNumber())
+            {
+                *vDouble[key] = value.number();
+                ok = true;
+            }
+            else if (vInt.count(key) && value.isNumber())
+            {
+                *vInt[key] = int64_t(value.number());
+                ok = true;
+            }
+            else if (vBool.count(key) && value.isBool())
+            {
+                *vBool[key] = value.boolean();
+                ok = true;
+            }
+
+            if (!ok)
+            {
+                pout("ERROR (gp-filter::createFilter) ==> Invalid parameter for", name, ":", key);
+                return false;
+            }
+        }
+
+        // Estimating memory held by the filter, in frames
+        if (Filter::SVD* svd = dynamic_cast<Filter::SVD*>(filter.get()))
+            chain.windowFrames += 2 * svd->slice;
+        else if (Filter::Temporal* temp = dynamic_cast<Filter::Temporal*>(filter.get()))
+            chain.windowFrames += (dynamic_cast<Filter::TemporalMedian*>(temp) || dynamic_cast<Filter::TemporalNLMeans*>(temp) ? 2 : 1) * (2 * temp->radius + 1);
+        else
+        {
+            Filter::Contrast* contrast = dynamic_cast<Filter::Contrast*>(filter.get());
+            if (contrast && contrast->wholeMovie)
+                chain.buffersMovie = true;
+        }
+
+        // Differences of values in a range of width w lie in [-w, w], while contrast filters map back to [0, 1]
+        if (dynamic_cast<Filter::DoG*>(filter.get()) || dynamic_cast<Filter::BackgroundSubtraction*>(filter.get()))
+        {
+            double width = chain.high - chain.low;
+            chain.low = -width;
+            chain.high = width;
+        }
+        else if (dynamic_cast<Filter::Contrast*>(filter.get()) || dynamic_cast<Filter::CLAHE*>(filter.get()))
+        {
+            chain.low = 0.0;
+            chain.high = 1.0;
+        }
+
+        if (perFrame)
+            chain.numStages++;
+
+        chain.vFilters.emplace_back(std::move(filter));
+        return true;
+    }
+
+    bool createChain(const Json& json, Chain& chain, Options& opt)
+    {
+        if (!json.isObject())
+        {
+            pout("ERROR (gp-filter::createChain) ==> Filter chain must be a json object!");
+            return false;
+        }
+
+        std::map<std::string, int64_t*> vOpt = { {"threads", &opt.threads}, {"memory", &opt.memory}, {"channel", &opt.channel} };
+
+        for (auto& [key, value] : json.object())
+        {
+            if (key == "filters" && value.isArray())
+            {
+                for (const Json& obj : value.array())
+                    if (!obj.isObject() || !createFilter(obj.object(), chain))
+                        return false;
+            }
+            else if (vOpt.count(key) && value.isNumber())
+                *vOpt[key] = int64_t(value.number());
+            else
+            {
+                pout("ERROR (gp-filter::createChain) ==> Invalid entry in filter chain:", key);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    /*****************************************************************************/
+
+    std::string describeOutput(const Metadata& meta, uint64_t channel)
+    {
+        std::ostringstream ss;
+        ss.precision(9); // enough for values read as floats
+
+        // Units are optional, empty ones are left out
+        auto unit = [&](const char* name, const std::string& value) -> void {
+            if (!value.empty())
+                ss << ' ' << name << "=\"" << escapeXML(value) << '"';
+        };
+
+        ss << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>"
+           << "<OME xmlns=\"http://www.openmicroscopy.org/Schemas/OME/2016-06\">"
+           << "<Image ID=\"Image:0\" Name=\"" << escapeXML(meta.movie_name) << "\">";
+
+        if (!meta.acquisitionDate.empty())
+            ss << "<AcquisitionDate>" << escapeXML(meta.acquisitionDate) << "</AcquisitionDate>";
+
+        // Filtered frames are always saved as a single 16-bit channel
+        ss << "<Pixels ID=\"Pixels:0\" DimensionOrder=\"XYCZT\" Type=\"uint16\" SignificantBits=\"16\""
+           << " SizeC=\"1\" SizeT=\"" << meta.SizeT << "\" SizeX=\"" << meta.SizeX << "\" SizeY=\"" << meta.SizeY << "\" SizeZ=\"1\""
+           << " PhysicalSizeX=\"" << meta.PhysicalSizeXY << "\" PhysicalSizeY=\"" << meta.PhysicalSizeXY << '"';
+        unit("PhysicalSizeXUnit", meta.PhysicalSizeXYUnit);
+        unit("PhysicalSizeYUnit", meta.PhysicalSizeXYUnit);
+
+        ss << " PhysicalSizeZ=\"" << meta.PhysicalSizeZ << '"';
+        unit("PhysicalSizeZUnit", meta.PhysicalSizeZUnit);
+
+        ss << " TimeIncrement=\"" << meta.TimeIncrement << '"';
+        unit("TimeIncrementUnit", meta.TimeIncrementUnit);
+
+        std::string name = channel < meta.nameCH.size() ? meta.nameCH[channel] : "";
+        ss << "><Channel ID=\"Channel:0:0\" Name=\"" << escapeXML(name) << "\" SamplesPerPixel=\"1\"/>"
+           << "<TiffData IFD=\"0\" PlaneCount=\"" << meta.SizeT << "\"/>";
+
+        // Planes keep the time points of the channel
+        if (meta.hasPlanes())
+            for (uint64_t t = 0; t < meta.SizeT; t++)
+            {
+                Plane pne = meta.getPlane(channel, 0, t);
+
+                ss << "<Plane TheC=\"0\" TheT=\"" << t << "\" TheZ=\"0\" DeltaT=\"" << pne.DeltaT << '"';
+                unit("DeltaTUnit", pne.DeltaTUnit);
+
+                ss << " ExposureTime=\"" << pne.ExposureTime << '"';
+                unit("ExposureTimeUnit", pne.ExposureTimeUnit);
+
+                ss << " PositionX=\"" << pne.PositionX << '"';
+                unit("PositionXUnit", pne.PositionXUnit);
+
+                ss << " PositionY=\"" << pne.PositionY << '"';
+                unit("PositionYUnit", pne.PositionYUnit);
+
+                ss << " PositionZ=\"" << pne.PositionZ << '"';
+                unit("PositionZUnit", pne.PositionZUnit);
+
+                ss << "/>";
+            }
+
+        ss << "</Pixels></Image></OME>";
+        return ss.str();
+    }
+
+    bool filterMovie(const fs::path& input, const fs::path& output, Chain& chain, const Options& opt, ThreadPool& pool)
+    {
+        Movie movie(input);
+        if (!movie.successful())
+            return false;
+
+        const Metadata& meta = movie.getMetadata();
+        if (opt.channel < 0 || uint64_t(opt.channel) >= meta.SizeC)
+        {
+            pout("ERROR (gp-filter) ==> Movie doesn't have channel", opt.channel, "::", input);
+            return false;
+        }
+
+        if (meta.SignificantBits != 8 && meta.SignificantBits != 16 && meta.SignificantBits != 32)
+        {
+            pout("ERROR (gp-filter) ==> Bit depth is not supported ::", input);
+            return false;
+        }
+
+        // Frames are held in double precision while filtered
+        const int64_t
+            nFrames = int64_t(meta.SizeT),
+            frameBytes = 8 * int64_t(meta.SizeX) * int64_t(meta.SizeY),
+            budget = opt.memory * 1024 * 1024 / std::max<int64_t>(frameBytes, 1) - chain.windowFrames;
+
+        Filter::Pipeline pipeline;
+        for (auto& filter : chain.vFilters)
+            pipeline.add(filter.get());
+
+        pipeline.batchSize = std::max<int64_t>(budget / std::max<int64_t>(chain.numStages, 1), 1);
+
+        if (budget < chain.numStages)
+            pout("WARNING (gp-filter) ==> Memory budget is too small for this chain, using one frame per stage");
+
+        if (chain.buffersMovie)
+            pout("WARNING (gp-filter) ==> Whole movie contrast holds every frame in memory");
+
+        if (chain.low < 0.0)
+            pout("WARNING (gp-filter) ==> Chain output can be negative, values from", chain.low, "to", chain.high, "are mapped to the 16-bit range");
+
+        if (meta.SignificantBits > 16)
+            pout("WARNING (gp-filter) ==> Output is 16-bit, so", meta.SignificantBits, "bit input loses precision");
+
+        Tiffer::Write writer(output, describeOutput(meta, uint64_t(opt.channel)));
+        if (!writer.isOpen())
+            return false;
+
+        bool ok = true;
+        pipeline.emit = [&](int64_t /*frame*/, MatXd& img) -> void {
+            const double range = chain.high - chain.low;
+            Image<uint16_t> out = (65535.0 * ((img.array() - chain.low) / range).max(0.0).min(1.0) + 0.5).cast<uint16_t>();
+
+            if (ok)
+                ok = writer.append(out);
+        };
+
+        const double scale = 1.0 / (std::pow(2.0, double(meta.SignificantBits)) - 1.0);
+
+        for (int64_t fr = 0; fr < nFrames && ok; fr++)
+        {
+            pipeline.push(scale * movie.getImage(opt.channel, fr), pool);
+            movie.release(opt.channel, fr);
+        }
+
+        pipeline.flush();
+        writer.close();
+
+        return ok;
+    }
+
+    /*****************************************************************************/
+
+    int runFilter(const std::vector<std::string>& vInput)
+    {
+        std::vector<std::string> vArgs;
+        std::map<std::string, std::string> vCmd;
+
+        for (size_t k = 0; k < vInput.size(); k++)
+        {
+            const std::string& arg = vInput[k];
+
+            if (arg.rfind("--", 0) == 0)
+            {
+                if (k + 1 >= vInput.size())
+                {
+                    pout("ERROR (gp-filter) ==> Missing value for", arg);
+                    return EXIT_FAILURE;
+                }
+
+                vCmd[arg.substr(2)] = vInput[++k];
+            }
+            else
+                vArgs.push_back(arg);
+        }
+
+        if (vArgs.size() < 3)
+        {
+            pout("Usage: gp-filter <chain.json> <output folder> <movie.tif> [<movie.tif> ...] [--threads N] [--memory MB] [--channel C]");
+            return EXIT_FAILURE;
+        }
+
+        // Reading filter chain
+        std::ifstream file(vArgs[0]);
+        if (!file.is_open())
+        {
+            pout("ERROR (gp-filter) ==> Cannot open", vArgs[0]);
+            return EXIT_FAILURE;
+        }
+
+        std::stringstream ss;
+        ss << file.rdbuf();
+
+        Json json;
+        if (!parseJson(ss.str(), json))
+        {
+            pout("ERROR (gp-filter) ==> Invalid filter chain:", vArgs[0]);
+            return EXIT_FAILURE;
+        }
+
+        Options opt;
+        Chain chain;
+        if (!createChain(json, chain, opt))
+            return EXIT_FAILURE;
+
+        std::map<std::string, int64_t*> vOpt = { {"threads", &opt.threads}, {"memory", &opt.memory}, {"channel", &opt.channel} };
+
+        for (auto& [key, value] : vCmd)
+            if (vOpt.count(key) == 0 || !readNumber(value, *vOpt[key]))
+            {
+                pout("ERROR (gp-filter) ==> Invalid option:", key, value);
+                return EXIT_FAILURE;
+            }
+
+        if (chain.vFilters.empty())
+            pout("WARNING (gp-filter) ==> Filter chain is empty, movies are only converted");
+
+        // Filtering movies
+        const fs::path folder(vArgs[1]);
+        if (!fs::exists(folder))
+            fs::create_directories(folder);
+
+        ThreadPool pool(uint32_t(std::max<int64_t>(opt.threads, 0)));
+
+        int numFailed = 0;
+        for (size_t k = 2; k < vArgs.size(); k++)
+        {
+            fs::path input(vArgs[k]);
+            fs::path output = folder / (input.stem().string() + "_filtered.tif");
+
+            pout("Filtering", input, "->", output);
+
+            if (!filterMovie(input, output, chain, opt, pool))
+            {
+                pout("ERROR (gp-filter) ==> Failed filtering", input);
+                numFailed++;
+            }
+        }
+
+        return numFailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+}
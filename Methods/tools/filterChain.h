@@ -0,0 +1,61 @@
+#pragma once
+
+// Filter chains read from json files, and the command line of gp-filter that streams movies through them
+
+#include "movie.h"
+#include "filters.h"
+#include "threadpool.h"
+
+#include <map>
+#include <variant>
+
+namespace GPT::Tool
+{
+    // Minimal json values, enough for filter chains
+    struct Json
+    {
+        std::variant<std::nullptr_t, bool, double, std::string, std::vector<Json>, std::map<std::string, Json>> value;
+
+        bool isNumber(void) const { return std::holds_alternative<double>(value); }
+        bool isBool(void) const { return std::holds_alternative<bool>(value); }
+        bool isString(void) const { return std::holds_alternative<std::string>(value); }
+        bool isArray(void) const { return std::holds_alternative<std::vector<Json>>(value); }
+        bool isObject(void) const { return std::holds_alternative<std::map<std::string, Json>>(value); }
+
+        double number(void) const { return std::get<double>(value); }
+        bool boolean(void) const { return std::get<bool>(value); }
+        const std::string& string(void) const { return std::get<std::string>(value); }
+        const std::vector<Json>& array(void) const { return std::get<std::vector<Json>>(value); }
+        const std::map<std::string, Json>& object(void) const { return std::get<std::map<std::string, Json>>(value); }
+    };
+
+    bool parseJson(const std::string& text, Json& out);
+
+    struct Chain
+    {
+        std::vector<std::unique_ptr<Filter::Filter>> vFilters;
+        int64_t windowFrames = 0; // frames kept by window filters
+        int64_t numStages = 0;    // per-frame stages holding a batch each
+        bool buffersMovie = false;
+        double low = 0.0, high = 1.0; // range of the filtered values, which is mapped to the 16-bit output
+    };
+
+    struct Options
+    {
+        int64_t threads = 0, memory = 1024, channel = 0;
+    };
+
+    // Parameters have the names of the members they set
+    bool createFilter(const std::map<std::string, Json>& obj, Chain& chain);
+
+    // Reads the filters and the options of a chain file
+    bool createChain(const Json& json, Chain& chain, Options& opt);
+
+    // OME-XML describing the filtered channel, so physical sizes, time points and names survive filtering
+    std::string describeOutput(const Metadata& meta, uint64_t channel);
+
+    bool filterMovie(const fs::path& input, const fs::path& output, Chain& chain, const Options& opt, ThreadPool& pool);
+
+    // Whole command line, without the name of the program. Returns the exit code
+    int runFilter(const std::vector<std::string>& vArgs);
+}
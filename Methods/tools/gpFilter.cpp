@@ -0,0 +1,27 @@
+// Headless filtering for batch jobs. Reads a filter chain from a json file and streams
+// every movie frame by frame through it, so memory doesn't grow with the movie length.
+//
+// Usage: gp-filter <chain.json> <output folder> <movie.tif> [<movie.tif> ...] [options]
+//    --threads N   number of threads, zero means one per core
+//    --memory MB   budget for frames in flight
+//    --channel C   channel to filter
+//
+// Example of chain.json, where options given in the command line take precedence:
+// {
+//     "threads": 8, "memory": 512, "channel": 0,
+//     "filters": [ { "name": "Median", "sizeX": 3, "sizeY": 3 },
+//                  { "name": "Background", "radius": 10, "compensateBleaching": true },
+//                  { "name": "Contrast", "wholeMovie": true } ]
+// }
+//
+// Frames are scaled to [0, 1] by the bit depth of the movie, and saved as 16-bit tif files named
+// after the input movie with "_filtered" appended. Their OME metadata comes from the input movie.
+// DoG and background subtraction can give negative values, so the first one widens the range mapped
+// to 16 bits to [-1, 1] and every later one doubles it, until Contrast or CLAHE maps frames back to [0, 1].
+
+#include "filterChain.h"
+
+int main(int argc, char* argv[])
+{
+    return GPT::Tool::runFilter(std::vector<std::string>(argv + 1, argv + argc));
+}